@@ -0,0 +1,137 @@
+// Opens many connections, each with one channel, lets them go idle and reports
+// the resident memory each one costs. The broker is the stand-in
+// (stand_in_broker.hpp) in a child process, so only the client is measured.
+//
+//   asio_amqp_idle_footprint --count 10000
+//
+// Raise the open file limit (ulimit -n) above count if it is lower.
+
+#include "stand_in_broker.hpp"
+#include <asio_amqp/connection.hpp>
+#include <asio_amqp/channel.hpp>
+#include <boost/asio/use_future.hpp>
+#include <boost/program_options.hpp>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <list>
+#include <thread>
+#include <vector>
+
+namespace po = boost::program_options;
+namespace asio = asio_amqp::asio;
+
+namespace {
+    std::size_t resident_bytes()
+    {
+        std::ifstream statm("/proc/self/statm");
+        std::size_t size = 0, resident = 0;
+        statm >> size >> resident;
+        return resident * std::size_t(::sysconf(_SC_PAGESIZE));
+    }
+
+    void raise_file_limit()
+    {
+        rlimit rl;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+        }
+    }
+
+    struct client
+    {
+        client(asio::io_service& io_service)
+        : conn(io_service)
+        , chan(io_service, conn)
+        {}
+
+        asio_amqp::connection conn;
+        asio_amqp::channel chan;
+    };
+}
+
+int main(int argc, char** argv)
+{
+    std::size_t count, batch;
+
+    po::options_description desc("asio_amqp idle connection footprint benchmark");
+    desc.add_options()
+    ("help", "print this message")
+    ("count", po::value(&count)->default_value(1000), "connections to open")
+    ("batch", po::value(&batch)->default_value(100), "connections opening at once");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::cout << desc << '\n';
+            return 0;
+        }
+        po::notify(vm);
+    }
+    catch(const std::exception& e) {
+        std::cerr << e.what() << '\n' << desc << '\n';
+        return 2;
+    }
+    batch = std::max<std::size_t>(1, batch);
+    raise_file_limit();
+
+    // forked before any thread exists
+    bench::stand_in_process broker;
+    auto uri = "amqp://127.0.0.1:" + std::to_string(broker.port());
+
+    asio::io_service io_service;
+    asio::io_service::work work(io_service);
+    std::thread client_thread([&] { io_service.run(); });
+
+    int result = 0;
+    try {
+        // one connection first, so that library and allocator start up costs
+        // are not charged to the others
+        std::list<client> clients;
+        clients.emplace_back(io_service);
+        clients.back().chan.async_open(uri, asio::use_future).get();
+
+        auto before = resident_bytes();
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t opened = 1 ; opened < count ; )
+        {
+            std::vector<std::future<unsigned int>> pending;
+            for ( ; opened < count and pending.size() < batch ; ++opened) {
+                clients.emplace_back(io_service);
+                pending.push_back(clients.back().chan.async_open(uri, asio::use_future));
+            }
+            for (auto& f : pending) {
+                f.get();
+            }
+        }
+        auto setup = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // let every connection finish reading and go idle
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        auto after = resident_bytes();
+
+        std::size_t held = 0;
+        for (auto& c : clients) {
+            held += c.conn.get_memory_stats().used;
+        }
+        auto measured = std::max<std::size_t>(1, count - 1);
+        std::cout << "connections:          " << count << '\n'
+                  << "setup:                " << setup << " s\n"
+                  << "resident growth:      " << (after - before) / 1024.0 / 1024.0 << " MiB\n"
+                  << "resident per conn:    " << double(after - before) / measured / 1024.0 << " KiB\n"
+                  << "buffers per conn:     " << double(held) / count << " bytes\n";
+    }
+    catch(const std::exception& e) {
+        std::cerr << "error: " << e.what() << '\n';
+        result = 1;
+    }
+
+    io_service.stop();
+    client_thread.join();
+    return result;
+}
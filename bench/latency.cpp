@@ -0,0 +1,150 @@
+// Measures publish -> consume latency through a broker and the CPU it costs.
+// Compare --busy-poll 0 against e.g. --busy-poll 50 to see the effect of
+// spinning the service thread on the tail.
+//
+// The queue must already exist, e.g.
+//   rabbitmqadmin declare queue name=asio_amqp_latency auto_delete=true
+//
+//   asio_amqp_latency --count 100000 --interval 100 --busy-poll 50
+
+#include <asio_amqp/connection.hpp>
+#include <asio_amqp/channel.hpp>
+#include <boost/asio/use_future.hpp>
+#include <boost/program_options.hpp>
+#include <sys/resource.h>
+#include <algorithm>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace po = boost::program_options;
+namespace asio = asio_amqp::asio;
+
+namespace {
+    using clock_type = std::chrono::steady_clock;
+
+    std::chrono::microseconds cpu_time()
+    {
+        rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        return std::chrono::seconds(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec)
+        + std::chrono::microseconds(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+    }
+
+    std::int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now().time_since_epoch()).count();
+    }
+
+    double percentile(const std::vector<std::int64_t>& sorted, double p)
+    {
+        auto index = std::size_t(p * (sorted.size() - 1));
+        return sorted[index] / 1000.0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string host, port, user, password, vhost, queue;
+    std::size_t count, size;
+    long interval, busy_poll, socket_busy_poll;
+
+    po::options_description desc("asio_amqp publish to consume latency benchmark");
+    desc.add_options()
+    ("help", "print this message")
+    ("host", po::value(&host)->default_value("localhost"), "broker host")
+    ("port", po::value(&port)->default_value("5672"), "broker port")
+    ("user", po::value(&user)->default_value("guest"), "login")
+    ("password", po::value(&password)->default_value("guest"), "password")
+    ("vhost", po::value(&vhost)->default_value("/"), "vhost")
+    ("queue", po::value(&queue)->default_value("asio_amqp_latency"), "existing queue to round trip through")
+    ("count", po::value(&count)->default_value(100000), "messages to send")
+    ("size", po::value(&size)->default_value(64), "body size in bytes (at least 8)")
+    ("interval", po::value(&interval)->default_value(100), "microseconds between publishes")
+    ("busy-poll", po::value(&busy_poll)->default_value(0), "service thread spin budget in microseconds")
+    ("socket-busy-poll", po::value(&socket_busy_poll)->default_value(0), "SO_BUSY_POLL in microseconds");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::cout << desc << '\n';
+            return 0;
+        }
+        po::notify(vm);
+    }
+    catch(const std::exception& e) {
+        std::cerr << e.what() << '\n' << desc << '\n';
+        return 2;
+    }
+    size = std::max<std::size_t>(size, sizeof(std::int64_t));
+
+    asio::io_service io_service;
+    asio_amqp::service_options service_options;
+    service_options.busy_poll = std::chrono::microseconds(busy_poll);
+    service_options.socket_busy_poll = std::chrono::microseconds(socket_busy_poll);
+    asio_amqp::configure_connection_service(io_service, service_options);
+
+    asio::io_service::work work(io_service);
+    std::thread client_thread([&] { io_service.run(); });
+
+    int result = 0;
+    try {
+        asio_amqp::connection conn(io_service);
+        conn.async_connect_transport(asio_amqp::connection::query_type(host, port),
+                                     asio::use_future).get();
+        conn.async_connect(AMQP::Login(user, password), vhost, asio::use_future).get();
+
+        asio_amqp::channel chan(io_service, conn);
+        chan.async_open(asio::use_future).get();
+
+        std::vector<std::int64_t> latencies;
+        latencies.reserve(count);
+        std::promise<void> all_received;
+
+        chan.async_consume(queue, [&](asio_amqp::message& msg)
+                           {
+                               std::int64_t sent;
+                               std::memcpy(&sent, msg.body.data(), sizeof(sent));
+                               latencies.push_back(now_ns() - sent);
+                               chan.ack(msg.delivery_tag);
+                               if (latencies.size() == count) {
+                                   all_received.set_value();
+                               }
+                           },
+                           asio::use_future).get();
+
+        auto cpu_before = cpu_time();
+        auto body = std::string(size, 'x');
+        auto next = clock_type::now();
+        for (std::size_t i = 0 ; i < count ; ++i)
+        {
+            std::this_thread::sleep_until(next);
+            next += std::chrono::microseconds(interval);
+            auto now = now_ns();
+            std::memcpy(&body[0], &now, sizeof(now));
+            chan.async_publish("", queue, body, [](asio_amqp::future<void>&) {});
+        }
+        all_received.get_future().get();
+        auto cpu = cpu_time() - cpu_before;
+
+        std::sort(latencies.begin(), latencies.end());
+        std::cout << "busy poll:       " << busy_poll << " us (socket " << socket_busy_poll << " us)\n"
+                  << "messages:        " << count << '\n'
+                  << "p50:             " << percentile(latencies, 0.5) << " us\n"
+                  << "p99:             " << percentile(latencies, 0.99) << " us\n"
+                  << "p99.9:           " << percentile(latencies, 0.999) << " us\n"
+                  << "max:             " << latencies.back() / 1000.0 << " us\n"
+                  << "cpu per message: " << double(cpu.count()) / count << " us\n";
+    }
+    catch(const std::exception& e) {
+        std::cerr << "error: " << e.what() << '\n';
+        result = 1;
+    }
+
+    io_service.stop();
+    client_thread.join();
+    return result;
+}
@@ -0,0 +1,140 @@
+// Compares the per-message cost of the generic publish path, which builds an
+// AMQP::Envelope and lets AMQP-CPP encode every frame, with prepared_publisher,
+// which stamps out pre-encoded frames. It also times the prepared encode on its
+// own, without the connection.
+//
+//   asio_amqp_prepared --count 1000000 --size 128
+
+#include <asio_amqp/connection.hpp>
+#include <asio_amqp/channel.hpp>
+#include <asio_amqp/prepared_publisher.hpp>
+#include <boost/asio/use_future.hpp>
+#include <boost/program_options.hpp>
+#include <sys/resource.h>
+#include <atomic>
+#include <future>
+#include <iostream>
+#include <thread>
+
+namespace po = boost::program_options;
+namespace asio = asio_amqp::asio;
+
+namespace {
+    std::chrono::microseconds cpu_time()
+    {
+        rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        return std::chrono::seconds(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec)
+        + std::chrono::microseconds(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+    }
+
+    /// publish count messages with publish(i, handler) and return cpu us per message
+    template<class Publish>
+    double run(std::size_t count, Publish&& publish)
+    {
+        std::atomic<std::size_t> completed { 0 };
+        std::promise<void> all_done;
+        auto before = cpu_time();
+        for (std::size_t i = 0 ; i < count ; ++i)
+        {
+            publish(i, [&](asio_amqp::future<void>&)
+                    {
+                        if (++completed == count) {
+                            all_done.set_value();
+                        }
+                    });
+        }
+        all_done.get_future().get();
+        return double((cpu_time() - before).count()) / count;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string host, port, user, password, vhost, exchange, routing_key;
+    std::size_t count, size;
+
+    po::options_description desc("asio_amqp prepared publisher benchmark");
+    desc.add_options()
+    ("help", "print this message")
+    ("host", po::value(&host)->default_value("localhost"), "broker host")
+    ("port", po::value(&port)->default_value("5672"), "broker port")
+    ("user", po::value(&user)->default_value("guest"), "login")
+    ("password", po::value(&password)->default_value("guest"), "password")
+    ("vhost", po::value(&vhost)->default_value("/"), "vhost")
+    ("exchange", po::value(&exchange)->default_value("amq.fanout"), "exchange to publish to")
+    ("routing-key", po::value(&routing_key)->default_value("prepared"), "routing key")
+    ("count", po::value(&count)->default_value(1000000), "messages per mode")
+    ("size", po::value(&size)->default_value(128), "body size in bytes");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::cout << desc << '\n';
+            return 0;
+        }
+        po::notify(vm);
+    }
+    catch(const std::exception& e) {
+        std::cerr << e.what() << '\n' << desc << '\n';
+        return 2;
+    }
+
+    asio::io_service io_service;
+    asio::io_service::work work(io_service);
+    std::thread client_thread([&] { io_service.run(); });
+
+    int result = 0;
+    try {
+        asio_amqp::connection conn(io_service);
+        conn.async_connect_transport(asio_amqp::connection::query_type(host, port),
+                                     asio::use_future).get();
+        conn.async_connect(AMQP::Login(user, password), vhost, asio::use_future).get();
+
+        asio_amqp::channel chan(io_service, conn);
+        chan.async_open(asio::use_future).get();
+
+        asio_amqp::message properties;
+        properties.content_type = "application/octet-stream";
+        auto body = std::string(size, 'x');
+
+        asio_amqp::prepared_publisher prepared(chan, exchange, routing_key, properties);
+
+        // encode only
+        std::vector<char> frames;
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0 ; i < count ; ++i) {
+            prepared.encode(body.data(), body.size(), std::string(), std::to_string(i), frames);
+        }
+        auto encode_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+
+        auto generic = run(count, [&](std::size_t i, auto&& handler)
+                           {
+                               auto msg = properties;
+                               msg.exchange = exchange;
+                               msg.routing_key = routing_key;
+                               msg.message_id = std::to_string(i);
+                               msg.body = body;
+                               chan.async_publish(std::move(msg), std::move(handler));
+                           });
+        auto stamped = run(count, [&](std::size_t i, auto&& handler)
+                           {
+                               prepared.async_publish(body, std::string(), std::to_string(i),
+                                                      std::move(handler));
+                           });
+
+        std::cout << "messages:           " << count << " x " << size << " bytes per mode\n"
+                  << "prepared encode:    " << encode_ns << " ns/msg\n"
+                  << "generic publish:    " << generic << " us cpu/msg\n"
+                  << "prepared publish:   " << stamped << " us cpu/msg\n";
+    }
+    catch(const std::exception& e) {
+        std::cerr << "error: " << e.what() << '\n';
+        result = 1;
+    }
+
+    io_service.stop();
+    client_thread.join();
+    return result;
+}
@@ -0,0 +1,184 @@
+// Measures rpc_client round trips. By default the requests go to an in-process
+// stand-in broker (stand_in_broker.hpp) which answers each one immediately, so
+// the figures are the client's overhead plus the loopback. With --host the
+// requests go to a real broker, and --routing-key must name a queue served by
+// an echo server that replies to reply_to with the request's correlation id.
+//
+//   asio_amqp_rpc --count 100000 --window 64
+
+#include "stand_in_broker.hpp"
+#include <asio_amqp/connection.hpp>
+#include <asio_amqp/channel.hpp>
+#include <asio_amqp/rpc_client.hpp>
+#include <boost/asio/use_future.hpp>
+#include <boost/program_options.hpp>
+#include <sys/resource.h>
+#include <algorithm>
+#include <future>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace po = boost::program_options;
+namespace asio = asio_amqp::asio;
+
+namespace {
+    using clock_type = std::chrono::steady_clock;
+
+    std::chrono::microseconds cpu_time()
+    {
+        rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        return std::chrono::seconds(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec)
+        + std::chrono::microseconds(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+    }
+
+    double percentile(const std::vector<std::int64_t>& sorted, double p)
+    {
+        auto index = std::size_t(p * (sorted.size() - 1));
+        return sorted[index] / 1000.0;
+    }
+
+    /// Keeps window calls in flight until count have completed, recording the
+    /// round trip of each. Each call is issued from the previous one's handler.
+    struct driver
+    {
+        asio_amqp::rpc_client& client;
+        asio_amqp::message request;
+        std::size_t count;
+        std::vector<std::int64_t> latencies;
+        std::size_t issued = 0;
+        std::size_t failed = 0;
+        std::promise<void> done;
+
+        void issue()
+        {
+            ++issued;
+            auto start = clock_type::now();
+            client.async_call(request, std::chrono::seconds(5),
+                              [this, start](asio_amqp::future<asio_amqp::message>& f)
+                              {
+                                  if (f.get_exception()) {
+                                      ++failed;
+                                  }
+                                  latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count());
+                                  if (issued < count) {
+                                      issue();
+                                  }
+                                  else if (latencies.size() == count) {
+                                      done.set_value();
+                                  }
+                              });
+        }
+    };
+}
+
+int main(int argc, char** argv)
+{
+    std::string host, port, user, password, vhost, exchange, routing_key;
+    std::size_t count, size, window;
+
+    po::options_description desc("asio_amqp rpc round trip benchmark");
+    desc.add_options()
+    ("help", "print this message")
+    ("host", po::value(&host), "broker host; omit to use the in-process stand-in")
+    ("port", po::value(&port)->default_value("5672"), "broker port")
+    ("user", po::value(&user)->default_value("guest"), "login")
+    ("password", po::value(&password)->default_value("guest"), "password")
+    ("vhost", po::value(&vhost)->default_value("/"), "vhost")
+    ("exchange", po::value(&exchange)->default_value(""), "exchange requests are published to")
+    ("routing-key", po::value(&routing_key)->default_value("asio_amqp_rpc"), "routing key of the echo server")
+    ("count", po::value(&count)->default_value(100000), "calls to make")
+    ("size", po::value(&size)->default_value(64), "request body size in bytes")
+    ("window", po::value(&window)->default_value(1), "calls in flight at once");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::cout << desc << '\n';
+            return 0;
+        }
+        po::notify(vm);
+    }
+    catch(const std::exception& e) {
+        std::cerr << e.what() << '\n' << desc << '\n';
+        return 2;
+    }
+    window = std::max<std::size_t>(1, std::min(window, count));
+
+    // the stand-in gets a thread of its own, like a real broker
+    asio::io_service broker_io;
+    std::unique_ptr<bench::stand_in_broker> broker;
+    std::thread broker_thread;
+    if (host.empty()) {
+        broker = std::make_unique<bench::stand_in_broker>(broker_io);
+        host = "127.0.0.1";
+        port = std::to_string(broker->port());
+        broker_thread = std::thread([&] { broker_io.run(); });
+    }
+
+    // replies complete inline on the thread that receives them
+    asio::io_service io_service;
+    asio::io_service::work work(io_service);
+    asio_amqp::service_options options;
+    options.completion = asio_amqp::completion_policy::dispatch;
+    options.run_on_client_io_service = true;
+    asio_amqp::configure_connection_service(io_service, options);
+    std::thread client_thread([&] { io_service.run(); });
+
+    int result = 0;
+    try {
+        asio_amqp::connection conn(io_service);
+        conn.async_connect_transport(asio_amqp::connection::query_type(host, port),
+                                     asio::use_future).get();
+        conn.async_connect(AMQP::Login(user, password), vhost, asio::use_future).get();
+
+        asio_amqp::channel chan(io_service, conn);
+        chan.async_open(asio::use_future).get();
+
+        asio_amqp::rpc_client client(chan);
+        client.async_start(asio::use_future).get();
+
+        driver d { client, asio_amqp::message(), count };
+        d.request.exchange = exchange;
+        d.request.routing_key = routing_key;
+        d.request.body = std::string(size, 'x');
+        d.latencies.reserve(count);
+
+        auto cpu_before = cpu_time();
+        auto wall_before = clock_type::now();
+        io_service.post([&d, window]
+                        {
+                            for (std::size_t i = 0 ; i < window ; ++i) {
+                                d.issue();
+                            }
+                        });
+        d.done.get_future().get();
+        auto wall = std::chrono::duration<double>(clock_type::now() - wall_before).count();
+        auto cpu = cpu_time() - cpu_before;
+
+        std::sort(d.latencies.begin(), d.latencies.end());
+        std::cout << "broker:          " << (broker ? "stand-in" : host) << '\n'
+                  << "calls:           " << count << " (" << d.failed << " failed), window " << window << '\n'
+                  << "calls per sec:   " << count / wall << '\n'
+                  << "p50:             " << percentile(d.latencies, 0.5) << " us\n"
+                  << "p99:             " << percentile(d.latencies, 0.99) << " us\n"
+                  << "p99.9:           " << percentile(d.latencies, 0.999) << " us\n"
+                  << "max:             " << d.latencies.back() / 1000.0 << " us\n"
+                  << "cpu per call:    " << double(cpu.count()) / count << " us"
+                  << (broker ? " (including the stand-in)\n" : "\n");
+    }
+    catch(const std::exception& e) {
+        std::cerr << "error: " << e.what() << '\n';
+        result = 1;
+    }
+
+    io_service.stop();
+    client_thread.join();
+    if (broker) {
+        broker_io.stop();
+        broker_thread.join();
+    }
+    return result;
+}
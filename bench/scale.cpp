@@ -0,0 +1,291 @@
+// Opens many connections through one connection_service, keeps them
+// heartbeating, then makes a low rate of rpc calls on each. Reports setup
+// time, resident memory, cpu per connection while idle and while busy, and
+// round trip latency. The broker is the stand-in (stand_in_broker.hpp) in a
+// child process, so only the client is measured; it heartbeats every
+// --heartbeat seconds and answers each call at once.
+//
+//   asio_amqp_scale --connections 10000 --rate 1 --duration 30
+//
+// --max-kib-per-connection and --max-p99-us turn it into a regression check:
+// it exits with 1 when either is exceeded. Raise the open file limit
+// (ulimit -n) above the connection count if it is lower.
+
+#include "stand_in_broker.hpp"
+#include <asio_amqp/connection.hpp>
+#include <asio_amqp/channel.hpp>
+#include <asio_amqp/rpc_client.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/use_future.hpp>
+#include <boost/program_options.hpp>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace po = boost::program_options;
+namespace asio = asio_amqp::asio;
+
+namespace {
+    using clock_type = std::chrono::steady_clock;
+
+    std::size_t resident_bytes()
+    {
+        std::ifstream statm("/proc/self/statm");
+        std::size_t size = 0, resident = 0;
+        statm >> size >> resident;
+        return resident * std::size_t(::sysconf(_SC_PAGESIZE));
+    }
+
+    std::chrono::microseconds cpu_time()
+    {
+        rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        return std::chrono::seconds(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec)
+        + std::chrono::microseconds(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+    }
+
+    void raise_file_limit()
+    {
+        rlimit rl;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+        }
+    }
+
+    double percentile(const std::vector<std::int64_t>& sorted, double p)
+    {
+        if (sorted.empty()) { return 0; }
+        return sorted[std::size_t(p * (sorted.size() - 1))] / 1000.0;
+    }
+
+    struct client
+    {
+        client(asio::io_service& io_service)
+        : conn(io_service)
+        , chan(io_service, conn)
+        {}
+
+        asio_amqp::connection conn;
+        asio_amqp::channel chan;
+        std::unique_ptr<asio_amqp::rpc_client> rpc;
+    };
+
+    /// Spreads calls evenly over the clients at a fixed total rate. Runs on
+    /// the client io_service, as do the completions of its calls.
+    struct driver
+    {
+        driver(asio::io_service& io_service, std::vector<client*>& clients, double total_rate)
+        : timer(io_service)
+        , clients(clients)
+        , total_rate(total_rate)
+        {
+            request.routing_key = "asio_amqp_scale";
+            request.body = std::string(64, 'x');
+        }
+
+        void start(clock_type::duration duration)
+        {
+            started = clock_type::now();
+            until = started + duration;
+            tick();
+        }
+
+        void tick()
+        {
+            auto now = clock_type::now();
+            if (now >= until) {
+                stopping = true;
+                check_done();
+                return;
+            }
+            auto due = std::size_t(total_rate * std::chrono::duration<double>(now - started).count());
+            for ( ; issued < due ; ++issued) {
+                call(*clients[next++ % clients.size()]);
+            }
+            timer.expires_from_now(std::chrono::milliseconds(5));
+            timer.async_wait([this](const asio_amqp::system::error_code& ec)
+                             {
+                                 if (not ec) {
+                                     tick();
+                                 }
+                             });
+        }
+
+        void call(client& c)
+        {
+            auto start = clock_type::now();
+            c.rpc->async_call(request, std::chrono::seconds(10),
+                              [this, start](asio_amqp::future<asio_amqp::message>& f)
+                              {
+                                  if (f.get_exception()) {
+                                      ++failed;
+                                  }
+                                  latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count());
+                                  check_done();
+                              });
+        }
+
+        void check_done()
+        {
+            if (stopping and latencies.size() == issued and not finished) {
+                finished = true;
+                done.set_value();
+            }
+        }
+
+        asio::steady_timer timer;
+        std::vector<client*>& clients;
+        double total_rate;
+        asio_amqp::message request;
+        clock_type::time_point started, until;
+        std::size_t issued = 0;
+        std::size_t next = 0;
+        std::size_t failed = 0;
+        bool stopping = false;
+        bool finished = false;
+        std::vector<std::int64_t> latencies;
+        std::promise<void> done;
+    };
+}
+
+int main(int argc, char** argv)
+{
+    std::size_t connections, batch, service_threads;
+    double rate, max_kib, max_p99;
+    long heartbeat, idle, duration;
+
+    po::options_description desc("asio_amqp connection scaling benchmark");
+    desc.add_options()
+    ("help", "print this message")
+    ("connections", po::value(&connections)->default_value(10000), "connections to open")
+    ("batch", po::value(&batch)->default_value(200), "connections opening at once")
+    ("service-threads", po::value(&service_threads)->default_value(0), "threads of a shared io_thread_pool; 0 for the service's own thread")
+    ("heartbeat", po::value(&heartbeat)->default_value(5), "heartbeat interval in seconds")
+    ("idle", po::value(&idle)->default_value(10), "seconds spent idle, heartbeating only")
+    ("rate", po::value(&rate)->default_value(1.0), "calls per second per connection")
+    ("duration", po::value(&duration)->default_value(30), "seconds of calls")
+    ("max-kib-per-connection", po::value(&max_kib)->default_value(0), "fail above this resident KiB per connection; 0 disables")
+    ("max-p99-us", po::value(&max_p99)->default_value(0), "fail above this p99 round trip; 0 disables");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::cout << desc << '\n';
+            return 0;
+        }
+        po::notify(vm);
+    }
+    catch(const std::exception& e) {
+        std::cerr << e.what() << '\n' << desc << '\n';
+        return 2;
+    }
+    connections = std::max<std::size_t>(1, connections);
+    batch = std::max<std::size_t>(1, batch);
+    raise_file_limit();
+
+    // forked before any thread exists
+    bench::stand_in_process broker { std::chrono::seconds(heartbeat) };
+    auto uri = "amqp://127.0.0.1:" + std::to_string(broker.port());
+
+    asio::io_service io_service;
+    asio::io_service::work work(io_service);
+    asio_amqp::service_options options;
+    options.shared_pool_threads = service_threads;
+    asio_amqp::configure_connection_service(io_service, options);
+    std::thread client_thread([&] { io_service.run(); });
+
+    int result = 0;
+    try {
+        auto rss_before = resident_bytes();
+        auto cpu_before = cpu_time();
+        auto setup_start = clock_type::now();
+
+        std::list<client> clients;
+        std::vector<client*> open;
+        open.reserve(connections);
+        while (open.size() < connections)
+        {
+            std::vector<std::pair<client*, std::future<unsigned int>>> pending;
+            while (open.size() + pending.size() < connections and pending.size() < batch) {
+                clients.emplace_back(io_service);
+                pending.emplace_back(&clients.back(), clients.back().chan.async_open(uri, asio::use_future));
+            }
+            std::vector<std::future<void>> starting;
+            for (auto& p : pending) {
+                p.second.get();
+                p.first->rpc = std::make_unique<asio_amqp::rpc_client>(p.first->chan);
+                starting.push_back(p.first->rpc->async_start(asio::use_future));
+                open.push_back(p.first);
+            }
+            for (auto& f : starting) {
+                f.get();
+            }
+        }
+        auto setup = std::chrono::duration<double>(clock_type::now() - setup_start).count();
+        auto setup_cpu = cpu_time() - cpu_before;
+        auto rss_setup = resident_bytes();
+
+        auto idle_cpu_before = cpu_time();
+        std::this_thread::sleep_for(std::chrono::seconds(idle));
+        auto idle_cpu = cpu_time() - idle_cpu_before;
+        auto rss_idle = resident_bytes();
+
+        driver d(io_service, open, rate * connections);
+        d.latencies.reserve(std::size_t(rate * connections * duration) + 1);
+        auto busy_cpu_before = cpu_time();
+        io_service.post([&] { d.start(std::chrono::seconds(duration)); });
+        d.done.get_future().get();
+        auto busy_cpu = cpu_time() - busy_cpu_before;
+        auto rss_busy = resident_bytes();
+        std::sort(d.latencies.begin(), d.latencies.end());
+
+        auto per_connection_kib = [&](std::size_t rss) { return (double(rss) - double(rss_before)) / connections / 1024.0; };
+        auto cpu_per_connection = [&](std::chrono::microseconds cpu, long seconds) {
+            return seconds ? double(cpu.count()) / connections / seconds : 0.0;
+        };
+        auto p99 = percentile(d.latencies, 0.99);
+        std::cout << "connections:            " << connections << '\n'
+                  << "setup:                  " << setup << " s, "
+                  << double(setup_cpu.count()) / connections << " us cpu per connection\n"
+                  << "resident per conn:      " << per_connection_kib(rss_setup) << " KiB after setup, "
+                  << per_connection_kib(rss_idle) << " idle, " << per_connection_kib(rss_busy) << " busy\n"
+                  << "cpu per conn, idle:     " << cpu_per_connection(idle_cpu, idle) << " us/s\n"
+                  << "cpu per conn, busy:     " << cpu_per_connection(busy_cpu, duration) << " us/s at "
+                  << rate << " calls/s\n"
+                  << "calls:                  " << d.latencies.size() << " (" << d.failed << " failed)\n"
+                  << "p50:                    " << percentile(d.latencies, 0.5) << " us\n"
+                  << "p99:                    " << p99 << " us\n"
+                  << "p99.9:                  " << percentile(d.latencies, 0.999) << " us\n"
+                  << "max:                    " << (d.latencies.empty() ? 0 : d.latencies.back() / 1000.0) << " us\n";
+
+        auto worst_kib = std::max(per_connection_kib(rss_idle), per_connection_kib(rss_busy));
+        if (max_kib > 0 and worst_kib > max_kib) {
+            std::cerr << "resident per connection " << worst_kib << " KiB exceeds " << max_kib << '\n';
+            result = 1;
+        }
+        if (max_p99 > 0 and p99 > max_p99) {
+            std::cerr << "p99 " << p99 << " us exceeds " << max_p99 << '\n';
+            result = 1;
+        }
+        if (d.failed) {
+            result = 1;
+        }
+    }
+    catch(const std::exception& e) {
+        std::cerr << "error: " << e.what() << '\n';
+        result = 1;
+    }
+
+    io_service.stop();
+    client_thread.join();
+    return result;
+}
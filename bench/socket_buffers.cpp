@@ -0,0 +1,298 @@
+// Shows how socket_options::send_buffer limits publish throughput over a link
+// with a large bandwidth-delay product, without tc/netem. The client talks to
+// the in-process stand-in broker (stand_in_broker.hpp) through delay_link, a
+// proxy that models the path: bytes read from the client reach the broker
+// rtt/2 later, and no more than the path's bandwidth-delay product may be in
+// flight. The window is fixed by --link-mbit and --rtt-ms, whatever the client
+// asks for. The proxy keeps its own receive buffer minimal, so bytes waiting
+// for the link queue in the client's SO_SNDBUF; each row shows how close a
+// given send buffer comes to the link rate.
+//
+//   asio_amqp_socket_buffers --rtt-ms 40 --link-mbit 1000 --mbytes 32
+
+#include "stand_in_broker.hpp"
+#include <asio_amqp/connection.hpp>
+#include <asio_amqp/channel.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/program_options.hpp>
+#include <boost/asio/use_future.hpp>
+#include <atomic>
+#include <deque>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace po = boost::program_options;
+namespace asio = asio_amqp::asio;
+
+namespace {
+    using clock_type = std::chrono::steady_clock;
+
+    /// A proxy between the client and upstream modelling a path of a given
+    /// round trip time. Only the client to upstream direction is delayed.
+    struct delay_link
+    {
+        delay_link(asio::io_service& io_service, unsigned short upstream,
+                   clock_type::duration rtt, std::size_t window)
+        : _io_service(io_service)
+        , _acceptor(io_service, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0))
+        , _upstream(upstream)
+        , _rtt(rtt)
+        , _window(window)
+        {
+            // inherited by accepted sockets; the kernel rounds it up to its minimum
+            _acceptor.set_option(asio::socket_base::receive_buffer_size(1));
+            accept();
+        }
+
+        unsigned short port() const {
+            return _acceptor.local_endpoint().port();
+        }
+
+        /// Bytes that have reached upstream
+        std::size_t delivered() const {
+            return _delivered.load();
+        }
+
+    private:
+        struct chunk
+        {
+            clock_type::time_point arrives;
+            std::vector<char> data;
+        };
+
+        struct session : std::enable_shared_from_this<session>
+        {
+            session(delay_link& link)
+            : link(link)
+            , client(link._io_service)
+            , upstream(link._io_service)
+            , arrival_timer(link._io_service)
+            {}
+
+            void start()
+            {
+                upstream.connect(asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), link._upstream));
+                upstream.set_option(asio::ip::tcp::no_delay(true));
+                relay_back();
+                read_client();
+            }
+
+            /// upstream to client is forwarded undelayed
+            void relay_back()
+            {
+                upstream.async_read_some(asio::buffer(back),
+                                         [self = shared_from_this()](const asio_amqp::system::error_code& ec, std::size_t n)
+                                         {
+                                             if (ec) { return; }
+                                             asio_amqp::system::error_code sink;
+                                             asio::write(self->client, asio::buffer(self->back, n), sink);
+                                             self->relay_back();
+                                         });
+            }
+
+            void read_client()
+            {
+                auto window = link._window;
+                if (reading or in_flight >= window) {
+                    return;
+                }
+                reading = true;
+                auto room = std::min(window - in_flight, sizeof(forth));
+                client.async_read_some(asio::buffer(forth, room),
+                                       [self = shared_from_this()](const asio_amqp::system::error_code& ec, std::size_t n)
+                                       {
+                                           self->reading = false;
+                                           if (ec) { return; }
+                                           self->sent(n);
+                                           self->read_client();
+                                       });
+            }
+
+            /// n bytes leave the client: they arrive upstream after rtt/2 and
+            /// their acknowledgement frees the window after rtt
+            void sent(std::size_t n)
+            {
+                in_flight += n;
+                auto now = clock_type::now();
+                chunks.push_back(chunk { now + link._rtt / 2, std::vector<char>(forth, forth + n) });
+                if (chunks.size() == 1) {
+                    schedule_arrival();
+                }
+                auto timer = std::make_shared<asio::steady_timer>(link._io_service);
+                timer->expires_at(now + link._rtt);
+                timer->async_wait([self = shared_from_this(), timer, n](const asio_amqp::system::error_code&)
+                                  {
+                                      self->in_flight -= n;
+                                      self->read_client();
+                                  });
+            }
+
+            void schedule_arrival()
+            {
+                arrival_timer.expires_at(chunks.front().arrives);
+                arrival_timer.async_wait([self = shared_from_this()](const asio_amqp::system::error_code&)
+                                         {
+                                             auto now = clock_type::now();
+                                             while (not self->chunks.empty() and self->chunks.front().arrives <= now)
+                                             {
+                                                 auto& c = self->chunks.front();
+                                                 asio_amqp::system::error_code sink;
+                                                 asio::write(self->upstream, asio::buffer(c.data), sink);
+                                                 self->link._delivered += c.data.size();
+                                                 self->chunks.pop_front();
+                                             }
+                                             if (not self->chunks.empty()) {
+                                                 self->schedule_arrival();
+                                             }
+                                         });
+            }
+
+            delay_link& link;
+            asio::ip::tcp::socket client;
+            asio::ip::tcp::socket upstream;
+            asio::steady_timer arrival_timer;
+            std::deque<chunk> chunks;
+            std::size_t in_flight = 0;
+            bool reading = false;
+            char forth[64 * 1024];
+            char back[64 * 1024];
+        };
+
+        void accept()
+        {
+            auto s = std::make_shared<session>(*this);
+            _acceptor.async_accept(s->client, [this, s](const asio_amqp::system::error_code& ec)
+                                   {
+                                       if (ec) { return; }
+                                       s->start();
+                                       accept();
+                                   });
+        }
+
+        asio::io_service& _io_service;
+        asio::ip::tcp::acceptor _acceptor;
+        unsigned short _upstream;
+        clock_type::duration _rtt;
+        const std::size_t _window;
+        std::atomic<std::size_t> _delivered { 0 };
+    };
+
+    struct row
+    {
+        int requested;
+        int effective;
+        double mbit_per_sec;
+    };
+
+    row run(int send_buffer, clock_type::duration rtt, std::size_t window,
+            std::size_t total, std::size_t message_size, unsigned short broker_port)
+    {
+        asio::io_service link_io;
+        delay_link link(link_io, broker_port, rtt, window);
+        std::thread link_thread([&] { link_io.run(); });
+
+        asio::io_service io_service;
+        asio::io_service::work work(io_service);
+        asio_amqp::service_options options;
+        options.socket.send_buffer = send_buffer;
+        asio_amqp::configure_connection_service(io_service, options);
+        std::thread client_thread([&] { io_service.run(); });
+
+        row result { send_buffer, 0, 0 };
+        {
+            asio_amqp::connection conn(io_service);
+            asio_amqp::channel chan(io_service, conn);
+            chan.async_open("amqp://127.0.0.1:" + std::to_string(link.port()), asio::use_future).get();
+
+            asio::socket_base::send_buffer_size reported;
+            conn.get_impl_ptr()->socket().get_option(reported);
+            result.effective = reported.value();
+
+            auto before = link.delivered();
+            auto body = std::string(message_size, 'x');
+            auto start = clock_type::now();
+            for (std::size_t sent = 0 ; sent < total ; sent += message_size) {
+                chan.async_publish("", "asio_amqp_socket_buffers", body, [](asio_amqp::future<void>&) {});
+            }
+            // frame overhead is ignored: under 0.1% at the default message size
+            while (link.delivered() - before < total) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            auto elapsed = std::chrono::duration<double>(clock_type::now() - start).count();
+            result.mbit_per_sec = total * 8 / elapsed / 1e6;
+        }
+
+        io_service.stop();
+        client_thread.join();
+        link_io.stop();
+        link_thread.join();
+        return result;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    long rtt_ms;
+    double link_mbit;
+    std::size_t mbytes, message_size;
+    std::vector<int> sizes;
+
+    po::options_description desc("asio_amqp socket buffer benchmark");
+    desc.add_options()
+    ("help", "print this message")
+    ("rtt-ms", po::value(&rtt_ms)->default_value(40), "modelled round trip time")
+    ("link-mbit", po::value(&link_mbit)->default_value(1000), "modelled link rate, which with rtt-ms fixes the window")
+    ("mbytes", po::value(&mbytes)->default_value(32), "megabytes published per row")
+    ("message-size", po::value(&message_size)->default_value(128 * 1024), "body size in bytes")
+    ("send-buffer", po::value(&sizes)->multitoken(), "SO_SNDBUF values to try, 0 for the system default");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::cout << desc << '\n';
+            return 0;
+        }
+        po::notify(vm);
+    }
+    catch(const std::exception& e) {
+        std::cerr << e.what() << '\n' << desc << '\n';
+        return 2;
+    }
+    if (sizes.empty()) {
+        sizes = { 0, 64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024 };
+    }
+    message_size = std::max<std::size_t>(1, message_size);
+
+    asio::io_service broker_io;
+    bench::stand_in_broker broker(broker_io);
+    std::thread broker_thread([&] { broker_io.run(); });
+
+    int result = 0;
+    try {
+        auto rtt = std::chrono::milliseconds(rtt_ms);
+        // at least one full-size read per round trip
+        auto window = std::max<std::size_t>(64 * 1024, std::size_t(link_mbit * 1e6 / 8 * rtt_ms / 1000));
+        std::cout << "rtt " << rtt_ms << " ms, link " << link_mbit << " Mbit/s, window "
+                  << window << " bytes, " << mbytes << " MB per row\n"
+                  << "SO_SNDBUF requested   effective   Mbit/s\n";
+        for (auto size : sizes)
+        {
+            auto r = run(size, rtt, window, mbytes * 1024 * 1024, message_size, broker.port());
+            std::cout << std::setw(19) << (size ? std::to_string(size) : std::string("default"))
+                      << std::setw(12) << r.effective
+                      << std::setw(9) << std::fixed << std::setprecision(1) << r.mbit_per_sec << '\n';
+        }
+    }
+    catch(const std::exception& e) {
+        std::cerr << "error: " << e.what() << '\n';
+        result = 1;
+    }
+
+    broker_io.stop();
+    broker_thread.join();
+    return result;
+}
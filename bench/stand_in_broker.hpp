@@ -0,0 +1,406 @@
+#pragma once
+// A loopback stand-in for a broker, speaking just enough AMQP 0-9-1 for the
+// benchmarks to run without RabbitMQ: the connection and channel handshakes,
+// basic.consume and basic.publish. A publish that carries reply-to is answered
+// at once with a basic.deliver of the same body and correlation id to the
+// channel's consumer, as a direct reply-to RPC server would; other publishes,
+// and those routed to stand_in_broker::unanswered, are dropped. Login is not
+// checked and nothing is queued.
+//
+// Latency measured against it is the client's overhead plus the loopback, so
+// it isolates the library from broker latency.
+//
+// With a non-zero heartbeat the stand-in proposes it in connection.tune and
+// sends a heartbeat frame that often, which the client answers.
+
+#include <asio_amqp/config.hpp>
+#include <asio_amqp/detail/frame_encoder.hpp>
+#include <asio_amqp/detail/frame_scanner.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/write.hpp>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+    namespace asio = asio_amqp::asio;
+    using asio_amqp::detail::frame_encoder;
+
+    struct stand_in_broker
+    {
+        /// Listen on 127.0.0.1 on an ephemeral port. Sessions run on io_service.
+        explicit stand_in_broker(asio::io_service& io_service,
+                                 std::chrono::seconds heartbeat = std::chrono::seconds(0))
+        : _io_service(io_service)
+        , _acceptor(io_service, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0))
+        , _heartbeat(heartbeat)
+        {
+            accept();
+        }
+
+        unsigned short port() const {
+            return _acceptor.local_endpoint().port();
+        }
+
+        /// requests published with this routing key are never answered
+        static constexpr const char* unanswered = "stand-in.unanswered";
+
+    private:
+        /// reads big endian fields from a frame payload
+        struct reader
+        {
+            const unsigned char* p;
+            const unsigned char* end;
+
+            std::uint8_t u8() { return *p++; }
+            std::uint16_t u16() { auto v = std::uint16_t(p[0] << 8 | p[1]); p += 2; return v; }
+            std::uint32_t u32() { auto v = std::uint32_t(u16()) << 16; return v | u16(); }
+            std::uint64_t u64() { auto v = std::uint64_t(u32()) << 32; return v | u32(); }
+            std::string shortstr() { auto n = u8(); std::string s(p, p + n); p += n; return s; }
+            void skip_long() { auto n = u32(); p += n; }
+        };
+
+        struct publish
+        {
+            std::string routing_key;
+            std::string reply_to;
+            std::string correlation_id;
+            std::uint64_t remaining = 0;
+            std::string body;
+        };
+
+        struct session : std::enable_shared_from_this<session>
+        {
+            session(asio::io_service& io_service, std::chrono::seconds heartbeat)
+            : socket(io_service)
+            , heartbeat(heartbeat)
+            , heartbeat_timer(io_service)
+            {}
+
+            void start()
+            {
+                socket.set_option(asio::ip::tcp::no_delay(true));
+                read();
+            }
+
+            void read()
+            {
+                auto used = input.size();
+                input.resize(used + 64 * 1024);
+                socket.async_read_some(asio::buffer(&input[used], 64 * 1024),
+                                       [self = shared_from_this(), used](const asio_amqp::system::error_code& ec,
+                                                                         std::size_t n)
+                                       {
+                                           self->input.resize(used + n);
+                                           if (ec or not self->consume_input()) {
+                                               self->heartbeat_timer.cancel();
+                                               return;
+                                           }
+                                           self->flush();
+                                           self->read();
+                                       });
+            }
+
+            /// false once the connection should end
+            bool consume_input()
+            {
+                std::size_t pos = 0;
+                if (not greeted)
+                {
+                    if (input.size() < 8) { return true; }
+                    if (std::memcmp(input.data(), "AMQP\0\0\x09\x01", 8) != 0) { return false; }
+                    greeted = true;
+                    pos = 8;
+                    send_start();
+                }
+                auto scan = asio_amqp::detail::scan_frames(input.data() + pos, input.size() - pos);
+                if (scan.malformed) { return false; }
+                auto p = reinterpret_cast<const unsigned char*>(input.data() + pos);
+                auto end = p + scan.bytes;
+                while (p < end)
+                {
+                    auto size = asio_amqp::detail::read_frame_size(p);
+                    auto channel = std::uint16_t(p[1] << 8 | p[2]);
+                    reader r { p + asio_amqp::detail::frame_header_size,
+                               p + asio_amqp::detail::frame_header_size + size };
+                    if (not handle(p[0], channel, r)) { return false; }
+                    p += size + asio_amqp::detail::frame_overhead;
+                }
+                input.erase(input.begin(), input.begin() + pos + scan.bytes);
+                return true;
+            }
+
+            bool handle(std::uint8_t type, std::uint16_t channel, reader& r)
+            {
+                switch (type)
+                {
+                    case frame_encoder::method_frame: return handle_method(channel, r);
+                    case frame_encoder::header_frame: handle_header(channel, r); return true;
+                    case frame_encoder::body_frame: handle_body(channel, r); return true;
+                    default: return true;   // heartbeats
+                }
+            }
+
+            bool handle_method(std::uint16_t channel, reader& r)
+            {
+                auto class_id = r.u16();
+                auto method_id = r.u16();
+                switch (class_id << 16 | method_id)
+                {
+                    case 10 << 16 | 11:         // connection.start-ok
+                        method(0, 10, 30, [this](frame_encoder& e)
+                               {
+                                   e.put16(2047);
+                                   e.put32(131072);
+                                   e.put16(std::uint16_t(heartbeat.count()));
+                               });
+                        break;
+                    case 10 << 16 | 40:         // connection.open
+                        method(0, 10, 41, [](frame_encoder& e) { e.put8(0); });
+                        if (heartbeat.count()) {
+                            beat();
+                        }
+                        break;
+                    case 10 << 16 | 50:         // connection.close
+                        method(0, 10, 51, [](frame_encoder&) {});
+                        flush();
+                        return false;
+                    case 20 << 16 | 10:         // channel.open
+                        method(channel, 20, 11, [](frame_encoder& e) { e.put32(0); });
+                        break;
+                    case 20 << 16 | 40:         // channel.close
+                        consumers.erase(channel);
+                        method(channel, 20, 41, [](frame_encoder&) {});
+                        break;
+                    case 60 << 16 | 20:         // basic.consume
+                    {
+                        r.u16();
+                        r.shortstr();           // queue
+                        auto tag = r.shortstr();
+                        if (tag.empty()) {
+                            tag = "amq.ctag-" + std::to_string(++next_tag);
+                        }
+                        consumers[channel] = tag;
+                        method(channel, 60, 21, [&tag](frame_encoder& e) { e.put_shortstr(tag); });
+                    } break;
+                    case 60 << 16 | 40:         // basic.publish
+                    {
+                        auto& pub = publishes[channel] = publish();
+                        r.u16();
+                        r.shortstr();           // exchange
+                        pub.routing_key = r.shortstr();
+                    } break;
+                    default:                    // tune-ok, acks and anything unsupported
+                        break;
+                }
+                return true;
+            }
+
+            void handle_header(std::uint16_t channel, reader& r)
+            {
+                auto& pub = publishes[channel];
+                r.u16();                        // class
+                r.u16();                        // weight
+                pub.remaining = r.u64();
+                auto flags = r.u16();
+                if (flags & frame_encoder::content_type_flag) r.shortstr();
+                if (flags & frame_encoder::content_encoding_flag) r.shortstr();
+                if (flags & frame_encoder::headers_flag) r.skip_long();
+                if (flags & frame_encoder::delivery_mode_flag) r.u8();
+                if (flags & frame_encoder::priority_flag) r.u8();
+                if (flags & frame_encoder::correlation_id_flag) pub.correlation_id = r.shortstr();
+                if (flags & frame_encoder::reply_to_flag) pub.reply_to = r.shortstr();
+                if (not pub.remaining) {
+                    complete(channel, pub);
+                }
+            }
+
+            void handle_body(std::uint16_t channel, reader& r)
+            {
+                auto& pub = publishes[channel];
+                auto size = std::size_t(r.end - r.p);
+                pub.body.append(reinterpret_cast<const char*>(r.p), size);
+                pub.remaining -= std::min<std::uint64_t>(pub.remaining, size);
+                if (not pub.remaining) {
+                    complete(channel, pub);
+                }
+            }
+
+            /// answer a request as a direct reply-to server would
+            void complete(std::uint16_t channel, publish& pub)
+            {
+                auto consumer = consumers.find(channel);
+                if (pub.reply_to.empty() or consumer == consumers.end() or pub.routing_key == unanswered) {
+                    return;
+                }
+                frame_encoder e(output);
+                e.begin_frame(frame_encoder::method_frame, channel);
+                e.put16(60);
+                e.put16(60);                    // basic.deliver
+                e.put_shortstr(consumer->second);
+                e.put64(++delivery_tag);
+                e.put8(0);                      // redelivered
+                e.put_shortstr("");
+                e.put_shortstr(pub.reply_to);
+                e.end_frame();
+                std::uint16_t flags = pub.correlation_id.empty() ? 0 : frame_encoder::correlation_id_flag;
+                e.begin_content_header(channel, pub.body.size(), flags);
+                if (flags) {
+                    e.put_shortstr(pub.correlation_id);
+                }
+                e.end_frame();
+                e.body_frames(channel, pub.body.data(), pub.body.size(), 131072 - asio_amqp::detail::frame_overhead);
+            }
+
+            void beat()
+            {
+                heartbeat_timer.expires_from_now(heartbeat);
+                heartbeat_timer.async_wait([self = shared_from_this()](const asio_amqp::system::error_code& ec)
+                                           {
+                                               if (ec) { return; }
+                                               frame_encoder(self->output).heartbeat();
+                                               self->flush();
+                                               self->beat();
+                                           });
+            }
+
+            void send_start()
+            {
+                method(0, 10, 10, [](frame_encoder& e)
+                       {
+                           e.put8(0);
+                           e.put8(9);
+                           e.put32(0);          // server properties
+                           e.put32(5);
+                           e.put_bytes("PLAIN", 5);
+                           e.put32(5);
+                           e.put_bytes("en_US", 5);
+                       });
+            }
+
+            template<class Args>
+            void method(std::uint16_t channel, std::uint16_t class_id, std::uint16_t method_id, Args&& args)
+            {
+                frame_encoder e(output);
+                e.begin_frame(frame_encoder::method_frame, channel);
+                e.put16(class_id);
+                e.put16(method_id);
+                args(e);
+                e.end_frame();
+            }
+
+            void flush()
+            {
+                if (writing or output.empty()) { return; }
+                writing = true;
+                std::swap(output, sending);
+                asio::async_write(socket, asio::buffer(sending),
+                                  [self = shared_from_this()](const asio_amqp::system::error_code& ec, std::size_t)
+                                  {
+                                      self->writing = false;
+                                      self->sending.clear();
+                                      if (not ec) {
+                                          self->flush();
+                                      }
+                                  });
+            }
+
+            asio::ip::tcp::socket socket;
+            std::chrono::seconds heartbeat;
+            asio::steady_timer heartbeat_timer;
+            std::vector<char> input;
+            std::vector<char> output;
+            std::vector<char> sending;
+            bool writing = false;
+            bool greeted = false;
+            std::map<std::uint16_t, std::string> consumers;
+            std::map<std::uint16_t, publish> publishes;
+            std::uint64_t delivery_tag = 0;
+            unsigned next_tag = 0;
+        };
+
+        void accept()
+        {
+            auto s = std::make_shared<session>(_io_service, _heartbeat);
+            _acceptor.async_accept(s->socket, [this, s](const asio_amqp::system::error_code& ec)
+                                   {
+                                       if (ec) { return; }
+                                       s->start();
+                                       accept();
+                                   });
+        }
+
+        asio::io_service& _io_service;
+        asio::ip::tcp::acceptor _acceptor;
+        std::chrono::seconds _heartbeat;
+    };
+
+    /// A stand_in_broker in a child process, so that its memory and cpu are
+    /// not counted against the client. Create it before starting any threads.
+    struct stand_in_process
+    {
+        explicit stand_in_process(std::chrono::seconds heartbeat = std::chrono::seconds(0))
+        {
+            int fds[2];
+            if (::pipe(fds) != 0) {
+                throw std::runtime_error("pipe failed");
+            }
+            _pid = ::fork();
+            if (_pid < 0) {
+                throw std::runtime_error("fork failed");
+            }
+            if (_pid == 0)
+            {
+                ::close(fds[0]);
+                try {
+                    asio::io_service io_service;
+                    stand_in_broker broker(io_service, heartbeat);
+                    auto port = broker.port();
+                    if (::write(fds[1], &port, sizeof(port)) != sizeof(port)) {
+                        ::_exit(1);
+                    }
+                    ::close(fds[1]);
+                    io_service.run();
+                }
+                catch(...) {
+                    ::_exit(1);
+                }
+                ::_exit(0);
+            }
+            ::close(fds[1]);
+            auto n = ::read(fds[0], &_port, sizeof(_port));
+            ::close(fds[0]);
+            if (n != sizeof(_port)) {
+                throw std::runtime_error("stand-in broker did not start");
+            }
+        }
+
+        stand_in_process(const stand_in_process&) = delete;
+        stand_in_process& operator=(const stand_in_process&) = delete;
+
+        ~stand_in_process()
+        {
+            ::kill(_pid, SIGTERM);
+            ::waitpid(_pid, nullptr, 0);
+        }
+
+        unsigned short port() const {
+            return _port;
+        }
+
+    private:
+        pid_t _pid;
+        unsigned short _port = 0;
+    };
+}
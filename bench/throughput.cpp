@@ -0,0 +1,132 @@
+// Publishes a burst of messages to a broker and reports rate and per-message
+// process cost. Run it under the epoll and io_uring builds (ASIO_AMQP_USE_IO_URING)
+// and with different --linger values to compare backends and batching. For an
+// exact syscall count per message run it under
+//   perf stat -e 'raw_syscalls:sys_enter' asio_amqp_throughput ...
+//
+//   asio_amqp_throughput --count 1000000 --size 128 --linger 200
+
+#include <asio_amqp/connection.hpp>
+#include <asio_amqp/channel.hpp>
+#include <boost/asio/use_future.hpp>
+#include <boost/program_options.hpp>
+#include <sys/resource.h>
+#include <atomic>
+#include <future>
+#include <iostream>
+#include <thread>
+
+namespace po = boost::program_options;
+namespace asio = asio_amqp::asio;
+
+namespace {
+    struct usage
+    {
+        usage()
+        {
+            rusage ru;
+            getrusage(RUSAGE_SELF, &ru);
+            cpu = std::chrono::seconds(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec)
+            + std::chrono::microseconds(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+            context_switches = ru.ru_nvcsw + ru.ru_nivcsw;
+        }
+
+        std::chrono::microseconds cpu;
+        long context_switches;
+    };
+}
+
+int main(int argc, char** argv)
+{
+    std::string host, port, user, password, vhost, exchange, routing_key;
+    std::size_t count, size, max_batch;
+    long linger;
+
+    po::options_description desc("asio_amqp publish throughput benchmark");
+    desc.add_options()
+    ("help", "print this message")
+    ("host", po::value(&host)->default_value("localhost"), "broker host")
+    ("port", po::value(&port)->default_value("5672"), "broker port")
+    ("user", po::value(&user)->default_value("guest"), "login")
+    ("password", po::value(&password)->default_value("guest"), "password")
+    ("vhost", po::value(&vhost)->default_value("/"), "vhost")
+    ("exchange", po::value(&exchange)->default_value("amq.fanout"), "exchange to publish to")
+    ("routing-key", po::value(&routing_key)->default_value(""), "routing key")
+    ("count", po::value(&count)->default_value(100000), "messages to publish")
+    ("size", po::value(&size)->default_value(128), "body size in bytes")
+    ("linger", po::value(&linger)->default_value(0), "sender linger in microseconds")
+    ("max-batch", po::value(&max_batch)->default_value(64 * 1024), "sender max batch bytes");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::cout << desc << '\n';
+            return 0;
+        }
+        po::notify(vm);
+    }
+    catch(const std::exception& e) {
+        std::cerr << e.what() << '\n' << desc << '\n';
+        return 2;
+    }
+
+    asio::io_service io_service;
+    asio::io_service::work work(io_service);
+    std::thread client_thread([&] { io_service.run(); });
+
+    int result = 0;
+    try {
+        asio_amqp::connection conn(io_service);
+        conn.async_connect_transport(asio_amqp::connection::query_type(host, port),
+                                     asio::use_future).get();
+        conn.async_connect(AMQP::Login(user, password), vhost, asio::use_future).get();
+
+        asio_amqp::send_options options;
+        options.linger = std::chrono::microseconds(linger);
+        options.max_batch_bytes = max_batch;
+        conn.set_send_options(options);
+
+        asio_amqp::channel chan(io_service, conn);
+        chan.async_open(asio::use_future).get();
+
+        std::atomic<std::size_t> completed { 0 }, failed { 0 };
+        std::promise<void> all_done;
+        auto body = std::string(size, 'x');
+
+        usage before;
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0 ; i < count ; ++i)
+        {
+            chan.async_publish(exchange, routing_key, body,
+                               [&](asio_amqp::future<void>& f)
+                               {
+                                   if (f.get_exception()) {
+                                       ++failed;
+                                   }
+                                   if (++completed == count) {
+                                       all_done.set_value();
+                                   }
+                               });
+        }
+        all_done.get_future().get();
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        usage after;
+
+        std::cout << "backend:          " << asio_amqp::io_backend_name() << '\n'
+                  << "messages:         " << count << " x " << size << " bytes, "
+                  << failed << " failed\n"
+                  << "elapsed:          " << elapsed << " s\n"
+                  << "rate:             " << count / elapsed << " msg/s\n"
+                  << "cpu per message:  " << double((after.cpu - before.cpu).count()) / count << " us\n"
+                  << "ctx sw per 1k:    " << 1000.0 * (after.context_switches - before.context_switches) / count << '\n';
+    }
+    catch(const std::exception& e) {
+        std::cerr << "error: " << e.what() << '\n';
+        result = 1;
+    }
+
+    io_service.stop();
+    client_thread.join();
+    return result;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <asio_amqp/config.hpp>
+#include <asio_amqp/error.hpp>
+
+#include <vector>
+
+namespace asio_amqp {
+
+    /// Restrict the calling thread to the given cpus. An empty set is a no-op.
+    /// Not supported on platforms without pthread_setaffinity_np.
+    system::error_code pin_current_thread(const std::vector<int>& cpus,
+                                          system::error_code& ec = system::throws);
+}
@@ -1,114 +1,26 @@
 #pragma once
 #include <asio_amqp/config.hpp>
 #include <asio_amqp/error.hpp>
+#include <asio_amqp/future.hpp>
+#include <asio_amqp/resolve_cache.hpp>
+#include <asio_amqp/detail/socket_tuning.hpp>
 
 #include <memory>
+#include <functional>
+#include <sstream>
 #include <string>
-#include <future>
 
 
 
 namespace asio_amqp
 {
-    template<class T>
-    struct deferred_result
-    {
-        using value_type = T;
-        using handler_sig = void(std::future<value_type>&);
-        using handler_func = std::function<handler_sig>;
-        
-        deferred_result(handler_func func)
-        : _handler(std::move(func))
-        {}
-        
-        void set_exception(std::exception_ptr ep)
-        {
-            _promise.set_exception(std::move(ep));
-            _handler(_future);
-        }
-        
-        template<
-        class Arg,
-        std::enable_if_t<std::is_convertible<Arg, value_type>::value> * = nullptr
-        >
-        void set_value(Arg&& value)
-        {
-            _promise.set_value(std::forward<Arg>(value));
-            _handler(_future);
-        }
-        
-        template<class Handler>
-        void set_handler(Handler&& handler)
-        {
-            _handler = handler_func(std::forward<Handler>(handler));
-        }
-        
-        std::promise<T> _promise;
-        std::future<T> _future { _promise.get_future() };
-        handler_func _handler;
-    };
-    
-    
-    template<> struct deferred_result<void>
-    {
-        using value_type = void;
-        using handler_sig = void(std::future<value_type>&);
-        using handler_func = std::function<handler_sig>;
-        
-        deferred_result(handler_func func = {})
-        : _handler(std::move(func))
-        {}
-        
-        void set_exception(std::exception_ptr ep)
-        {
-            _promise.set_exception(std::move(ep));
-            _handler(_future);
-        }
-        
-        void set_value()
-        {
-            _promise.set_value();
-            _handler(_future);
-        }
-        
-        template<class Handler>
-        void set_handler(Handler&& handler)
-        {
-            _handler = handler_func(std::forward<Handler>(handler));
-        }
-        
-        std::promise<value_type> _promise;
-        std::future<value_type> _future { _promise.get_future() };
-        handler_func _handler;
-    };
-    
-
-    template<class T, class...Args>
-    std::exception_ptr make_failure(const boost::system::error_code& ec,
-                                    Args&&...args)
-    {
-        try {
-            throw boost::system::system_error(ec, ec.message());
-        }
-        catch(...)
-        {
-            try {
-                std::throw_with_nested(T(std::forward<Args>(args)...));
-            }
-            catch(...)
-            {
-                return std::current_exception();
-            }
-        }
-        return {};
-    }
-
-    
-    
     struct resolve_and_connect_op
     : std::enable_shared_from_this<resolve_and_connect_op>
     {
-        using async_result_type = deferred_result<void>;
+        /// Called with an empty failure on success. On failure the code is
+        /// the operating system's, and the exception, built only if asked
+        /// for, describes what was tried.
+        using handler_type = std::function<void(failure)>;
         
         using protocol_type = asio::ip::tcp;
         using socket_type = protocol_type::socket;
@@ -116,86 +28,136 @@ namespace asio_amqp
         using query_type = resolver_type::query;
         using iterator_type = resolver_type::iterator;
         
+        using endpoint_type = protocol_type::endpoint;
+        
+        /// Lookups go through cache if it is not null. options are applied to
+        /// the socket before each connect attempt.
         resolve_and_connect_op(socket_type& socket,
-                               query_type query)
+                               query_type query,
+                               resolve_cache* cache = nullptr,
+                               const socket_options& options = socket_options())
         : _query(std::move(query))
         , _resolver(socket.get_io_service())
         , _socket(std::addressof(socket))
+        , _cache(cache)
+        , _options(options)
         {}
         
         template<class Handler>
         void run(Handler&& handler)
         {
-            _result.set_handler(std::forward<Handler>(handler));
-            _resolver.async_resolve(_query,
-                                    [this, self = this->shared_from_this()]
-                                    (auto const& ec, auto iter)
-                                    {
-                                        this->handle_resolve(ec, iter);
-                                    });
+            _handler = handler_type(std::forward<Handler>(handler));
+            if (_cache) {
+                _cache->async_resolve(_socket->get_io_service(),
+                                      _query,
+                                      [this, self = this->shared_from_this()]
+                                      (auto const& ec, auto const& endpoints)
+                                      {
+                                          this->handle_resolve(ec, endpoints);
+                                      });
+            }
+            else {
+                _resolver.async_resolve(_query,
+                                        [this, self = this->shared_from_this()]
+                                        (auto const& ec, iterator_type first)
+                                        {
+                                            this->handle_resolve(ec, resolve_cache::results_type(first, iterator_type()));
+                                        });
+            }
         }
         
-        void handle_resolve(boost::system::error_code const& ec, iterator_type iter)
+        void handle_resolve(boost::system::error_code const& ec,
+                            resolve_cache::results_type const& endpoints)
         {
             if (ec) {
-                auto context = "resolving " + _query.host_name() + ':'
-                + _query.service_name();
-                _result.set_exception(make_failure<resolve_failure>(ec,
-                                                                    std::move(context)));
+                complete(failure { ec, nullptr, [ec, query = _query]
+                                   {
+                                       auto context = "resolving " + query.host_name() + ':'
+                                       + query.service_name();
+                                       return std::make_exception_ptr(resolve_failure(ec, context));
+                                   } });
             }
             else {
-                attempt_connect(iter);
+                _candidates = endpoints;
+                attempt_connect(0);
             }
         }
         
-        void attempt_connect(iterator_type iter)
+        void attempt_connect(std::size_t index)
         {
-            if (iter == iterator_type())
+            if (index == _candidates.size())
             {
-                _result.set_exception(exhausted_error());
+                complete(exhausted_failure());
             }
             else {
-                _socket->open(iter->endpoint().protocol());
-                _socket->set_option(asio::ip::tcp::no_delay(true));
-                _socket->async_connect(iter->endpoint(),
+                auto const& endpoint = _candidates[index];
+                system::error_code ec;
+                _socket->open(endpoint.protocol(), ec);
+                if (ec) {
+                    // e.g. an IPv6 endpoint on a host without IPv6
+                    _endpoints.emplace_back(endpoint, ec);
+                    attempt_connect(index + 1);
+                    return;
+                }
+                detail::apply_socket_options(*_socket, _options);
+                _socket->async_connect(endpoint,
                                        [this, self = this->shared_from_this(),
-                                        iter]
+                                        index]
                                        (auto const& ec)
                                        {
-                                           this->handle_connect_attempt(ec, iter);
+                                           this->handle_connect_attempt(ec, index);
                                        });
             }
         }
         
         void handle_connect_attempt(boost::system::error_code const& ec,
-                                    iterator_type iter)
+                                    std::size_t index)
         {
             if (ec) {
-                _endpoints.emplace_back(iter->endpoint(), ec);
+                _endpoints.emplace_back(_candidates[index], ec);
                 boost::system::error_code sink;
                 _socket->close(sink);
-                attempt_connect(++iter);
+                attempt_connect(index + 1);
             }
             else {
-                _result.set_value();
+                complete({});
             }
         }
         
-        std::exception_ptr exhausted_error() const
+        void complete(failure f)
         {
-            return std::make_exception_ptr(std::runtime_error(connection_results_as_string()));
+            auto handler = std::move(_handler);
+            handler(std::move(f));
         }
         
-        std::string connection_results_as_string() const
+        using attempt = std::pair<protocol_type::endpoint, system::error_code>;
+        
+        /// Fails with the reason the last endpoint refused, or host_not_found
+        /// if the lookup produced none. The attempts are only described if
+        /// the exception is asked for.
+        failure exhausted_failure()
         {
-            if (_endpoints.empty())
+            auto code = _endpoints.empty()
+            ? system::error_code(asio::error::host_not_found)
+            : _endpoints.back().second;
+            auto attempts = std::make_shared<const std::vector<attempt>>(std::move(_endpoints));
+            return failure { code, nullptr, [code, attempts]
+                             {
+                                 return std::make_exception_ptr(system::system_error(code,
+                                                                                     connection_results_as_string(*attempts)));
+                             } };
+        }
+        
+        static std::string connection_results_as_string(const std::vector<attempt>& endpoints)
+        {
+            if (endpoints.empty())
             {
                 return { "no endpoints resolved" };
             }
             else {
                 std::stringstream ss("unable to connect to the following endpoints: ");
                 auto sep = "";
-                for (auto const& pair : _endpoints)
+                for (auto const& pair : endpoints)
                 {
                     auto const& endpoint = pair.first;
                     auto const& reason = pair.second;
@@ -213,22 +175,30 @@ namespace asio_amqp
         query_type _query;
         resolver_type _resolver;
         socket_type* _socket;
-        async_result_type _result;
-        
-        using attempt = std::pair<protocol_type::endpoint, system::error_code>;
+        resolve_cache* _cache;
+        socket_options _options;
+        handler_type _handler;
+        resolve_cache::results_type _candidates;
         std::vector<attempt> _endpoints;
     };
     
+    /// Resolve query, through cache if it is not null, and connect socket to
+    /// the first endpoint that accepts, tuned according to options. handler is
+    /// called as handler(failure), with an empty failure on success.
     template<class Handler>
     void async_resolve_and_connect(asio::ip::tcp::socket& socket,
                                    asio::ip::tcp::resolver::query query,
-                                   Handler&& handler)
+                                   Handler&& handler,
+                                   resolve_cache* cache = nullptr,
+                                   const socket_options& options = socket_options())
     {
         auto p = std::make_shared<resolve_and_connect_op>(socket,
-                                                          std::move(query));
-        p->run([p, handler = std::move(handler)](std::future<void>& f) mutable
+                                                          std::move(query),
+                                                          cache,
+                                                          options);
+        p->run([p, handler = std::move(handler)](failure f) mutable
                {
-                   handler(f);
+                   handler(std::move(f));
                });
     }
 }
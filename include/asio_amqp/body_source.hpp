@@ -0,0 +1,68 @@
+#pragma once
+#include <asio_amqp/config.hpp>
+
+#include <boost/interprocess/exceptions.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+
+namespace asio_amqp {
+
+    /// A body source for channel::async_publish_stream that reads a file through
+    /// a read only memory mapping. Pages are faulted in as frames are built,
+    /// but the whole file stays mapped, and the pages read stay resident
+    /// as the kernel allows, until the last copy is destroyed.
+    /// Copies share the mapping and the read position.
+    struct mapped_file_source
+    {
+        /// @throws boost::interprocess::interprocess_exception if the file
+        /// cannot be opened or mapped
+        explicit mapped_file_source(const std::string& path)
+        : _state(std::make_shared<state>(path))
+        {}
+
+        std::uint64_t size() const {
+            return _state->size;
+        }
+
+        /// Copy up to max_size of the next bytes of the file into buffer.
+        /// Returns the number of bytes copied, zero at the end of the file.
+        std::size_t operator()(char* buffer, std::size_t max_size)
+        {
+            auto& st = *_state;
+            auto n = std::min<std::size_t>(max_size, st.size - st.position);
+            if (n) {
+                std::memcpy(buffer, static_cast<const char*>(st.region.get_address()) + st.position, n);
+            }
+            st.position += n;
+            return n;
+        }
+
+    private:
+        struct state
+        {
+            state(const std::string& path)
+            : file(path.c_str(), boost::interprocess::read_only)
+            {
+                // an empty file cannot be mapped
+                std::ifstream probe(path, std::ios::binary | std::ios::ate);
+                if (probe.tellg() > 0) {
+                    region = boost::interprocess::mapped_region(file, boost::interprocess::read_only);
+                    region.advise(boost::interprocess::mapped_region::advice_sequential);
+                    size = region.get_size();
+                }
+            }
+
+            boost::interprocess::file_mapping file;
+            boost::interprocess::mapped_region region;
+            std::size_t size = 0;
+            std::size_t position = 0;
+        };
+
+        std::shared_ptr<state> _state;
+    };
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <asio_amqp/config.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace asio_amqp {
+
+    /// Receives a copy of every chunk of raw bytes read from or queued to the wire.
+    /// Implementations must be thread safe if shared between connections.
+    struct capture_sink
+    {
+        enum class direction : std::uint8_t {
+            inbound = 0,
+            outbound = 1
+        };
+
+        virtual ~capture_sink() = default;
+        virtual void record(direction dir, const char* data, std::size_t size) = 0;
+    };
+
+    /// One record of a capture file
+    struct capture_record
+    {
+        std::chrono::nanoseconds timestamp;
+        capture_sink::direction dir;
+        std::vector<char> data;
+    };
+
+    /// Writes captured traffic to a compact binary file.
+    ///
+    /// Layout: the 8 byte magic "AAMQCAP1", then for each record
+    /// u64 nanoseconds since the capture was opened, u8 direction, u32 length,
+    /// followed by length bytes. All integers are little endian.
+    struct file_capture : capture_sink
+    {
+        file_capture(const std::string& path);
+
+        void record(direction dir, const char* data, std::size_t size) override;
+
+        void flush();
+
+    private:
+        using clock_type = std::chrono::steady_clock;
+
+        std::mutex _mutex;
+        std::ofstream _stream;
+        clock_type::time_point _epoch;
+    };
+
+    /// Reads a file written by file_capture
+    struct capture_reader
+    {
+        capture_reader(const std::string& path);
+
+        /// read the next record. Returns false at end of file.
+        bool next(capture_record& record);
+
+    private:
+        std::ifstream _stream;
+    };
+
+    struct capture_format_error : std::runtime_error
+    {
+        using std::runtime_error::runtime_error;
+    };
+}
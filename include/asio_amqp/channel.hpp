@@ -1,6 +1,19 @@
 #pragma once
 #include <asio_amqp/connection.hpp>
 #include <asio_amqp/future.hpp>
+#include <asio_amqp/completion.hpp>
+#include <asio_amqp/codec.hpp>
+#include <asio_amqp/message.hpp>
+#include <asio_amqp/body_source.hpp>
+#include <asio_amqp/uri.hpp>
+#include <asio_amqp/detail/frame_encoder.hpp>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <map>
+#include <utility>
 
 namespace asio_amqp {
 
@@ -45,15 +58,43 @@ namespace asio_amqp {
         
     };
 
+    /// The broker refused or closed the channel, or a request on it could not
+    /// be encoded. The code is runtime_error_code::channel_failed.
+    struct channel_failure : system::system_error
+    {
+        explicit channel_failure(const std::string& message)
+        : system::system_error(runtime_error_code::channel_failed, message)
+        {}
+    };
+    
     struct channel_impl
     : std::enable_shared_from_this<channel_impl>
     {
-        channel_impl(std::shared_ptr<connection_impl> connection)
+        using message_handler_type = std::function<void(message&)>;
+        
+        channel_impl(std::shared_ptr<connection_impl> connection,
+                     asio::io_service& owner)
         : _connection(connection)
+        , _owner(owner)
+        , _owner_guard(detail::completion_guard::of(owner))
         {
             
         }
         
+        ~channel_impl()
+        {
+            std::size_t bytes = 0;
+            for (auto& entry : _unacked) {
+                bytes += entry.second;
+            }
+            if (bytes) {
+                // may be the last channel in the way of a connection paused at its limit
+                auto lock = _connection->get_lock();
+                _connection->memory().release(bytes);
+                _connection->memory_released();
+            }
+        }
+        
         enum class state {
             closed,
             opening,
@@ -66,26 +107,768 @@ namespace asio_amqp {
         {
             _connection->post_self([this,
                                     self = this->shared_from_this(),
-                                    handler = std::move(handler)]
+                                    handler = std::move(handler)] () mutable
             {
+                // this happens in the context of the connection's thread
+                auto lock = _connection->get_lock();
                 if (_state != state::closed) {
                     handler(std::logic_error("wrong state"));
+                    return;
                 }
-                // this happens in the context of the connection's thread
-                _channel.emplace(_connection->connection_ptr());
-                
+                if (not _connection->is_connected()) {
+                    handler(system::error_code(logic_error_code::wrong_state_for_connect));
+                    return;
+                }
+                open_now(std::move(handler));
+            });
+        }
+        
+        /// Connect this channel's connection to uri and open the channel in the
+        /// same sequence. channel.open is queued while the handshake is still
+        /// running, so it leaves as soon as the broker accepts connection.open
+        /// rather than after a round trip through the caller. handler completes
+        /// once, with the channel id or the first failure of either step.
+        template<class Handler>
+        void async_open(const amqp_uri& uri, Handler&& handler)
+        {
+            auto self = this->shared_from_this();
+            auto on_handshake = make_future_handler<void>(_connection->get_io_service(),
+                                                          [this, self, handler](future<void>& f)
+            {
+                if (not f.is_exception()) {
+                    return;     // onReady of the channel completes us
+                }
+                auto lock = _connection->get_lock();
+                auto previous = std::exchange(_state, state::shutdown);
+                if (previous == state::closed or previous == state::opening) {
+                    handler(f.get_failure());
+                }
+            });
+            _connection->async_open(connection_impl::query_type(uri.host, uri.port),
+                                    AMQP::Login(uri.user, uri.password),
+                                    std::string(uri.vhost),
+                                    [this, self, handler = std::forward<Handler>(handler)] () mutable
+                                    {
+                                        if (_state == state::closed) {
+                                            open_now(std::move(handler));
+                                        }
+                                    },
+                                    std::move(on_handshake));
+        }
+        
+        /// Fails with runtime_error_code::memory_limit while the connection is
+        /// over its memory limit.
+        template<class Handler>
+        void async_publish(message&& msg, Handler&& handler)
+        {
+            on_channel([this, msg = std::move(msg), handler = std::move(handler)] () mutable
+            {
+                if (auto failed = publish_now(msg)) {
+                    handler(std::move(failed));
+                }
+                else {
+                    handler();
+                }
+            });
+        }
+        
+        /// Publish msg immediately, returning the reason if it could not be.
+        ///
+        /// Messages without headers are encoded straight into the connection's
+        /// send queue. Those with headers, or published while AMQP-CPP holds
+        /// back this channel's frames for a pending consume, go through AMQP-CPP.
+        /// @pre called from execute()
+        failure publish_now(const message& msg)
+        {
+            if (_state != state::open) {
+                return make_failure(system::system_error(logic_error_code::channel_not_open));
+            }
+            if (_connection->memory().over_limit()) {
+                return make_failure(system::system_error(runtime_error_code::memory_limit));
+            }
+            if (msg.headers.keys().empty() and not _pending_sync)
+            {
+                auto id = _channel->id();
+                auto body_max = body_frame_size();
+                auto frames = (msg.body.size() + body_max - 1) / body_max;
+                try {
+                    _connection->encode_frames(msg.body.size() + (frames + 2) * detail::frame_overhead + 512,
+                                               [&](std::vector<char>& out)
+                                               {
+                                                   detail::frame_encoder encoder(out);
+                                                   encoder.publish_method(id, msg.exchange, msg.routing_key);
+                                                   encode_content_header(encoder, id, msg.body.size(), msg);
+                                                   encoder.body_frames(id, msg.body.data(), msg.body.size(), body_max);
+                                               });
+                }
+                catch(const std::exception& e) {
+                    return make_failure(channel_failure(e.what()));
+                }
+                return {};
+            }
+            AMQP::Envelope envelope(msg.body.data(), msg.body.size());
+            set_properties(envelope, msg);
+            if (not _channel->publish(msg.exchange, msg.routing_key, envelope)) {
+                return make_failure(channel_failure("publish failed"));
+            }
+            return {};
+        }
+        
+        /// Run f on the connection's thread with the mutex taken, in order with
+        /// the channel's other operations
+        template<class F>
+        void execute(F&& f)
+        {
+            on_channel(std::forward<F>(f));
+        }
+        
+        connection_impl& get_connection() const {
+            return *_connection;
+        }
+        
+        /// Publish a body_size byte body pulled from producer one frame at a
+        /// time. producer(buffer, max) is called on the connection's thread and
+        /// returns the number of bytes it wrote, at most max. header supplies
+        /// the exchange, routing key and properties; its body is ignored.
+        ///
+        /// The frames bypass AMQP-CPP, so the stream waits for any consume in
+        /// flight, and the frames AMQP-CPP holds back meanwhile, to go first.
+        /// Once the content header is sent the channel belongs to the stream:
+        /// other operations on it wait until the stream completes. If producer
+        /// throws or runs dry early the body cannot be completed and the channel
+        /// is left unusable.
+        template<class Producer, class Handler>
+        void async_publish_stream(message&& header, std::uint64_t body_size,
+                                  Producer&& producer, Handler&& handler)
+        {
+            on_channel([this,
+                        header = std::move(header),
+                        body_size,
+                        producer = std::move(producer),
+                        handler = std::move(handler)] () mutable
+            {
+                if (not _pending_sync) {
+                    publish_stream_now(header, body_size, std::move(producer), std::move(handler));
+                    return;
+                }
+                wait_for_sync([this,
+                               header = std::move(header),
+                               body_size,
+                               producer = std::move(producer),
+                               handler = std::move(handler)] () mutable
+                {
+                    publish_stream_now(header, body_size, std::move(producer), std::move(handler));
+                });
+            });
+        }
+        
+        /// Queue frames encoded by the caller, e.g. by a prepared_publisher,
+        /// as one publish. Like a stream, they wait for any consume in flight
+        /// and the frames AMQP-CPP holds back meanwhile.
+        template<class Handler>
+        void async_publish_frames(std::vector<char>&& frames, Handler&& handler)
+        {
+            on_channel([this, frames = std::move(frames), handler = std::move(handler)] () mutable
+            {
+                if (not _pending_sync) {
+                    publish_frames_now(std::move(frames), std::move(handler));
+                    return;
+                }
+                wait_for_sync([this, frames = std::move(frames), handler = std::move(handler)] () mutable
+                {
+                    publish_frames_now(std::move(frames), std::move(handler));
+                });
+            });
+        }
+        
+        /// The channel id, zero until the channel is open
+        std::uint16_t id() const {
+            return _id;
+        }
+        
+        /// The connection's frame size limit when the channel opened, zero if none
+        std::uint32_t frame_max() const {
+            return _frame_max;
+        }
+        
+        /// Begin consuming from queue. Each delivery is passed to on_message on
+        /// the owner's io_service, or with on_connection_thread directly on the
+        /// connection's thread with the mutex taken. handler receives the
+        /// consumer tag. no_ack deliveries need no settlement.
+        template<class Handler>
+        void async_consume(std::string&& queue,
+                           message_handler_type on_message,
+                           Handler&& handler,
+                           bool no_ack = false,
+                           bool on_connection_thread = false)
+        {
+            on_channel([this,
+                        queue = std::move(queue),
+                        on_message = std::move(on_message),
+                        handler = std::move(handler),
+                        no_ack,
+                        on_connection_thread] () mutable
+            {
+                if (_state != state::open) {
+                    handler(system::error_code(logic_error_code::channel_not_open));
+                    return;
+                }
+                auto pfn = std::make_shared<message_handler_type>(std::move(on_message));
+                auto pdone = std::make_shared<bool>(false);
+                auto ptag = std::make_shared<std::string>();
+                ++_pending_sync;
+                _channel->consume(queue, no_ack ? AMQP::noack : 0)
+                .onReceived([this, pfn, ptag, no_ack, on_connection_thread](const AMQP::Message& m,
+                                                                            uint64_t delivery_tag,
+                                                                            bool redelivered)
+                            {
+                                if (not no_ack) {
+                                    // the body is held until acked or rejected
+                                    _connection->memory().charge(m.bodySize());
+                                    _unacked.emplace(delivery_tag, std::size_t(m.bodySize()));
+                                }
+                                auto msg = message(m, delivery_tag, redelivered);
+                                msg.consumer_tag = *ptag;
+                                if (on_connection_thread) {
+                                    (*pfn)(msg);
+                                    return;
+                                }
+                                _owner_guard->post([pfn, msg = std::move(msg)]() mutable
+                                                   {
+                                                       (*pfn)(msg);
+                                                   });
+                            })
+                .onSuccess([this, handler, pdone, ptag](const std::string& consumer_tag)
+                           {
+                               *pdone = true;
+                               sync_done();
+                               *ptag = consumer_tag;
+                               handler(consumer_tag);
+                           })
+                .onError([this, handler, pdone](const char* message)
+                         {
+                             if (not std::exchange(*pdone, true)) {
+                                 sync_done();
+                                 handler(channel_failure(message));
+                             }
+                         });
+            });
+        }
+        
+        /// Begin consuming from queue, reporting each delivery incrementally to
+        /// consumer. handler receives the consumer tag.
+        template<class Handler>
+        void async_consume_stream(std::string&& queue,
+                                  stream_consumer consumer,
+                                  Handler&& handler)
+        {
+            on_channel([this,
+                        queue = std::move(queue),
+                        consumer = std::move(consumer),
+                        handler = std::move(handler)] () mutable
+            {
+                if (_state != state::open) {
+                    handler(system::error_code(logic_error_code::channel_not_open));
+                    return;
+                }
+                auto pconsumer = std::make_shared<stream_consumer>(std::move(consumer));
+                auto strand = std::make_shared<asio::io_service::strand>(_owner);
+                auto body_size = std::make_shared<std::uint64_t>(0);
+                // deliver f either here or, in order, on the owner's io_service
+                auto run = [pconsumer, strand, guard = _owner_guard](auto&& f)
+                {
+                    if (pconsumer->on_connection_thread) {
+                        f();
+                    }
+                    else {
+                        guard->with_io_service([&](asio::io_service&)
+                                               {
+                                                   strand->post(std::move(f));
+                                               });
+                    }
+                };
+                auto flow = std::make_shared<stream_flow>(_connection, pconsumer->max_in_flight);
+                auto pdone = std::make_shared<bool>(false);
+                // with no onReceived callback AMQP-CPP does not buffer the body
+                ++_pending_sync;
+                _channel->consume(queue)
+                .onSize([body_size](uint64_t size)
+                        {
+                            *body_size = size;
+                        })
+                .onHeaders([run, pconsumer, body_size](const AMQP::MetaData& meta)
+                           {
+                               run([pconsumer, header = message(meta), size = *body_size]() mutable
+                                   {
+                                       if (pconsumer->on_header) pconsumer->on_header(header, size);
+                                   });
+                           })
+                .onData([run, pconsumer, flow](const char* data, size_t size)
+                        {
+                            if (pconsumer->on_connection_thread) {
+                                if (pconsumer->on_data) pconsumer->on_data(data, size);
+                                return;
+                            }
+                            flow->add(size);
+                            run([pconsumer, flow, chunk = std::string(data, size)]
+                                {
+                                    if (pconsumer->on_data) pconsumer->on_data(chunk.data(), chunk.size());
+                                    flow->remove(chunk.size());
+                                });
+                        })
+                .onComplete([run, pconsumer](uint64_t delivery_tag, bool redelivered)
+                            {
+                                run([pconsumer, delivery_tag, redelivered]
+                                    {
+                                        if (pconsumer->on_complete) pconsumer->on_complete(delivery_tag, redelivered);
+                                    });
+                            })
+                .onSuccess([this, handler, pdone](const std::string& consumer_tag)
+                           {
+                               *pdone = true;
+                               sync_done();
+                               handler(consumer_tag);
+                           })
+                .onError([this, handler, pdone](const char* message)
+                         {
+                             if (not std::exchange(*pdone, true)) {
+                                 sync_done();
+                                 handler(channel_failure(message));
+                             }
+                         });
+            });
+        }
+        
+        void ack(std::uint64_t delivery_tag, bool multiple)
+        {
+            on_channel([this, delivery_tag, multiple]
+            {
+                if (_state == state::open) {
+                    send_method([&](detail::frame_encoder& encoder, std::uint16_t id)
+                                {
+                                    encoder.ack(id, delivery_tag, multiple);
+                                });
+                }
+                release_unacked(delivery_tag, multiple);
+            });
+        }
+        
+        void reject(std::uint64_t delivery_tag, bool requeue)
+        {
+            on_channel([this, delivery_tag, requeue]
+            {
+                if (_state == state::open) {
+                    send_method([&](detail::frame_encoder& encoder, std::uint16_t id)
+                                {
+                                    encoder.reject(id, delivery_tag, requeue);
+                                });
+                }
+                release_unacked(delivery_tag, false);
+            });
+        }
+        
+        void nack(std::uint64_t delivery_tag, bool multiple, bool requeue)
+        {
+            on_channel([this, delivery_tag, multiple, requeue]
+            {
+                if (_state == state::open) {
+                    send_method([&](detail::frame_encoder& encoder, std::uint16_t id)
+                                {
+                                    encoder.nack(id, delivery_tag, multiple, requeue);
+                                });
+                }
+                release_unacked(delivery_tag, multiple);
             });
         }
         
         void close()
         {
+            on_channel([this]
+            {
+                if (_state == state::open) {
+                    _channel->close();
+                }
+                _state = state::shutdown;
+                release_unacked(std::numeric_limits<std::uint64_t>::max(), true);
+            });
+        }
+        
+    private:
+        /// Start opening the channel. The connection's handshake need not be
+        /// complete: AMQP-CPP holds channel.open until it is.
+        /// @pre mutex is taken, _state == state::closed
+        template<class Handler>
+        void open_now(Handler&& handler)
+        {
+            _state = state::opening;
+            _channel.emplace(_connection->connection_ptr());
+            _channel->onReady([this, handler]
+            {
+                if (_state == state::opening) {
+                    _state = state::open;
+                    _id = _channel->id();
+                    _frame_max = _connection->max_frame();
+                    handler(unsigned(_channel->id()));
+                }
+            });
+            _channel->onError([this, handler](const char* message)
+            {
+                auto previous = std::exchange(_state, state::shutdown);
+                if (previous == state::opening) {
+                    handler(channel_failure(message));
+                }
+            });
+            _connection->expect_response();
+        }
+        
+        /// Send the publish method and content header of a stream, then pump
+        /// its body.
+        /// @pre called from on_channel, _pending_sync == 0
+        template<class Producer, class Handler>
+        void publish_stream_now(const message& header, std::uint64_t body_size,
+                                Producer&& producer, Handler&& handler)
+        {
+            if (_state != state::open) {
+                handler(system::error_code(logic_error_code::channel_not_open));
+                return;
+            }
+            if (_connection->memory().over_limit()) {
+                handler(system::error_code(runtime_error_code::memory_limit));
+                return;
+            }
+            std::vector<char> frames;
+            try {
+                detail::frame_encoder encoder(frames);
+                encoder.publish_method(_channel->id(), header.exchange, header.routing_key);
+                encode_content_header(encoder, _channel->id(), body_size, header);
+            }
+            catch(const std::exception& e) {
+                handler(channel_failure(e.what()));
+                return;
+            }
+            _streaming = true;
+            _connection->send_frames(std::move(frames));
+            using stream_type = publish_stream<std::decay_t<Producer>, std::decay_t<Handler>>;
+            pump(std::make_shared<stream_type>(std::forward<Producer>(producer),
+                                               std::forward<Handler>(handler),
+                                               body_size));
+        }
+        
+        /// @pre called from on_channel, _pending_sync == 0
+        template<class Handler>
+        void publish_frames_now(std::vector<char>&& frames, Handler&& handler)
+        {
+            if (_state != state::open) {
+                handler(system::error_code(logic_error_code::channel_not_open));
+                return;
+            }
+            if (_connection->memory().over_limit()) {
+                handler(system::error_code(runtime_error_code::memory_limit));
+                return;
+            }
+            _connection->send_caller_frames(std::move(frames));
+            handler();
+        }
+        
+        template<class Producer, class Handler>
+        struct publish_stream
+        {
+            publish_stream(Producer producer, Handler handler, std::uint64_t remaining)
+            : producer(std::move(producer))
+            , handler(std::move(handler))
+            , remaining(remaining)
+            {}
             
+            Producer producer;
+            Handler handler;
+            std::uint64_t remaining;
+        };
+        
+        /// Bounds the copied chunks of an incremental consumer that wait for
+        /// the owner's io_service: reading is held while there are more than
+        /// limit bytes of them.
+        struct stream_flow
+        : std::enable_shared_from_this<stream_flow>
+        {
+            stream_flow(std::shared_ptr<connection_impl> connection, std::size_t limit)
+            : _connection(std::move(connection))
+            , _limit(limit)
+            {}
+            
+            /// A chunk of size bytes was copied
+            /// @pre mutex is taken
+            void add(std::size_t size)
+            {
+                _connection->memory().charge(size);
+                if (_in_flight.fetch_add(size) + size > _limit and not _held) {
+                    _held = true;
+                    _connection->hold_reading();
+                }
+            }
+            
+            /// A chunk of size bytes was delivered. Called from the owner's io_service.
+            void remove(std::size_t size)
+            {
+                _connection->memory().release(size);
+                auto before = _in_flight.fetch_sub(size);
+                if (before > _limit and before - size <= _limit)
+                {
+                    _connection->post_self([self = this->shared_from_this()]
+                    {
+                        auto lock = self->_connection->get_lock();
+                        if (self->_held and self->_in_flight <= self->_limit) {
+                            self->_held = false;
+                            self->_connection->release_reading();
+                        }
+                    });
+                }
+            }
+            
+        private:
+            std::shared_ptr<connection_impl> _connection;
+            const std::size_t _limit;
+            std::atomic<std::size_t> _in_flight { 0 };
+            bool _held = false;         ///< guarded by the connection's mutex
+        };
+        
+        /// body frame payload used when the broker sets no frame limit
+        static constexpr std::size_t default_body_frame = 128 * 1024;
+        
+        /// Run f on the connection's thread with the mutex taken, after any
+        /// streaming publish in progress on this channel has finished and any
+        /// operation waiting for sync has run.
+        template<class F>
+        void on_channel(F&& f)
+        {
+            _connection->post_self([this,
+                                    self = this->shared_from_this(),
+                                    f = std::forward<F>(f)] () mutable
+            {
+                auto lock = _connection->get_lock();
+                if (_streaming or _waiting_sync) {
+                    _deferred.emplace_back(std::move(f));
+                }
+                else {
+                    f();
+                }
+            });
         }
         
+        /// Run f, and after it the channel's other operations, once no
+        /// synchronous operation is pending and AMQP-CPP has sent the frames it
+        /// held back for it. For frames that go straight to the send queue.
+        /// @pre called from on_channel, _pending_sync != 0
+        template<class F>
+        void wait_for_sync(F&& f)
+        {
+            _waiting_sync = true;
+            _deferred.emplace_front(std::forward<F>(f));
+        }
+        
+        /// A synchronous operation has been answered. AMQP-CPP sends the frames
+        /// it held back after this returns, so waiting operations resume from
+        /// a fresh handler.
+        /// @pre mutex is taken
+        void sync_done()
+        {
+            if (--_pending_sync or not _waiting_sync) {
+                return;
+            }
+            _connection->post_self([this, self = this->shared_from_this()]
+            {
+                auto lock = _connection->get_lock();
+                if (_waiting_sync and not _pending_sync) {
+                    _waiting_sync = false;
+                    run_deferred();
+                }
+            });
+        }
+        
+        /// Encode one method frame with encode(encoder, channel id) straight
+        /// into the send queue, ahead of other channels' queued publishes.
+        /// Settlements need not wait behind frames AMQP-CPP holds back for a
+        /// pending consume, so this is always safe for them.
+        /// @pre mutex is taken
+        template<class Encode>
+        void send_method(Encode&& encode)
+        {
+            auto id = _channel->id();
+            _connection->encode_control_frames(id, 64, [&](std::vector<char>& out)
+                                               {
+                                                   detail::frame_encoder encoder(out);
+                                                   encode(encoder, id);
+                                               });
+        }
+        
+        /// largest body frame payload the connection allows
+        std::size_t body_frame_size() const
+        {
+            auto frame_max = _connection->max_frame();
+            return frame_max ? std::size_t(frame_max) - detail::frame_overhead : default_body_frame;
+        }
+        
+        /// Queue body frames until the body is complete or the send window is
+        /// full, in which case resume when the sender drains. Over the memory
+        /// limit, resume once memory is released instead.
+        /// @pre mutex is taken
+        template<class Stream>
+        void pump(const std::shared_ptr<Stream>& stream)
+        {
+            auto body_max = body_frame_size();
+            auto window = _connection->get_send_options().stream_window_frames * (body_max + detail::frame_overhead);
+            
+            while (stream->remaining)
+            {
+                if (auto& ec = _connection->send_error()) {
+                    fail_stream(stream, system::system_error(ec));
+                    return;
+                }
+                if (_connection->memory().over_limit())
+                {
+                    _connection->when_memory_available([this, self = this->shared_from_this(), stream]
+                                                       {
+                                                           pump(stream);
+                                                       });
+                    return;
+                }
+                if (_connection->send_pending() >= window)
+                {
+                    _connection->notify_when_send_below(window / 2,
+                                                        [this, self = this->shared_from_this(), stream]
+                                                        {
+                                                            auto lock = _connection->get_lock();
+                                                            pump(stream);
+                                                        });
+                    return;
+                }
+                
+                auto size = std::size_t(std::min<std::uint64_t>(stream->remaining, body_max));
+                std::vector<char> frame;
+                frame.reserve(size + detail::frame_overhead);
+                detail::frame_encoder encoder(frame);
+                encoder.begin_frame(detail::frame_encoder::body_frame, _channel->id());
+                frame.resize(detail::frame_header_size + size);
+                std::size_t produced = 0;
+                try {
+                    produced = std::min(size, std::size_t(stream->producer(&frame[detail::frame_header_size], size)));
+                }
+                catch(const system::system_error& e) {
+                    fail_stream(stream, failure { e.code(), std::current_exception() });
+                    return;
+                }
+                catch(...) {
+                    fail_stream(stream, failure { runtime_error_code::unspecified, std::current_exception() });
+                    return;
+                }
+                if (not produced) {
+                    fail_stream(stream, channel_failure("body source ended before the declared size"));
+                    return;
+                }
+                frame.resize(detail::frame_header_size + produced);
+                encoder.end_frame();
+                stream->remaining -= produced;
+                _connection->send_frames(std::move(frame));
+            }
+            
+            stream->handler();
+            end_stream();
+        }
+        
+        /// Stop accounting for the bodies of settled deliveries
+        /// @pre mutex is taken
+        void release_unacked(std::uint64_t delivery_tag, bool multiple)
+        {
+            auto last = _unacked.upper_bound(delivery_tag);
+            auto first = multiple ? _unacked.begin() : _unacked.find(delivery_tag);
+            if (first == _unacked.end()) {
+                return;
+            }
+            std::size_t bytes = 0;
+            for (auto i = first ; i != last ; ++i) {
+                bytes += i->second;
+            }
+            _unacked.erase(first, last);
+            _connection->memory().release(bytes);
+            _connection->memory_released();
+        }
+        
+        /// The broker is still waiting for the rest of the body, so nothing
+        /// more can be sent on this channel.
+        template<class Stream, class Error>
+        void fail_stream(const std::shared_ptr<Stream>& stream, Error&& error)
+        {
+            _state = state::shutdown;
+            stream->handler(std::forward<Error>(error));
+            end_stream();
+        }
+        
+        void end_stream()
+        {
+            _streaming = false;
+            run_deferred();
+        }
+        
+        /// Run deferred operations, stopping if one of them starts another
+        /// stream or waits for sync.
+        void run_deferred()
+        {
+            while (not _streaming and not _waiting_sync and not _deferred.empty())
+            {
+                auto f = std::move(_deferred.front());
+                _deferred.pop_front();
+                f();
+            }
+        }
+        
+        static void encode_content_header(detail::frame_encoder& encoder,
+                                          std::uint16_t channel,
+                                          std::uint64_t body_size,
+                                          const message& msg)
+        {
+            using fe = detail::frame_encoder;
+            if (not msg.headers.keys().empty()) {
+                throw std::invalid_argument("headers are not supported on a streaming publish");
+            }
+            std::uint16_t flags = 0;
+            if (not msg.content_type.empty()) flags |= fe::content_type_flag;
+            if (not msg.content_encoding.empty()) flags |= fe::content_encoding_flag;
+            if (not msg.correlation_id.empty()) flags |= fe::correlation_id_flag;
+            if (not msg.reply_to.empty()) flags |= fe::reply_to_flag;
+            if (not msg.message_id.empty()) flags |= fe::message_id_flag;
+            
+            encoder.begin_content_header(channel, body_size, flags);
+            if (flags & fe::content_type_flag) encoder.put_shortstr(msg.content_type);
+            if (flags & fe::content_encoding_flag) encoder.put_shortstr(msg.content_encoding);
+            if (flags & fe::correlation_id_flag) encoder.put_shortstr(msg.correlation_id);
+            if (flags & fe::reply_to_flag) encoder.put_shortstr(msg.reply_to);
+            if (flags & fe::message_id_flag) encoder.put_shortstr(msg.message_id);
+            encoder.end_frame();
+        }
+        
+        static void set_properties(AMQP::Envelope& envelope, const message& msg)
+        {
+            if (not msg.content_type.empty()) envelope.setContentType(msg.content_type);
+            if (not msg.content_encoding.empty()) envelope.setContentEncoding(msg.content_encoding);
+            if (not msg.correlation_id.empty()) envelope.setCorrelationID(msg.correlation_id);
+            if (not msg.reply_to.empty()) envelope.setReplyTo(msg.reply_to);
+            if (not msg.message_id.empty()) envelope.setMessageID(msg.message_id);
+            envelope.setHeaders(msg.headers);
+        }
 
         std::shared_ptr<connection_impl> _connection;
+        asio::io_service& _owner;
+        std::shared_ptr<detail::completion_guard> _owner_guard;   ///< posts to _owner until it shuts down
         optional<AMQP::Channel> _channel;
         state _state = state::closed;
+        std::atomic<std::uint16_t> _id { 0 };
+        std::atomic<std::uint32_t> _frame_max { 0 };
+        bool _streaming = false;
+        /// consumes awaiting consume-ok; AMQP-CPP queues our channel's frames meanwhile
+        std::size_t _pending_sync = 0;
+        /// an operation at the front of _deferred waits for _pending_sync to reach zero
+        bool _waiting_sync = false;
+        std::deque<std::function<void()>> _deferred;
+        std::map<std::uint64_t, std::size_t> _unacked;
     };
     
     template<class T, class Handler>
@@ -138,18 +921,231 @@ namespace asio_amqp {
         }
         
         
-        template<class Handler>
-        void async_open(Handler&& handler)
+        /// Open the channel. Completes with the channel id.
+        template<class CompletionToken>
+        auto async_open(CompletionToken&& token)
+        {
+            return async_initiate_future<unsigned int>(*_owner,
+                                                       get_service().options().completion,
+                                                       std::forward<CompletionToken>(token),
+                                                       [this](auto&& my_handler)
+            {
+                if (_impl.get()) {
+                    my_handler(std::logic_error("already open"));
+                }
+                else
+                {
+                    _impl = std::make_shared<channel_impl>(_connection->get_impl_ptr(), *_owner);
+                    _impl->async_open(std::move(my_handler));
+                }
+            });
+        }
+
+        /// Connect the channel's connection to the broker at uri (see amqp_uri)
+        /// and open the channel, as one pipelined sequence with one completion.
+        /// The connection must not have been connected yet. Completes with the
+        /// channel id once both the connection and the channel are ready.
+        template<class CompletionToken>
+        auto async_open(const std::string& uri, CompletionToken&& token)
+        {
+            return async_initiate_future<unsigned int>(*_owner,
+                                                       get_service().options().completion,
+                                                       std::forward<CompletionToken>(token),
+                                                       [this, &uri](auto&& my_handler)
+            {
+                if (_impl.get()) {
+                    my_handler(std::logic_error("already open"));
+                    return;
+                }
+                amqp_uri parsed;
+                try {
+                    parsed = amqp_uri::parse(uri);
+                }
+                catch(const logic_system_error& e) {
+                    my_handler(e);
+                    return;
+                }
+                _impl = std::make_shared<channel_impl>(_connection->get_impl_ptr(), *_owner);
+                _impl->async_open(parsed, std::move(my_handler));
+            });
+        }
+
+        /// Compress published bodies and decode consumed ones according to
+        /// options. Affects operations started after the call.
+        void set_codec(const codec_options& options)
+        {
+            _codec = options;
+        }
+        
+        /// Publish msg to msg.exchange with msg.routing_key. Completes once the
+        /// message has been handed to the connection for sending. If a codec is
+        /// set the body is compressed on the calling thread.
+        template<class CompletionToken>
+        auto async_publish(message msg, CompletionToken&& token)
+        {
+            return async_initiate_future<void>(*_owner,
+                                               get_service().options().completion,
+                                               std::forward<CompletionToken>(token),
+                                               [this, &msg](auto&& my_handler)
+            {
+                if (not _impl.get()) {
+                    my_handler(system::error_code(logic_error_code::channel_not_open));
+                    return;
+                }
+                try {
+                    encode_body(msg, _codec);
+                }
+                catch(const codec_error& e) {
+                    my_handler(e);
+                    return;
+                }
+                _impl->async_publish(std::move(msg), std::move(my_handler));
+            });
+        }
+        
+        template<class CompletionToken>
+        auto async_publish(std::string exchange, std::string routing_key,
+                           std::string body, CompletionToken&& token)
+        {
+            message msg;
+            msg.exchange = std::move(exchange);
+            msg.routing_key = std::move(routing_key);
+            msg.body = std::move(body);
+            return async_publish(std::move(msg), std::forward<CompletionToken>(token));
+        }
+        
+        /// Publish a body of body_size bytes without holding it in memory.
+        /// producer(char* buffer, std::size_t max) is called on the connection's
+        /// thread for each body frame and returns the bytes it wrote; it must be
+        /// copyable and should not block. At most send_options::stream_window_frames
+        /// frames are queued at a time. header provides the exchange, routing key
+        /// and properties; its body and headers must be empty and no codec is
+        /// applied. Completes once the last frame has been queued. Fails with
+        /// runtime_error_code::memory_limit if the connection is over its memory
+        /// limit when the stream starts; later the stream pauses instead.
+        template<class Producer, class CompletionToken>
+        auto async_publish_stream(message header, std::uint64_t body_size,
+                                  Producer producer, CompletionToken&& token)
+        {
+            return async_initiate_future<void>(*_owner,
+                                               get_service().options().completion,
+                                               std::forward<CompletionToken>(token),
+                                               [this, &header, body_size, &producer](auto&& my_handler)
+            {
+                if (not _impl.get()) {
+                    my_handler(system::error_code(logic_error_code::channel_not_open));
+                }
+                else {
+                    _impl->async_publish_stream(std::move(header), body_size,
+                                                std::move(producer), std::move(my_handler));
+                }
+            });
+        }
+
+        /// Publish the contents of the file at path, read through a memory mapping
+        /// (see mapped_file_source) as frames are sent. If the file cannot be
+        /// mapped, completes with the operating system's error; future<void>&
+        /// callbacks see the boost::interprocess::interprocess_exception.
+        template<class CompletionToken>
+        auto async_publish_file(message header, const std::string& path,
+                                CompletionToken&& token)
+        {
+            return async_initiate_future<void>(*_owner,
+                                               get_service().options().completion,
+                                               std::forward<CompletionToken>(token),
+                                               [this, &header, &path](auto&& my_handler)
+            {
+                if (not _impl.get()) {
+                    my_handler(system::error_code(logic_error_code::channel_not_open));
+                    return;
+                }
+                std::unique_ptr<mapped_file_source> source;
+                try {
+                    source = std::make_unique<mapped_file_source>(path);
+                }
+                catch(const boost::interprocess::interprocess_exception& e) {
+                    auto code = e.get_native_error()
+                    ? system::error_code(e.get_native_error(), system::system_category())
+                    : system::error_code(runtime_error_code::unspecified);
+                    my_handler(failure { code, std::current_exception() });
+                    return;
+                }
+                auto size = source->size();
+                _impl->async_publish_stream(std::move(header), size,
+                                            std::move(*source), std::move(my_handler));
+            });
+        }
+
+        /// Consume from queue. on_message is called with each delivery on this
+        /// channel's io_service, after any body decoding, which also runs there.
+        /// Completes with the consumer tag.
+        template<class MessageHandler, class CompletionToken>
+        auto async_consume(std::string queue, MessageHandler&& on_message,
+                           CompletionToken&& token)
+        {
+            return async_initiate_future<std::string>(*_owner,
+                                                      get_service().options().completion,
+                                                      std::forward<CompletionToken>(token),
+                                                      [this, &queue, &on_message](auto&& my_handler)
+            {
+                if (not _impl.get()) {
+                    my_handler(system::error_code(logic_error_code::channel_not_open));
+                }
+                else {
+                    _impl->async_consume(std::move(queue),
+                                         [codec = _codec,
+                                          f = std::forward<MessageHandler>(on_message)](message& msg) mutable
+                                         {
+                                             decode_body(msg, codec);
+                                             f(msg);
+                                         },
+                                         std::move(my_handler));
+                }
+            });
+        }
+        
+        /// Consume from queue, receiving each delivery as a header, a sequence
+        /// of body chunks and a completion instead of a whole message. No codec
+        /// is applied. Completes with the consumer tag.
+        template<class CompletionToken>
+        auto async_consume_stream(std::string queue, stream_consumer consumer,
+                                  CompletionToken&& token)
+        {
+            return async_initiate_future<std::string>(*_owner,
+                                                      get_service().options().completion,
+                                                      std::forward<CompletionToken>(token),
+                                                      [this, &queue, &consumer](auto&& my_handler)
+            {
+                if (not _impl.get()) {
+                    my_handler(system::error_code(logic_error_code::channel_not_open));
+                }
+                else {
+                    _impl->async_consume_stream(std::move(queue), std::move(consumer),
+                                                std::move(my_handler));
+                }
+            });
+        }
+        
+        void ack(std::uint64_t delivery_tag, bool multiple = false)
         {
-            auto my_handler = make_future_handler<unsigned int>(get_io_service(),
-                                                                std::forward<Handler>(handler));
             if (_impl.get()) {
-                my_handler(std::logic_error("already open"));
+                _impl->ack(delivery_tag, multiple);
             }
-            else
-            {
-                _impl = std::make_shared<channel_impl>(_connection->get_impl_ptr());
-                _impl->async_open(std::move(my_handler));
+        }
+        
+        void reject(std::uint64_t delivery_tag, bool requeue = false)
+        {
+            if (_impl.get()) {
+                _impl->reject(delivery_tag, requeue);
+            }
+        }
+        
+        /// Reject delivery_tag, or with multiple every unsettled delivery up to
+        /// it (RabbitMQ's basic.nack)
+        void nack(std::uint64_t delivery_tag, bool multiple = false, bool requeue = false)
+        {
+            if (_impl.get()) {
+                _impl->nack(delivery_tag, multiple, requeue);
             }
         }
         
@@ -160,9 +1156,19 @@ namespace asio_amqp {
         connection_service& get_service() const {
             return _connection->get_service();
         }
+        
+        /// the io_service completions of this channel are delivered to
+        asio::io_service& get_owner() const {
+            return *_owner;
+        }
+        
+        std::shared_ptr<channel_impl> const& get_impl_ptr() const {
+            return _impl;
+        }
 
         asio::io_service* _owner;
 		connection* _connection;
 		std::shared_ptr<channel_impl> _impl;
+        codec_options _codec;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,69 @@
+#pragma once
+#include <asio_amqp/config.hpp>
+#include <asio_amqp/message.hpp>
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+namespace asio_amqp {
+
+    struct codec_error : std::runtime_error
+    {
+        using std::runtime_error::runtime_error;
+    };
+
+    /// Compresses and decompresses message bodies. name() is the value carried
+    /// in the content-encoding property. Implementations must be safe to call
+    /// from several threads at once.
+    struct body_codec
+    {
+        virtual ~body_codec() = default;
+
+        virtual const char* name() const = 0;
+
+        /// Replace out with the encoded form of [data, data + size)
+        virtual void encode(const char* data, std::size_t size, std::string& out) const = 0;
+
+        /// Replace out with the decoded form of [data, data + size).
+        /// @throws codec_error if the data is not valid for this codec or
+        /// decodes to more than max_size bytes
+        virtual void decode(const char* data, std::size_t size, std::string& out,
+                            std::size_t max_size) const = 0;
+    };
+
+    /// The built in codec with the given content-encoding name: "deflate"
+    /// (zlib), "lz4" (LZ4 frame) or "zstd". Returns nullptr if the name is
+    /// unknown or support for it was not compiled in.
+    const body_codec* find_codec(const std::string& name);
+
+    /// Per channel compression settings
+    struct codec_options
+    {
+        /// Codec used to compress published bodies. nullptr disables compression.
+        /// It must outlive the channel.
+        const body_codec* codec = nullptr;
+
+        /// Bodies smaller than this are sent as they are
+        std::size_t threshold = 1024;
+
+        /// Decode consumed bodies whose content-encoding is recognised
+        bool decode_on_consume = true;
+
+        /// Bodies that would decode to more than this are left encoded, so that
+        /// a small hostile body cannot exhaust memory
+        std::size_t max_decoded_size = std::size_t(64) << 20;
+    };
+
+    /// Compress msg.body with options.codec if it is at least options.threshold
+    /// bytes, does not already have a content encoding and gets smaller.
+    /// Returns true if the body was replaced.
+    bool encode_body(message& msg, const codec_options& options);
+
+    /// If options.decode_on_consume is set and msg.content_encoding names
+    /// options.codec or a built in codec, decode the body and clear
+    /// content_encoding. Returns false, leaving msg as it was, if the encoding
+    /// is unknown, the body fails to decode or it decodes to more than
+    /// options.max_decoded_size bytes.
+    bool decode_body(message& msg, const codec_options& options);
+}
@@ -0,0 +1,156 @@
+#pragma once
+#include <asio_amqp/config.hpp>
+#include <asio_amqp/future.hpp>
+
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/associated_allocator.hpp>
+
+#include <exception>
+#include <type_traits>
+#include <utility>
+
+namespace asio_amqp {
+
+    /// The signature with which generic completion tokens (asio::use_future,
+    /// asio::yield_context, asio::use_awaitable...) are completed. Failures
+    /// arrive as an error_code (see error.hpp for the categories), so neither
+    /// the library nor a callback taking the code needs to throw; use_future
+    /// and yield_context turn it into a system_error as usual.
+    template<class T>
+    struct completion_signature
+    {
+        using type = void(system::error_code, T);
+    };
+
+    template<>
+    struct completion_signature<void>
+    {
+        using type = void(system::error_code);
+    };
+
+    template<class T>
+    using completion_signature_t = typename completion_signature<T>::type;
+
+    namespace detail {
+
+        template<class...> struct make_void { using type = void; };
+        template<class...Ts> using void_t = typename make_void<Ts...>::type;
+
+        /// true if Handler is a classic asio_amqp callback, i.e. callable with future<T>&
+        /// and returning void (asio::use_future is callable with anything, but returns a token)
+        template<class T, class Handler, class = void>
+        struct is_future_callback : std::false_type {};
+
+        template<class T, class Handler>
+        struct is_future_callback<T, Handler,
+        void_t<decltype(std::declval<Handler&>()(std::declval<future<T>&>()))>>
+        : std::is_void<decltype(std::declval<Handler&>()(std::declval<future<T>&>()))> {};
+
+        /// Adapts a completion handler with signature completion_signature_t<T> to
+        /// the future<T>& interface understood by future_callback
+        template<class T, class Handler>
+        struct completion_adapter
+        {
+            completion_adapter(Handler handler)
+            : _handler(std::move(handler))
+            {}
+
+            void operator()(future<T>& f)
+            {
+                if (f.is_exception()) {
+                    _handler(f.get_error_code(), T());
+                }
+                else {
+                    _handler(system::error_code(), std::move(f.get()));
+                }
+            }
+
+            Handler _handler;
+        };
+
+        template<class Handler>
+        struct completion_adapter<void, Handler>
+        {
+            completion_adapter(Handler handler)
+            : _handler(std::move(handler))
+            {}
+
+            void operator()(future<void>& f)
+            {
+                _handler(f.get_error_code());
+            }
+
+            Handler _handler;
+        };
+
+        template<class T, class Handler>
+        auto make_completion_adapter(Handler&& handler)
+        {
+            return completion_adapter<T, std::decay_t<Handler>>(std::forward<Handler>(handler));
+        }
+
+        /// Call initiate(handler), posting any completion made before it
+        /// returns, e.g. an immediate failure, whatever the completion policy
+        template<class T, class Initiate>
+        void initiate_with(future_handler<T> handler, Initiate&& initiate)
+        {
+            // initiate may move handler away; the copy shares its callback
+            auto during = handler;
+            during.set_initiating(true);
+            initiate(std::move(handler));
+            during.set_initiating(false);
+        }
+    }
+
+    /// Start an asynchronous operation whose result is delivered to io_service
+    /// according to policy. initiate is called with a future_handler<T>. A classic future<T>& callback is
+    /// wrapped directly and the function returns void.
+    template<class T, class CompletionToken, class Initiate,
+    std::enable_if_t<detail::is_future_callback<T, std::decay_t<CompletionToken>>::value>* = nullptr>
+    void async_initiate_future(asio::io_service& io_service,
+                               completion_policy policy,
+                               CompletionToken&& token,
+                               Initiate&& initiate)
+    {
+        detail::initiate_with(make_future_handler<T>(io_service,
+                                                     std::forward<CompletionToken>(token),
+                                                     policy),
+                              std::forward<Initiate>(initiate));
+    }
+
+    /// Start an asynchronous operation whose result is delivered to io_service
+    /// according to policy. Any other completion token is completed with completion_signature_t<T> and
+    /// the function returns whatever the token's async_result dictates.
+    template<class T, class CompletionToken, class Initiate,
+    std::enable_if_t<not detail::is_future_callback<T, std::decay_t<CompletionToken>>::value>* = nullptr>
+    auto async_initiate_future(asio::io_service& io_service,
+                               completion_policy policy,
+                               CompletionToken&& token,
+                               Initiate&& initiate)
+    {
+        using signature = completion_signature_t<T>;
+        asio::async_completion<CompletionToken, signature> init(token);
+        detail::initiate_with(make_future_handler<T>(io_service,
+                                                     detail::make_completion_adapter<T>(std::move(init.completion_handler)),
+                                                     policy),
+                              std::forward<Initiate>(initiate));
+        return init.result.get();
+    }
+}
+
+namespace boost { namespace asio {
+
+    /// operation state is allocated with the allocator associated with the
+    /// underlying completion handler (e.g. the coroutine's frame allocator)
+    template<class T, class Handler, class Allocator>
+    struct associated_allocator<::asio_amqp::detail::completion_adapter<T, Handler>, Allocator>
+    {
+        using type = associated_allocator_t<Handler, Allocator>;
+
+        static type get(const ::asio_amqp::detail::completion_adapter<T, Handler>& h,
+                        const Allocator& a = Allocator()) noexcept
+        {
+            return associated_allocator<Handler, Allocator>::get(h._handler, a);
+        }
+    };
+}}
@@ -5,6 +5,7 @@
 
 #include <asio_amqp/connection_service.hpp>
 #include <asio_amqp/future.hpp>
+#include <asio_amqp/completion.hpp>
 
 namespace asio_amqp {
     struct connection
@@ -42,39 +43,76 @@ namespace asio_amqp {
         
 
         // connect
-        template<class Handler>
-        void async_connect_transport(query_type&& query, Handler&& handler)
+        
+        /// Resolve and connect the transport.
+        /// token may be a callback taking future<connect_result_type>& or any
+        /// asio completion token, completed with completion_signature_t<connect_result_type>
+        template<class CompletionToken>
+        auto async_connect_transport(query_type&& query, CompletionToken&& token)
         {
-            auto deferred_handler = make_future_handler<connect_result_type>(get_io_service(),
-                                                                             std::forward<Handler>(handler));
-            if (!_impl)
-            {
-                deferred_handler(system::system_error(logic_error_code::zombie));
-            }
-            else
+            return async_initiate_future<connect_result_type>(get_io_service(),
+                                                              get_service().options().completion,
+                                                              std::forward<CompletionToken>(token),
+                                                              [this, &query](auto&& deferred_handler)
             {
-                _impl->async_connect_transport(std::move(query), std::move(deferred_handler));
-            }
+                if (!_impl)
+                {
+                    deferred_handler(system::error_code(logic_error_code::zombie));
+                }
+                else
+                {
+                    _impl->async_connect_transport(std::move(query), std::move(deferred_handler));
+                }
+            });
         }
 
-        template<class Handler>
-        void async_connect(AMQP::Login login,
-                           std::string vhost, Handler&& handler)
+        /// Perform the AMQP handshake on a connected transport
+        template<class CompletionToken>
+        auto async_connect(AMQP::Login login,
+                           std::string vhost, CompletionToken&& token)
         {
-            auto deferred_handler = make_future_handler<connect_result_type>(get_io_service(),
-                                                                             std::forward<Handler>(handler));
-            if (!_impl)
+            return async_initiate_future<connect_result_type>(get_io_service(),
+                                                              get_service().options().completion,
+                                                              std::forward<CompletionToken>(token),
+                                                              [this, &login, &vhost](auto&& deferred_handler)
             {
-                deferred_handler(system::system_error(logic_error_code::zombie));
+                if (!_impl)
+                {
+                    deferred_handler(system::error_code(logic_error_code::zombie));
+                }
+                else
+                {
+                    _impl->async_connect(std::move(login),
+                                         std::move(vhost),
+                                         std::move(deferred_handler));
+                }
+            });
+        }
+        
+        /// Record the raw traffic of this connection to capture (see file_capture).
+        /// Pass nullptr to stop recording.
+        void set_capture(std::shared_ptr<capture_sink> capture)
+        {
+            if (_impl) {
+                _impl->set_capture(std::move(capture));
             }
-            else
-            {
-                _impl->async_connect(std::move(login),
-                                     std::move(vhost),
-                                     std::move(deferred_handler));
+        }
+        
+        /// Set the write coalescing policy, e.g. a linger of a few hundred
+        /// microseconds to batch many small publishes into fewer writes.
+        void set_send_options(const send_options& options)
+        {
+            if (_impl) {
+                _impl->set_send_options(options);
             }
         }
         
+        /// Memory currently held by this connection
+        memory_stats get_memory_stats() const
+        {
+            return _impl ? _impl->memory().stats() : memory_stats();
+        }
+        
         // cancel all outstanding handlers
         system::error_code cancel(system::error_code& ec = system::throws);
 
@@ -110,7 +148,7 @@ namespace asio_amqp {
     
     
     
-    system::error_code connection::cancel(system::error_code& ec)
+    inline system::error_code connection::cancel(system::error_code& ec)
     {
         if(_impl)
         {
@@ -122,7 +160,7 @@ namespace asio_amqp {
         return ec;
     }
     
-    void connection::close(system::error_code& ec)
+    inline void connection::close(system::error_code& ec)
     {
         if (_impl)
         {
@@ -1,10 +1,15 @@
 #pragma once
 #include <asio_amqp/config.hpp>
 #include <asio_amqp/future.hpp>
+#include <asio_amqp/memory_accountant.hpp>
+#include <asio_amqp/resolve_cache.hpp>
 #include <amqpcpp.h>
 
 #include <asio_amqp/detail/sender.hpp>
 #include <asio_amqp/detail/receiver.hpp>
+#include <asio_amqp/detail/frame_scanner.hpp>
+#include <asio_amqp/detail/frame_encoder.hpp>
+#include <asio_amqp/detail/socket_tuning.hpp>
 
 #include <memory>
 #include <mutex>
@@ -13,9 +18,27 @@
 
 namespace asio_amqp {
     
-    struct connection_failure : std::runtime_error
+    /// The broker refused or closed the connection. The code is
+    /// runtime_error_code::authentication when the broker's reply text is
+    /// ACCESS_REFUSED (reply code 403), runtime_error_code::connection_failed
+    /// otherwise. AMQP-CPP reports only the reply text, so that is what is
+    /// matched.
+    struct connection_failure : system::system_error
     {
-        using std::runtime_error::runtime_error;
+        explicit connection_failure(const std::string& message)
+        : system::system_error(code_for(message), message)
+        {}
+        
+    private:
+        static system::error_code code_for(const std::string& message)
+        {
+            // the reply text is the constant's name, then " - " and a reason
+            static const std::string access_refused = "ACCESS_REFUSED";
+            if (message.compare(0, access_refused.size(), access_refused) == 0) {
+                return runtime_error_code::authentication;
+            }
+            return runtime_error_code::connection_failed;
+        }
     };
     
     struct connection_impl
@@ -38,9 +61,19 @@ namespace asio_amqp {
             error
         };
         
-        connection_impl(asio::io_service& service_dispatcher)
+        /// memory_limit bounds the bytes held in this connection's buffers and
+        /// unacknowledged deliveries (zero for no limit); they are also charged
+        /// to memory_parent if given.
+        connection_impl(asio::io_service& service_dispatcher,
+                        std::size_t memory_limit = 0,
+                        std::shared_ptr<memory_accountant> memory_parent = nullptr)
         : _socket(service_dispatcher)
-        {}
+        , _memory(memory_limit, std::move(memory_parent))
+        {
+            _sender.set_memory(&_memory);
+            _sender.set_mutex(&_mutex);
+            _receiver.set_memory(&_memory);
+        }
         
         virtual ~connection_impl() = default;
         
@@ -48,6 +81,11 @@ namespace asio_amqp {
             return _socket.is_open();
         }
         
+        /// @pre mutex is taken
+        bool is_connected() const {
+            return _state == state_type::connected;
+        }
+        
         system::error_code close(system::error_code& ec) {
             return _socket.close(ec);
         }
@@ -84,11 +122,57 @@ namespace asio_amqp {
                                                    std::move(handler));
             });
         }
-        
-        
-                                      
-        
-        
+
+        /// Resolve, connect and perform the AMQP handshake in one sequence. The
+        /// protocol header is written from the TCP connect handler itself, and
+        /// started() is then called with the mutex taken so the caller can
+        /// queue frames (a channel.open) behind the handshake. handler
+        /// completes when the handshake does, or with the first failure.
+        template<class Started>
+        void async_open(query_type&& query, AMQP::Login&& login, std::string&& vhost,
+                        Started&& started, future_handler<void> handler)
+        {
+            post_self([this,
+                       query = std::move(query),
+                       login = std::move(login),
+                       vhost = std::move(vhost),
+                       started = std::forward<Started>(started),
+                       handler = std::move(handler)] () mutable
+            {
+                auto lock = get_lock();
+                if (_state != state_type::stopped) {
+                    handler(system::error_code(logic_error_code::wrong_state_for_connect));
+                    return;
+                }
+                _state = state_type::resolving;
+                async_resolve_and_connect(this->socket(),
+                                          std::move(query),
+                                          [this,
+                                           self = this->shared_from_this(),
+                                           login = std::move(login),
+                                           vhost = std::move(vhost),
+                                           started = std::move(started),
+                                           handler = std::move(handler)]
+                                          (failure f) mutable
+                                          {
+                                              auto lock = get_lock();
+                                              if (f) {
+                                                  _state = state_type::error;
+                                                  handler(std::move(f));
+                                                  return;
+                                              }
+                                              apply_socket_busy_poll();
+                                              _state = state_type::transport_up;
+                                              impl_async_connect(std::move(login),
+                                                                 std::move(vhost),
+                                                                 std::move(handler));
+                                              started();
+                                          },
+                                          _resolve_cache,
+                                          _socket_options);
+            });
+        }
+
         socket_type& socket() {
             return _socket;
         }
@@ -103,10 +187,149 @@ namespace asio_amqp {
             return lock_type(_mutex);
         }
         
+        /// Record all traffic on this connection to capture, or stop recording
+        /// if capture is null.
+        void set_capture(std::shared_ptr<capture_sink> capture)
+        {
+            _receiver.set_capture(capture);
+            _sender.set_capture(std::move(capture));
+        }
+        
+        /// SO_BUSY_POLL value applied once the transport is connected. Zero leaves
+        /// the socket default.
+        void set_socket_busy_poll(std::chrono::microseconds value)
+        {
+            _socket_busy_poll = value;
+        }
+        
+        /// Tuning applied to the socket before it connects, and the size of
+        /// each read from it
+        void set_socket_options(const socket_options& options)
+        {
+            auto lock = get_lock();
+            _socket_options = options;
+            _receiver.set_read_size(options.read_size);
+        }
+        
+        /// Resolve host names through cache rather than a fresh lookup per
+        /// connect. Null disables caching.
+        void set_resolve_cache(resolve_cache* cache)
+        {
+            _resolve_cache = cache;
+        }
+        
+        void set_send_options(const send_options& options)
+        {
+            auto lock = get_lock();
+            _sender.set_options(options);
+        }
+        
         AMQP::Connection* connection_ptr() const {
             return _connection.get();
         }
         
+        /// Queue frames built outside AMQP-CPP, after anything it has queued.
+        /// @pre mutex is taken
+        void send_frames(std::vector<char>&& frames)
+        {
+            _sender.queue_for_send(std::move(frames));
+        }
+        
+        /// Queue frames the caller built on its own thread. With local send
+        /// buffers they are copied into a buffer allocated here on the service
+        /// thread, so that the memory written to the socket is on its node.
+        /// @pre mutex is taken
+        void send_caller_frames(std::vector<char>&& frames)
+        {
+            if (not _local_send_buffers) {
+                _sender.queue_for_send(std::move(frames));
+                return;
+            }
+            _sender.encode_for_send(frames.size(), [&frames](std::vector<char>& out)
+                                    {
+                                        out.insert(out.end(), frames.begin(), frames.end());
+                                    });
+        }
+        
+        /// Copy frames built on other threads into buffers allocated on this
+        /// connection's thread (see send_caller_frames). Worthwhile when that
+        /// thread is pinned, so that first touch places them on its node.
+        void set_local_send_buffers(bool local)
+        {
+            auto lock = get_lock();
+            _local_send_buffers = local;
+        }
+        
+        /// Take receive buffers from pool rather than the process wide one.
+        /// Must be called before the first read.
+        void set_receive_pool(std::shared_ptr<detail::buffer_pool> pool)
+        {
+            auto lock = get_lock();
+            _receiver.set_pool(std::move(pool));
+        }
+        
+        /// Have encode(std::vector<char>&) append frames straight into the send
+        /// queue, after anything already queued.
+        /// @pre mutex is taken
+        template<class Encode>
+        void encode_frames(std::size_t size_hint, Encode&& encode)
+        {
+            _sender.encode_for_send(size_hint, std::forward<Encode>(encode));
+        }
+        
+        /// As encode_frames, for heartbeats, settlements and other small frames
+        /// on channel that should not wait behind queued publishes. They are
+        /// written ahead of queued frames of other channels.
+        /// @pre mutex is taken
+        template<class Encode>
+        void encode_control_frames(std::uint16_t channel, std::size_t size_hint, Encode&& encode)
+        {
+            _sender.encode_control(channel, size_hint, std::forward<Encode>(encode));
+        }
+        
+        /// @pre mutex is taken
+        void send_heartbeat()
+        {
+            encode_control_frames(0, detail::frame_overhead, [](std::vector<char>& out)
+                                  {
+                                      detail::frame_encoder(out).heartbeat();
+                                  });
+        }
+        
+        /// @pre mutex is taken
+        std::size_t send_pending() const {
+            return _sender.pending_bytes();
+        }
+        
+        /// @pre mutex is taken
+        const system::error_code& send_error() const {
+            return _sender.error();
+        }
+        
+        /// @pre mutex is taken
+        const send_options& get_send_options() const {
+            return _sender.options();
+        }
+        
+        /// Call f on the service thread once no more than limit bytes wait to be
+        /// written, or once writing has failed. f is called without the mutex.
+        /// @pre mutex is taken
+        void notify_when_send_below(std::size_t limit, std::function<void()> f)
+        {
+            _sender.notify_when_below(limit, std::move(f));
+        }
+        
+        /// The negotiated frame size limit, or zero if there is none
+        /// @pre mutex is taken
+        std::uint32_t max_frame() const {
+            return _connection ? _connection->maxFrame() : 0;
+        }
+        
+        
+        /// the io_service that runs the socket, and so this connection's callbacks
+        asio::io_service& get_io_service() {
+            return _socket.get_io_service();
+        }
         
         template<class F>
         void post_self(F&& f)
@@ -119,8 +342,99 @@ namespace asio_amqp {
                                           });
         }
 
+        memory_accountant& memory() {
+            return _memory;
+        }
+        
+        /// Resume reading if it was paused by the memory limit and usage has
+        /// dropped back below it.
+        /// @pre mutex is taken
+        void memory_released()
+        {
+            if (_read_paused and not _memory.over_limit()) {
+                _read_paused = false;
+                expect_response();
+            }
+        }
+        
+        /// Call f on the connection's thread with the mutex taken once the
+        /// connection and its service may be back under their memory limits,
+        /// which f must check again. Memory may be released by any connection
+        /// of the service, so this waits on the accountants rather than polling.
+        /// f is dropped if the connection is destroyed first.
+        template<class F>
+        void when_memory_available(F&& f)
+        {
+            std::weak_ptr<connection_impl> weak = shared_from_this();
+            auto resume = [weak, f = std::forward<F>(f)]
+            {
+                if (auto self = weak.lock()) {
+                    self->post_self([self, f]() mutable
+                                    {
+                                        auto lock = self->get_lock();
+                                        f();
+                                    });
+                }
+            };
+            if (not _memory.notify_below_limit(resume)) {
+                resume();
+            }
+        }
+        
+        /// Stop reading from the socket until a matching release_reading(),
+        /// e.g. while a consumer's io_service falls behind. Holds nest.
+        /// @pre mutex is taken
+        void hold_reading()
+        {
+            ++_read_holds;
+        }
+        
+        /// @pre mutex is taken, hold_reading() was called
+        void release_reading()
+        {
+            if (not --_read_holds) {
+                expect_response();
+            }
+        }
+        
+        /// Ensure a read is outstanding while the AMQP connection exists. The broker
+        /// may send deliveries, heartbeats or a close at any time. Reading pauses
+        /// while the connection or its service is over its memory limit, and
+        /// while reading is held.
+        /// @pre mutex is taken
+        void expect_response()
+        {
+            if (_connection && !_receiver.busy() && !_read_holds)
+            {
+                if (_memory.over_limit()) {
+                    pause_reading();
+                    return;
+                }
+                _receiver.async_read(_socket,
+                                     [this, self = shared_from_this()](const auto& ec,
+                                                                       auto received)
+                                 {
+                                     this->handle_read(ec, received);
+                                 });
+            }
+        }
+
     private:
         
+        /// @pre mutex is taken
+        void pause_reading()
+        {
+            if (_read_paused) { return; }
+            _read_paused = true;
+            when_memory_available([this]
+                                  {
+                                      if (_read_paused) {
+                                          _read_paused = false;
+                                          expect_response();
+                                      }
+                                  });
+        }
+        
         /// @pre this has a valid shared reference
         template<class Handler>
         void impl_async_connect_transport(query_type&& query,
@@ -135,44 +449,54 @@ namespace asio_amqp {
                                           [this,
                                            self = this->shared_from_this(),
                                            handler = std::move(handler)]
-                                          (auto& result) mutable
+                                          (failure f) mutable
                                           {
-                                              this->impl_handle_transport_connect(result,
+                                              this->impl_handle_transport_connect(std::move(f),
                                                                                   std::move(handler));
-                                          });
+                                          },
+                                          _resolve_cache,
+                                          _socket_options);
             }
             else
             {
-                handler(system::system_error(logic_error_code::wrong_state_for_connect));
+                handler(system::error_code(logic_error_code::wrong_state_for_connect));
             }
         }
         
-        /// @pre lock.owns_lock() == true
-        /// @pre result.valid() == true
+        /// f is empty if the transport connected
         template<class Handler>
-        void impl_handle_transport_connect(std::future<void>& result,
-                                           Handler&& handler)
+        void impl_handle_transport_connect(failure f, Handler&& handler)
         {
-            assert(result.valid());
-            try {
-                result.get();
-                auto lock = get_lock();
-                _state = state_type::transport_up;
+            auto lock = get_lock();
+            if (f) {
+                _state = state_type::error;
                 lock.unlock();
-                handler();
+                handler(std::move(f));
             }
-            catch(...)
-            {
-                auto lock = get_lock();
-                _state = state_type::error;
+            else {
+                apply_socket_busy_poll();
+                _state = state_type::transport_up;
                 lock.unlock();
-                handler(std::current_exception());
+                handler();
             }
         }
 
         
 
 
+        void apply_socket_busy_poll()
+        {
+#if defined(SO_BUSY_POLL)
+            if (_socket_busy_poll.count()) {
+                using busy_poll = asio::detail::socket_option::integer<SOL_SOCKET, SO_BUSY_POLL>;
+                // raising the value above net.core.busy_read needs CAP_NET_ADMIN;
+                // failing to set it is not an error for the connection
+                system::error_code sink;
+                _socket.set_option(busy_poll(int(_socket_busy_poll.count())), sink);
+            }
+#endif
+        }
+
         /// @pre lock is already taken
         template<class Handler>
         void impl_async_connect(AMQP::Login&& login, std::string&& vhost,
@@ -191,7 +515,7 @@ namespace asio_amqp {
                 } break;
 
                 default:
-                    handler(system::system_error(logic_error_code::wrong_state_for_connect));
+                    handler(system::error_code(logic_error_code::wrong_state_for_connect));
                     break;
             }
         }
@@ -200,13 +524,30 @@ namespace asio_amqp {
         /// @pre mutex is taken
         void onData(AMQP::Connection *connection, const char *buffer, size_t size) override
         {
-            _sender.queue_for_send(buffer, buffer + size);
+            std::uint16_t channel;
+            if (detail::is_channel_close(buffer, size, channel)) {
+                encode_control_frames(channel, size, [buffer, size](std::vector<char>& out)
+                                      {
+                                          out.insert(out.end(), buffer, buffer + size);
+                                      });
+            }
+            else {
+                _sender.queue_for_send(buffer, buffer + size);
+            }
+        }
+        
+        /// Answer the broker's heartbeat without going through AMQP-CPP
+        /// @pre mutex is taken
+        void onHeartbeat(AMQP::Connection *connection) override
+        {
+            send_heartbeat();
         }
         
         /// @pre mutex is taken
         void onConnected(AMQP::Connection *connection) override
         {
             assert(_state == state_type::connecting);
+            _state = state_type::connected;
             auto copy = decltype(_connect_handler)();
             std::swap(copy, _connect_handler);
             copy();
@@ -228,19 +569,6 @@ namespace asio_amqp {
             }
         }
         
-        void expect_response()
-        {
-            if (_connection && _connection->waiting() && !_receiver.busy())
-            {
-                _receiver.async_read(_socket,
-                                     [this, self = shared_from_this()](const auto& ec,
-                                                                       auto received)
-                                 {
-                                     this->handle_read(ec, received);
-                                 });
-            }
-        }
-        
         void handle_read(system::error_code const& ec, std::size_t bytes_read)
         {
             auto lock = get_lock();
@@ -248,19 +576,9 @@ namespace asio_amqp {
                 _connection->close();
             }
             else {
-                for(;;)
-                {
-                    auto buffer = _receiver.data();
-                    auto data = asio::buffer_cast<const char*>(buffer);
-                    auto length = asio::buffer_size(buffer);
-                    auto consumed = _connection->parse(data, length);
-                    if (consumed) {
-                        _receiver.consume(consumed);
-                    }
-                    else {
-                        break;
-                    }
-                }
+                _receiver.set_frame_max(_connection->maxFrame());
+                _receiver.parse(*_connection);
+                detail::renew_quick_ack(_socket, _socket_options);
                 expect_response();
             }
             
@@ -281,10 +599,17 @@ namespace asio_amqp {
         
         
         socket_type _socket;
+        memory_accountant _memory;
+        bool _read_paused = false;
+        std::size_t _read_holds = 0;            ///< see hold_reading()
         detail::sender<socket_type> _sender { _socket };
         detail::receiver _receiver;
         std::unique_ptr<AMQP::Connection> _connection;
         future_handler<void> _connect_handler;
+        std::chrono::microseconds _socket_busy_poll { 0 };
+        socket_options _socket_options;
+        resolve_cache* _resolve_cache = nullptr;
+        bool _local_send_buffers = false;
         
         
     };
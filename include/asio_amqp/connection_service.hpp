@@ -2,14 +2,37 @@
 #include <asio_amqp/async_resolve_and_connect.hpp>
 #include <asio_amqp/config.hpp>
 #include <asio_amqp/error.hpp>
+#include <asio_amqp/options.hpp>
+#include <asio_amqp/affinity.hpp>
+#include <asio_amqp/io_thread_pool.hpp>
 
 #include <boost/asio.hpp>
 #include <asio_amqp/connection_impl.hpp>
+#include <future>
 #include <thread>
 #include <memory>
+#include <mutex>
 
 namespace asio_amqp {
     
+    /// The reactor asio was configured to use for socket I/O
+    constexpr const char* io_backend_name()
+    {
+#if defined(BOOST_ASIO_HAS_IO_URING_AS_DEFAULT)
+        return "io_uring";
+#elif defined(BOOST_ASIO_HAS_IOCP)
+        return "iocp";
+#elif defined(BOOST_ASIO_HAS_EPOLL)
+        return "epoll";
+#elif defined(BOOST_ASIO_HAS_KQUEUE)
+        return "kqueue";
+#elif defined(BOOST_ASIO_HAS_DEV_POLL)
+        return "/dev/poll";
+#else
+        return "select";
+#endif
+    }
+    
     struct connection_service
     : asio::detail::service_base<connection_service>
     {
@@ -24,15 +47,84 @@ namespace asio_amqp {
         using connect_result_type = connection_impl::connect_result_type;
         
         
-        connection_service(asio::io_service& client_dispatcher)
+        connection_service(asio::io_service& client_dispatcher,
+                           service_options options = {})
         : asio::detail::service_base<connection_service>(client_dispatcher)
+        , _options(std::move(options))
+        , _dispatcher(_options.run_on_client_io_service
+                      ? client_dispatcher
+                      : _service_dispatcher)
+        , _pool(uses_shared_pool()
+                ? &io_thread_pool::shared(_options)
+                : nullptr)
+        , _resolve_cache(_options.resolve.ttl.count()
+                         ? &resolve_cache::shared(_options.resolve)
+                         : nullptr)
+        {
+            if (not _options.run_on_client_io_service and not _pool) {
+                // wait until the thread has pinned itself, so that
+                // affinity_error() reports it once construction completes
+                std::promise<system::error_code> pinned;
+                auto result = pinned.get_future();
+                _service_thread = std::thread(&connection_service::run, this, std::move(pinned));
+                note_affinity_error(result.get());
+            }
+            else if (_pool) {
+                note_affinity_error(_pool->affinity_error());
+            }
+            if (not _options.client_cpus.empty()) {
+                client_dispatcher.post([this, cpus = _options.client_cpus]
+                                       {
+                                           system::error_code ec;
+                                           pin_current_thread(cpus, ec);
+                                           note_affinity_error(ec);
+                                       });
+            }
+        }
+        
+        /// Stops and joins the service thread if the io_service never shut
+        /// the service down, e.g. when configure_connection_service fails to
+        /// register it.
+        ~connection_service()
         {
-            _service_thread = std::thread(&connection_service::run, this);
+            stop_service_thread();
         }
         
         auto create()
         {
-            return std::make_shared<impl_type>(_service_dispatcher);
+            auto& io_service = _pool ? _pool->next() : _dispatcher;
+            auto impl = std::make_shared<impl_type>(io_service,
+                                                    _options.connection_memory_limit,
+                                                    _memory);
+            impl->set_socket_busy_poll(_options.socket_busy_poll);
+            impl->set_socket_options(_options.socket);
+            impl->set_local_send_buffers(not _options.service_cpus.empty());
+            if (not _options.service_cpus.empty()) {
+                impl->set_receive_pool(detail::buffer_pool::of(io_service));
+            }
+            if (_resolve_cache) {
+                impl->set_resolve_cache(_resolve_cache);
+            }
+            return impl;
+        }
+        
+        const service_options& options() const {
+            return _options;
+        }
+        
+        /// The first failure to pin a thread to service_cpus or client_cpus,
+        /// or a clear code. Service threads are pinned by the time the service
+        /// is constructed; client_cpus is applied when the client io_service
+        /// runs its first handler.
+        system::error_code affinity_error() const
+        {
+            std::lock_guard<std::mutex> lock(_affinity_mutex);
+            return _affinity_error;
+        }
+        
+        /// Memory held by all connections of this service
+        memory_stats get_memory_stats() const {
+            return _memory->stats();
         }
         
         system::error_code cancel(const impl_ptr_type& impl, system::error_code& ec)
@@ -53,13 +145,21 @@ namespace asio_amqp {
             return ec;
         }
         
+        /// the io_service on which connections are serviced. When the shared
+        /// pool is in use each connection is given one of the pool's
+        /// io_services instead and this one is idle.
         asio::io_service& service_dispatcher() {
-            return _service_dispatcher;
+            return _dispatcher;
         }
         
         
     private:
         virtual void shutdown_service() override
+        {
+            stop_service_thread();
+        }
+        
+        void stop_service_thread()
         {
             _service_dispatcher.stop();
             if (_service_thread.joinable()) {
@@ -67,7 +167,20 @@ namespace asio_amqp {
             }
         }
         
-        void run();
+        /// pinned receives the result of pinning the thread to service_cpus
+        void run(std::promise<system::error_code> pinned);
+        
+        void note_affinity_error(const system::error_code& ec)
+        {
+            std::lock_guard<std::mutex> lock(_affinity_mutex);
+            if (ec and not _affinity_error) {
+                _affinity_error = ec;
+            }
+        }
+        
+        bool uses_shared_pool() const {
+            return _options.shared_pool_threads and not _options.run_on_client_io_service;
+        }
         
         system::error_code& zombie_check(const impl_ptr_type& impl,
                                          system::error_code& ec = system::throws)
@@ -80,8 +193,28 @@ namespace asio_amqp {
         }
         
     private:
+        service_options _options;
+        std::shared_ptr<memory_accountant> _memory {
+            std::make_shared<memory_accountant>(_options.service_memory_limit)
+        };
         asio::io_service _service_dispatcher;
         asio::io_service::work _service_work { _service_dispatcher };
+        asio::io_service& _dispatcher;
+        io_thread_pool* _pool;
+        resolve_cache* _resolve_cache;
         std::thread _service_thread;
+        mutable std::mutex _affinity_mutex;
+        system::error_code _affinity_error;
     };
+    
+    /// Create the connection_service for io_service with the given options.
+    /// @throws asio::service_already_exists if a connection has already been
+    /// created on io_service or it has already been configured
+    inline connection_service& configure_connection_service(asio::io_service& io_service,
+                                                            service_options options)
+    {
+        auto service = std::make_unique<connection_service>(io_service, std::move(options));
+        asio::add_service(io_service, service.get());
+        return *service.release();
+    }
 }
\ No newline at end of file
@@ -0,0 +1,128 @@
+#pragma once
+#include <asio_amqp/config.hpp>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace asio_amqp { namespace detail {
+
+    /// A thread safe free list of byte blocks, kept per block size. Receivers
+    /// take a block when their socket becomes readable and give it back once
+    /// everything read has been parsed, so idle connections hold none. Up to
+    /// max_retained bytes of returned blocks are kept for reuse; beyond that
+    /// they are freed. A block always goes back to the pool it came from.
+    struct buffer_pool
+    {
+        struct deleter
+        {
+            buffer_pool* pool;
+            std::size_t size;
+
+            void operator()(char* p) const {
+                pool->release(p, size);
+            }
+        };
+
+        using block_ptr = std::unique_ptr<char[], deleter>;
+
+        explicit buffer_pool(std::size_t max_retained = 16 * 1024 * 1024)
+        : _max_retained(max_retained)
+        {}
+
+        buffer_pool(const buffer_pool&) = delete;
+        buffer_pool& operator=(const buffer_pool&) = delete;
+
+        ~buffer_pool()
+        {
+            for (auto& list : _free) {
+                for (auto p : list.second) {
+                    delete [] p;
+                }
+            }
+        }
+
+        block_ptr acquire(std::size_t size)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                auto& list = _free[size];
+                if (not list.empty()) {
+                    auto p = list.back();
+                    list.pop_back();
+                    _retained -= size;
+                    return block_ptr(p, deleter { this, size });
+                }
+            }
+            return block_ptr(new char[size], deleter { this, size });
+        }
+
+        /// Bytes held in the free lists
+        std::size_t retained() const
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _retained;
+        }
+
+        /// The pool used by connections without one of their own. It is never
+        /// destroyed, so blocks released during static destruction are still
+        /// safe.
+        static buffer_pool& shared()
+        {
+            static auto pool = new buffer_pool();
+            return *pool;
+        }
+
+        /// The pool of the thread running io_service, for connections serviced
+        /// by a pinned thread: blocks are then first touched, reused and freed
+        /// on that thread's node, and the lock is shared only with its own
+        /// connections.
+        static std::shared_ptr<buffer_pool> of(asio::io_service& io_service);
+
+    private:
+        void release(char* p, std::size_t size)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (_retained + size <= _max_retained) {
+                    _free[size].push_back(p);
+                    _retained += size;
+                    return;
+                }
+            }
+            delete [] p;
+        }
+
+        mutable std::mutex _mutex;
+        std::map<std::size_t, std::vector<char*>> _free;
+        std::size_t _retained = 0;
+        const std::size_t _max_retained;
+    };
+
+    /// Owns the buffer_pool of an io_service. Receivers share ownership, so
+    /// the pool outlives any block still held after the io_service has gone.
+    struct buffer_pool_service
+    : asio::detail::service_base<buffer_pool_service>
+    {
+        explicit buffer_pool_service(asio::io_service& io_service)
+        : asio::detail::service_base<buffer_pool_service>(io_service)
+        , _pool(std::make_shared<buffer_pool>())
+        {}
+
+        const std::shared_ptr<buffer_pool>& pool() const {
+            return _pool;
+        }
+
+    private:
+        void shutdown_service() override
+        {}
+
+        std::shared_ptr<buffer_pool> _pool;
+    };
+
+    inline std::shared_ptr<buffer_pool> buffer_pool::of(asio::io_service& io_service)
+    {
+        return asio::use_service<buffer_pool_service>(io_service).pool();
+    }
+}}
@@ -0,0 +1,99 @@
+#pragma once
+#include <asio_amqp/config.hpp>
+#include <memory>
+#include <mutex>
+
+namespace asio_amqp { namespace detail {
+
+    /// Delivers handlers to one io_service until it shuts down, and drops them
+    /// after. Connections may complete on threads that outlive the io_service
+    /// their handlers belong to (the shared pool, or the service thread of
+    /// another io_service), so every delivery to a client io_service goes
+    /// through its guard.
+    struct completion_guard
+    {
+        explicit completion_guard(asio::io_service& io_service)
+        : _io_service(&io_service)
+        {}
+
+        /// The guard of io_service, shared by everything delivering to it
+        static std::shared_ptr<completion_guard> of(asio::io_service& io_service);
+
+        /// Call f(io_service) unless the io_service has shut down. Its shutdown
+        /// waits for f to return.
+        template<class F>
+        bool with_io_service(F&& f)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (not _io_service) {
+                return false;
+            }
+            f(*_io_service);
+            return true;
+        }
+
+        template<class F>
+        void post(F&& f)
+        {
+            with_io_service([&f](asio::io_service& io_service)
+                            {
+                                io_service.post(std::forward<F>(f));
+                            });
+        }
+
+        /// Run f inline if this thread is running the io_service, which then
+        /// cannot be shutting down, otherwise post it
+        template<class F>
+        void dispatch(F&& f)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (not _io_service) {
+                return;
+            }
+            if (_io_service->get_executor().running_in_this_thread()) {
+                lock.unlock();
+                f();
+                return;
+            }
+            _io_service->post(std::forward<F>(f));
+        }
+
+        void shutdown()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _io_service = nullptr;
+        }
+
+    private:
+        std::mutex _mutex;
+        asio::io_service* _io_service;
+    };
+
+    /// Owns the completion_guard of an io_service and closes it when the
+    /// io_service shuts down
+    struct completion_guard_service
+    : asio::detail::service_base<completion_guard_service>
+    {
+        explicit completion_guard_service(asio::io_service& io_service)
+        : asio::detail::service_base<completion_guard_service>(io_service)
+        , _guard(std::make_shared<completion_guard>(io_service))
+        {}
+
+        const std::shared_ptr<completion_guard>& guard() const {
+            return _guard;
+        }
+
+    private:
+        void shutdown_service() override
+        {
+            _guard->shutdown();
+        }
+
+        std::shared_ptr<completion_guard> _guard;
+    };
+
+    inline std::shared_ptr<completion_guard> completion_guard::of(asio::io_service& io_service)
+    {
+        return asio::use_service<completion_guard_service>(io_service).guard();
+    }
+}}
@@ -0,0 +1,173 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace asio_amqp { namespace detail {
+
+    /// An open addressing hash table from non-zero 64 bit correlation ids to
+    /// Value, with linear probing and backward shift deletion so that lookups
+    /// never wade through tombstones. Capacity is a power of two and the table
+    /// grows when half full. Not thread safe.
+    template<class Value>
+    struct correlation_table
+    {
+        explicit correlation_table(std::size_t capacity = 64)
+        {
+            std::size_t n = 8;
+            while (n < capacity) {
+                n *= 2;
+            }
+            _slots.resize(n);
+        }
+
+        /// @pre key is non-zero and not present
+        void insert(std::uint64_t key, Value value)
+        {
+            if ((_size + 1) * 2 > _slots.size()) {
+                grow();
+            }
+            place(key, std::move(value));
+            ++_size;
+        }
+
+        /// nullptr if key is absent
+        Value* find(std::uint64_t key)
+        {
+            auto i = index_of(key);
+            return i == npos ? nullptr : &_slots[i].value;
+        }
+
+        /// Move the value for key into out and remove it. false if absent.
+        bool take(std::uint64_t key, Value& out)
+        {
+            auto i = index_of(key);
+            if (i == npos) {
+                return false;
+            }
+            out = std::move(_slots[i].value);
+            erase_slot(i);
+            return true;
+        }
+
+        bool erase(std::uint64_t key)
+        {
+            auto i = index_of(key);
+            if (i == npos) {
+                return false;
+            }
+            erase_slot(i);
+            return true;
+        }
+
+        /// Call f(key, value&) for every entry
+        template<class F>
+        void for_each(F&& f)
+        {
+            for (auto& s : _slots) {
+                if (s.key) {
+                    f(s.key, s.value);
+                }
+            }
+        }
+
+        /// Call f(key, value&) for every entry, then empty the table
+        template<class F>
+        void drain(F&& f)
+        {
+            auto slots = std::move(_slots);
+            _slots = std::vector<slot>(slots.size());
+            _size = 0;
+            for (auto& s : slots) {
+                if (s.key) {
+                    f(s.key, s.value);
+                }
+            }
+        }
+
+        std::size_t size() const {
+            return _size;
+        }
+
+        std::size_t capacity() const {
+            return _slots.size();
+        }
+
+    private:
+        struct slot
+        {
+            std::uint64_t key = 0;
+            Value value {};
+        };
+
+        static constexpr std::size_t npos = std::size_t(-1);
+
+        std::size_t index_of(std::uint64_t key) const
+        {
+            if (not key) { return npos; }
+            for (auto i = home(key) ; ; i = next(i))
+            {
+                if (_slots[i].key == key) {
+                    return i;
+                }
+                if (not _slots[i].key) {
+                    return npos;
+                }
+            }
+        }
+
+        std::size_t home(std::uint64_t key) const
+        {
+            // fibonacci hashing spreads sequential ids over the table
+            return std::size_t((key * 0x9e3779b97f4a7c15ull) >> 32) & (_slots.size() - 1);
+        }
+
+        std::size_t next(std::size_t i) const {
+            return (i + 1) & (_slots.size() - 1);
+        }
+
+        void place(std::uint64_t key, Value&& value)
+        {
+            auto i = home(key);
+            while (_slots[i].key) {
+                i = next(i);
+            }
+            _slots[i].key = key;
+            _slots[i].value = std::move(value);
+        }
+
+        /// Empty slot i and pull later entries of the probe run back into it
+        void erase_slot(std::size_t i)
+        {
+            --_size;
+            auto mask = _slots.size() - 1;
+            for (auto j = next(i) ; _slots[j].key ; j = next(j))
+            {
+                auto h = home(_slots[j].key);
+                // move j back to i unless its home lies cyclically in (i, j]
+                if (((j - h) & mask) >= ((j - i) & mask)) {
+                    _slots[i].key = _slots[j].key;
+                    _slots[i].value = std::move(_slots[j].value);
+                    i = j;
+                }
+            }
+            _slots[i].key = 0;
+            _slots[i].value = Value();
+        }
+
+        void grow()
+        {
+            auto old = std::move(_slots);
+            _slots = std::vector<slot>(old.size() * 2);
+            for (auto& s : old) {
+                if (s.key) {
+                    place(s.key, std::move(s.value));
+                }
+            }
+        }
+
+        std::vector<slot> _slots;
+        std::size_t _size = 0;
+    };
+}}
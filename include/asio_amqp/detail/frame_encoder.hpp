@@ -0,0 +1,196 @@
+#pragma once
+#include <asio_amqp/detail/frame_scanner.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace asio_amqp { namespace detail {
+
+    /// Writes AMQP 0-9-1 frames without going through AMQP-CPP. Used where the
+    /// library must produce frames AMQP-CPP would otherwise buffer whole.
+    struct frame_encoder
+    {
+        enum : std::uint8_t {
+            method_frame = 1,
+            header_frame = 2,
+            body_frame = 3,
+            heartbeat_frame = 8
+        };
+
+        static constexpr std::uint16_t basic_class = 60;
+        static constexpr std::uint16_t basic_publish = 40;
+        static constexpr std::uint16_t basic_ack = 80;
+        static constexpr std::uint16_t basic_reject = 90;
+        static constexpr std::uint16_t basic_nack = 120;
+
+        /// content header property flags
+        enum : std::uint16_t {
+            content_type_flag = 1 << 15,
+            content_encoding_flag = 1 << 14,
+            headers_flag = 1 << 13,
+            delivery_mode_flag = 1 << 12,
+            priority_flag = 1 << 11,
+            correlation_id_flag = 1 << 10,
+            reply_to_flag = 1 << 9,
+            expiration_flag = 1 << 8,
+            message_id_flag = 1 << 7,
+            timestamp_flag = 1 << 6,
+            type_flag = 1 << 5,
+            user_id_flag = 1 << 4,
+            app_id_flag = 1 << 3
+        };
+
+        frame_encoder(std::vector<char>& out)
+        : _out(out)
+        {}
+
+        /// Start a frame. Its size is filled in by end_frame.
+        void begin_frame(std::uint8_t type, std::uint16_t channel)
+        {
+            _frame_start = _out.size();
+            put8(type);
+            put16(channel);
+            put32(0);
+        }
+
+        void end_frame()
+        {
+            auto size = std::uint32_t(_out.size() - _frame_start - frame_header_size);
+            patch32(_frame_start + 3, size);
+            put8(frame_end);
+        }
+
+        void put8(std::uint8_t v) {
+            _out.push_back(char(v));
+        }
+
+        void put16(std::uint16_t v) {
+            put8(std::uint8_t(v >> 8));
+            put8(std::uint8_t(v));
+        }
+
+        void put32(std::uint32_t v) {
+            put16(std::uint16_t(v >> 16));
+            put16(std::uint16_t(v));
+        }
+
+        void put64(std::uint64_t v) {
+            put32(std::uint32_t(v >> 32));
+            put32(std::uint32_t(v));
+        }
+
+        void put_shortstr(const std::string& s)
+        {
+            if (s.size() > 255) {
+                throw std::length_error("amqp short string longer than 255 octets");
+            }
+            put8(std::uint8_t(s.size()));
+            _out.insert(_out.end(), s.begin(), s.end());
+        }
+
+        void put_bytes(const char* data, std::size_t size) {
+            _out.insert(_out.end(), data, data + size);
+        }
+
+        void patch32(std::size_t pos, std::uint32_t v)
+        {
+            _out[pos] = char(v >> 24);
+            _out[pos + 1] = char(v >> 16);
+            _out[pos + 2] = char(v >> 8);
+            _out[pos + 3] = char(v);
+        }
+
+        /// basic.publish method frame
+        void publish_method(std::uint16_t channel,
+                            const std::string& exchange,
+                            const std::string& routing_key,
+                            bool mandatory = false,
+                            bool immediate = false)
+        {
+            begin_frame(method_frame, channel);
+            put16(basic_class);
+            put16(basic_publish);
+            put16(0);                   // reserved-1
+            put_shortstr(exchange);
+            put_shortstr(routing_key);
+            put8(std::uint8_t((mandatory ? 1 : 0) | (immediate ? 2 : 0)));
+            end_frame();
+        }
+
+        /// The fixed part of a basic content header. Properties follow, in flag
+        /// order, before end_frame.
+        void begin_content_header(std::uint16_t channel, std::uint64_t body_size,
+                                  std::uint16_t property_flags)
+        {
+            begin_frame(header_frame, channel);
+            put16(basic_class);
+            put16(0);                   // weight
+            put64(body_size);
+            put16(property_flags);
+        }
+
+        /// The body in frames of at most body_max payload bytes
+        void body_frames(std::uint16_t channel, const char* data, std::size_t size,
+                         std::size_t body_max)
+        {
+            while (size)
+            {
+                auto n = std::min(size, body_max);
+                begin_frame(body_frame, channel);
+                put_bytes(data, n);
+                end_frame();
+                data += n;
+                size -= n;
+            }
+        }
+        
+        void ack(std::uint16_t channel, std::uint64_t delivery_tag, bool multiple)
+        {
+            begin_frame(method_frame, channel);
+            put16(basic_class);
+            put16(basic_ack);
+            put64(delivery_tag);
+            put8(multiple ? 1 : 0);
+            end_frame();
+        }
+        
+        void reject(std::uint16_t channel, std::uint64_t delivery_tag, bool requeue)
+        {
+            begin_frame(method_frame, channel);
+            put16(basic_class);
+            put16(basic_reject);
+            put64(delivery_tag);
+            put8(requeue ? 1 : 0);
+            end_frame();
+        }
+        
+        /// basic.nack, the RabbitMQ extension that rejects several deliveries
+        void nack(std::uint16_t channel, std::uint64_t delivery_tag, bool multiple, bool requeue)
+        {
+            begin_frame(method_frame, channel);
+            put16(basic_class);
+            put16(basic_nack);
+            put64(delivery_tag);
+            put8(std::uint8_t((multiple ? 1 : 0) | (requeue ? 2 : 0)));
+            end_frame();
+        }
+        
+        void heartbeat()
+        {
+            begin_frame(heartbeat_frame, 0);
+            end_frame();
+        }
+        
+        std::vector<char>& buffer() {
+            return _out;
+        }
+
+    private:
+        std::vector<char>& _out;
+        std::size_t _frame_start = 0;
+    };
+}}
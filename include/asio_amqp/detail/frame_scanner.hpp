@@ -0,0 +1,135 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace asio_amqp { namespace detail {
+
+    /// AMQP 0-9-1 general frame layout:
+    ///   octet type, short channel, long size, size octets of payload, octet 0xCE
+    constexpr std::size_t frame_header_size = 7;
+    constexpr std::size_t frame_overhead = frame_header_size + 1;
+    constexpr unsigned char frame_end = 0xce;
+
+    /// "AMQP" 0 0 9 1, sent by the client before its first frame
+    constexpr std::size_t protocol_header_size = 8;
+
+    /// The outcome of scanning a receive buffer
+    struct frame_scan
+    {
+        std::size_t frames = 0;     ///< number of complete frames found
+        std::size_t bytes = 0;      ///< length of the prefix made up of complete frames
+        bool malformed = false;     ///< something other than a valid frame was found after bytes
+    };
+
+    /// method, header, body, heartbeat (and the obsolete 0-9 heartbeat type 4)
+    inline bool is_frame_type(unsigned char type)
+    {
+        return (type >= 1 and type <= 4) or type == 8;
+    }
+
+    inline std::uint32_t read_frame_size(const unsigned char* header)
+    {
+        return std::uint32_t(header[3]) << 24
+        | std::uint32_t(header[4]) << 16
+        | std::uint32_t(header[5]) << 8
+        | std::uint32_t(header[6]);
+    }
+
+    inline std::uint16_t read_frame_channel(const unsigned char* header)
+    {
+        return std::uint16_t(header[1] << 8 | header[2]);
+    }
+
+    /// The length of the frame or protocol header at the start of
+    /// [data, data + size), which may run past size if it is incomplete, or
+    /// zero if neither starts there
+    inline std::size_t unit_size(const unsigned char* data, std::size_t size)
+    {
+        if (size >= frame_overhead and is_frame_type(data[0])) {
+            return frame_overhead + std::size_t(read_frame_size(data));
+        }
+        if (size >= protocol_header_size and std::memcmp(data, "AMQP", 4) == 0) {
+            return protocol_header_size;
+        }
+        return 0;
+    }
+
+    /// The longest run of whole frames (or protocol headers) at the start of
+    /// [data, data + size) no longer than limit, but at least the first one.
+    /// Anything that parses as neither is never split: the rest of the range
+    /// is returned whole.
+    inline std::size_t frame_prefix(const char* data, std::size_t size, std::size_t limit)
+    {
+        auto first = reinterpret_cast<const unsigned char*>(data);
+        std::size_t length = 0;
+        while (auto total = unit_size(first + length, size - length))
+        {
+            if (length and length + total > limit) {
+                return length;
+            }
+            length += total;
+            if (length >= size) {
+                return size;
+            }
+        }
+        return length ? length : size;
+    }
+
+    /// If [data, data + size) is a single channel.close or channel.close-ok
+    /// method frame, set channel to its channel and return true
+    inline bool is_channel_close(const char* data, std::size_t size, std::uint16_t& channel)
+    {
+        auto first = reinterpret_cast<const unsigned char*>(data);
+        if (size < frame_overhead + 4 or first[0] != 1
+            or frame_overhead + read_frame_size(first) != size) {
+            return false;
+        }
+        auto payload = first + frame_header_size;
+        auto class_id = payload[0] << 8 | payload[1];
+        auto method_id = payload[2] << 8 | payload[3];
+        if (class_id != 20 or (method_id != 40 and method_id != 41)) {
+            return false;
+        }
+        channel = read_frame_channel(first);
+        return true;
+    }
+
+    /// Walk the frame headers in [data, data + size) once, stopping at the first
+    /// incomplete frame. Each header's position depends on the previous frame's
+    /// size so the walk is inherently serial; it touches only headers and
+    /// frame-end octets, never payload. A frame declaring a size above a
+    /// non-zero frame_max is malformed, even before all of it has arrived.
+    inline frame_scan scan_frames(const char* data, std::size_t size, std::uint32_t frame_max = 0)
+    {
+        frame_scan result;
+        auto first = reinterpret_cast<const unsigned char*>(data);
+        auto remaining = size;
+        while (remaining >= frame_overhead)
+        {
+            if (not is_frame_type(first[0])) {
+                // e.g. a protocol header sent back by a broker rejecting our version
+                result.malformed = true;
+                break;
+            }
+            auto declared = read_frame_size(first);
+            if (frame_max and declared > frame_max) {
+                result.malformed = true;
+                break;
+            }
+            auto total = frame_overhead + std::size_t(declared);
+            if (remaining < total) {
+                break;
+            }
+            if (first[total - 1] != frame_end) {
+                result.malformed = true;
+                break;
+            }
+            first += total;
+            remaining -= total;
+            result.bytes += total;
+            ++result.frames;
+        }
+        return result;
+    }
+}}
@@ -0,0 +1,109 @@
+#pragma once
+#include <asio_amqp/message.hpp>
+#include <asio_amqp/detail/frame_encoder.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace asio_amqp { namespace detail {
+
+    /// The frames of a publish to a fixed route with fixed properties,
+    /// encoded once and stamped out per message.
+    struct publish_template
+    {
+        /// properties supplies content type, content encoding and reply-to;
+        /// its body is ignored and its headers must be empty. A frame_max of
+        /// zero means the broker sets no limit.
+        /// @throws std::length_error if a name or property exceeds 255 octets
+        /// @throws std::invalid_argument if properties has headers
+        publish_template(std::uint16_t channel_id,
+                         std::uint32_t frame_max,
+                         const std::string& exchange,
+                         const std::string& routing_key,
+                         const message& properties)
+        {
+            if (not properties.headers.keys().empty()) {
+                throw std::invalid_argument("publish_template: headers are not supported");
+            }
+            using fe = frame_encoder;
+            _body_max = frame_max ? std::size_t(frame_max) - frame_overhead : 128 * 1024;
+            
+            fe method(_method);
+            method.publish_method(channel_id, exchange, routing_key);
+            
+            fe header(_header_prefix);
+            std::uint16_t flags = 0;
+            if (not properties.content_type.empty()) flags |= fe::content_type_flag;
+            if (not properties.content_encoding.empty()) flags |= fe::content_encoding_flag;
+            if (not properties.reply_to.empty()) flags |= fe::reply_to_flag;
+            header.begin_content_header(channel_id, 0, flags);
+            if (flags & fe::content_type_flag) header.put_shortstr(properties.content_type);
+            if (flags & fe::content_encoding_flag) header.put_shortstr(properties.content_encoding);
+            
+            if (not properties.reply_to.empty()) {
+                fe middle(_header_middle);
+                middle.put_shortstr(properties.reply_to);
+            }
+            
+            fe body(_body_header);
+            body.begin_frame(fe::body_frame, channel_id);
+        }
+        
+        /// Encode a complete publish of [data, data + size) into out, replacing
+        /// its contents. Empty ids are left out.
+        void encode(const char* data, std::size_t size,
+                    const std::string& correlation_id,
+                    const std::string& message_id,
+                    std::vector<char>& out) const
+        {
+            using fe = frame_encoder;
+            auto body_frames = size ? (size + _body_max - 1) / _body_max : 0;
+            out.clear();
+            out.reserve(_method.size() + _header_prefix.size() + _header_middle.size()
+                        + correlation_id.size() + message_id.size() + 3
+                        + size + body_frames * frame_overhead);
+            out.insert(out.end(), _method.begin(), _method.end());
+            
+            auto header_start = out.size();
+            out.insert(out.end(), _header_prefix.begin(), _header_prefix.end());
+            fe encoder(out);
+            // frame header 7, class 2, weight 2, then the body size and flags
+            auto size_pos = header_start + frame_header_size + 4;
+            encoder.patch32(size_pos, std::uint32_t(std::uint64_t(size) >> 32));
+            encoder.patch32(size_pos + 4, std::uint32_t(size));
+            std::uint16_t flags = std::uint16_t((std::uint8_t(out[size_pos + 8]) << 8) | std::uint8_t(out[size_pos + 9]));
+            if (not correlation_id.empty()) {
+                flags |= fe::correlation_id_flag;
+                encoder.put_shortstr(correlation_id);
+            }
+            out.insert(out.end(), _header_middle.begin(), _header_middle.end());
+            if (not message_id.empty()) {
+                flags |= fe::message_id_flag;
+                encoder.put_shortstr(message_id);
+            }
+            out[size_pos + 8] = char(flags >> 8);
+            out[size_pos + 9] = char(flags);
+            encoder.patch32(header_start + 3, std::uint32_t(out.size() - header_start - frame_header_size));
+            encoder.put8(frame_end);
+            
+            for (std::size_t offset = 0 ; offset < size ; offset += _body_max)
+            {
+                auto n = std::min(_body_max, size - offset);
+                auto frame_start = out.size();
+                out.insert(out.end(), _body_header.begin(), _body_header.end());
+                encoder.patch32(frame_start + 3, std::uint32_t(n));
+                out.insert(out.end(), data + offset, data + offset + n);
+                encoder.put8(frame_end);
+            }
+        }
+        
+    private:
+        std::size_t _body_max;
+        std::vector<char> _method;          ///< complete basic.publish frame
+        std::vector<char> _header_prefix;   ///< content header up to content encoding
+        std::vector<char> _header_middle;   ///< reply-to, between correlation and message id
+        std::vector<char> _body_header;     ///< body frame header with a zero size
+    };
+}}
@@ -1,73 +1,67 @@
 #pragma once
+#include <asio_amqp/capture.hpp>
+#include <asio_amqp/trace.hpp>
+#include <asio_amqp/memory_accountant.hpp>
+#include <asio_amqp/detail/buffer_pool.hpp>
+#include <asio_amqp/detail/frame_scanner.hpp>
+#include <atomic>
 #include <cassert>
 #include <algorithm>
 #include <vector>
-#include <array>
+#include <memory>
 #include <cstdlib>
-#include <iomanip>
+#include <cstring>
 
 namespace asio_amqp { namespace detail {
     
-    namespace detail {
-        struct chars_dumper
-        {
-            chars_dumper(const char* first, const char* last)
-            : _begin(first), _end(last)
-            {}
-            
-            std::ostream& operator()(std::ostream& os) const
-            {
-                os << '"';
-                for(auto first = _begin ; first != _end ; ++first) {
-                    
-                    auto c = *first;
-                    if (c == '\\') {
-                        os << "\\\\";
-                    }
-                    else if (std::isprint(c)) {
-                        os.put(c);
-                    }
-                    else {
-                        os << "\\x" << std::setw(2) << std::hex << std::setfill('0') << (int(c) & 0xff);
-                    }
-                }
-                os << '"';
-                return os;
-            }
-            
-            const char* _begin, *_end;
-        };
+	struct receiver
+	{
+        receiver()
+        : _pool(&buffer_pool::shared())
+        {}
         
-        inline
-        std::ostream& operator<<(std::ostream& os, chars_dumper cd)
+        ~receiver()
         {
-            return cd(os);
+            _block.reset();
+            update_charge();
         }
-    };
-    
-    inline
-    auto char_dump(const char* first, const char* last)
-    {
-        return detail::chars_dumper(first, last);
-    }
-    
-	struct receiver
-	{
+        
+        /// Read more data. While nothing is left over from earlier reads the
+        /// receiver holds no buffer: it waits for the socket to become
+        /// readable and only then takes one from the pool.
         template<class Socket, class Handler>
         void async_read(Socket& s, Handler&& handler)
         {
             assert(not busy());
             normalise();
             _receiving = true;
-            s.async_read_some(asio::buffer(_read_area),
+            if (not _block) {
+                wait_readable(s, std::forward<Handler>(handler));
+                return;
+            }
+            if (_putp == _block_size) {
+                // a frame larger than the block: double it, up to the largest
+                // frame allowed
+                auto size = _block_size * 2;
+                if (_frame_max) {
+                    size = std::min(size, std::size_t(_frame_max) + frame_overhead);
+                }
+                if (size <= _block_size) {
+                    // a full block of the largest frame, and the parser took none of it
+                    _receiving = false;
+                    s.get_io_service().post([handler = std::move(handler), left = _putp - _getp] () mutable
+                                            {
+                                                handler(system::error_code(asio::error::message_size), left);
+                                            });
+                    return;
+                }
+                replace_block(size);
+            }
+            s.async_read_some(asio::buffer(_block.get() + _putp, _block_size - _putp),
                               [this, handler = std::move(handler)]
                               (auto const& ec, auto bytes)
             {
-                _receiving = false;
-                auto first = _read_area.data();
-                auto last = first + bytes;
-                _buffer.insert(std::end(_buffer), first, last);
-                handler(ec, _buffer.size() - _getp);
+                this->received(ec, bytes, handler);
             });
         }
         
@@ -77,32 +71,175 @@ namespace asio_amqp { namespace detail {
         
         auto data()
         {
-            return asio::mutable_buffer(_buffer.data() + _getp , _buffer.size() - _getp);
+            return asio::mutable_buffer(_block.get() + _getp, _putp - _getp);
         }
         
         void consume(std::size_t bytes)
         {
-            BOOST_LOG_TRIVIAL(trace) << "consuming: " << char_dump(&_buffer[_getp], &_buffer[_getp + bytes]);
+            ASIO_AMQP_TRACE(trace_event::consume, bytes, _getp);
             _getp += bytes;
-            assert(_getp <= _buffer.size());
+            assert(_getp <= _putp);
         }
         
+        /// Hand every complete frame received to parser.parse(data, size) as
+        /// one batch and consume what it accepts, leaving a partial tail for
+        /// the next read. Malformed data, including a frame declaring more
+        /// than frame_max, is passed on whole so that the parser reports it.
+        /// Returns the bytes consumed.
+        template<class Parser>
+        std::size_t parse(Parser& parser)
+        {
+            auto buffer = data();
+            auto first = asio::buffer_cast<const char*>(buffer);
+            auto scan = scan_frames(first, asio::buffer_size(buffer), _frame_max);
+            auto length = scan.malformed ? asio::buffer_size(buffer) : scan.bytes;
+            std::size_t parsed = 0;
+            while (parsed < length)
+            {
+                auto consumed = parser.parse(first + parsed, length - parsed);
+                if (not consumed) {
+                    break;
+                }
+                parsed += consumed;
+            }
+            if (parsed) {
+                consume(parsed);
+            }
+            return parsed;
+        }
+        
+        /// Move unparsed data to the front of the block. Once everything has
+        /// been parsed and the last read left the socket empty, the block goes
+        /// back to the pool.
         void normalise()
         {
-            if (_getp) {
-                auto new_size = _buffer.size() - _getp;
-                auto dfirst = _buffer.data();
-                auto sfirst = dfirst + _getp;
-                auto slast = sfirst + new_size;
-                std::copy(sfirst, slast, dfirst);
-                _buffer.resize(new_size);
+            if (_getp == _putp) {
+                _getp = _putp = 0;
+                if (_block and _socket_drained) {
+                    _block.reset();
+                    update_charge();
+                }
+            }
+            else if (_getp) {
+                std::memmove(_block.get(), _block.get() + _getp, _putp - _getp);
+                _putp -= _getp;
                 _getp = 0;
             }
         }
+        
+        /// Charge the block held to memory
+        void set_memory(memory_accountant* memory) {
+            _memory = memory;
+            update_charge();
+        }
+        
+        void update_charge()
+        {
+            auto now = _block ? _block_size : 0;
+            if (_memory) {
+                _memory->adjust(_charged, now);
+                _charged = now;
+            }
+        }
+
+        /// May be called from any thread; a read in progress records to
+        /// whichever sink it finds when it completes.
+        void set_capture(std::shared_ptr<capture_sink> capture) {
+            std::atomic_store(&_capture, std::move(capture));
+        }
+
+        /// Bytes asked for by each read. Takes effect when the next block is
+        /// taken.
+        void set_read_size(std::size_t size) {
+            _read_size = size ? size : default_read_size;
+        }
+
+        /// The negotiated frame size limit, zero for none. Frames declaring
+        /// more are malformed, and the block never grows beyond one such frame.
+        void set_frame_max(std::uint32_t frame_max) {
+            _frame_max = frame_max;
+        }
 
-        std::array<char, 65536> _read_area;
-        std::vector<char> _buffer;
+        /// Take blocks from pool instead of the shared one
+        void set_pool(buffer_pool& pool) {
+            assert(not _block);
+            _pool = &pool;
+        }
+
+        /// Take blocks from pool, keeping it alive while this receiver lives
+        void set_pool(std::shared_ptr<buffer_pool> pool) {
+            set_pool(*pool);
+            _pool_owner = std::move(pool);
+        }
+
+        static constexpr std::size_t default_read_size = 65536;
+
+    private:
+        template<class Socket, class Handler>
+        void wait_readable(Socket& s, Handler&& handler)
+        {
+            s.async_read_some(asio::null_buffers(),
+                              [this, &s, handler = std::move(handler)]
+                              (auto const& ec, auto) mutable
+            {
+                if (ec) {
+                    this->received(ec, 0, handler);
+                    return;
+                }
+                _block = _pool->acquire(_read_size);
+                _block_size = _read_size;
+                update_charge();
+                system::error_code read_ec;
+                if (not s.non_blocking()) {
+                    s.non_blocking(true, read_ec);
+                }
+                auto bytes = s.read_some(asio::buffer(_block.get(), _block_size), read_ec);
+                if (read_ec == asio::error::would_block or read_ec == asio::error::try_again) {
+                    _block.reset();
+                    update_charge();
+                    this->wait_readable(s, std::move(handler));
+                    return;
+                }
+                this->received(read_ec, bytes, handler);
+            });
+        }
+        
+        template<class Handler>
+        void received(system::error_code const& ec, std::size_t bytes, Handler& handler)
+        {
+            _receiving = false;
+            if (bytes) {
+                if (auto capture = std::atomic_load(&_capture)) {
+                    capture->record(capture_sink::direction::inbound, _block.get() + _putp, bytes);
+                }
+            }
+            _socket_drained = _putp + bytes < _block_size;
+            _putp += bytes;
+            ASIO_AMQP_TRACE(trace_event::receive, bytes, _putp - _getp);
+            handler(ec, _putp - _getp);
+        }
+        
+        void replace_block(std::size_t size)
+        {
+            auto block = _pool->acquire(size);
+            std::memcpy(block.get(), _block.get(), _putp);
+            _block = std::move(block);
+            _block_size = size;
+            update_charge();
+        }
+        
+        buffer_pool* _pool;
+        std::shared_ptr<buffer_pool> _pool_owner;
+        buffer_pool::block_ptr _block { nullptr, buffer_pool::deleter { nullptr, 0 } };
+        std::size_t _block_size = 0;
+        std::size_t _read_size = default_read_size;
+        std::uint32_t _frame_max = 0;
         std::size_t _getp = 0;
+        std::size_t _putp = 0;
+        bool _socket_drained = true;
         bool _receiving = false;
+        std::shared_ptr<capture_sink> _capture;
+        memory_accountant* _memory = nullptr;
+        std::size_t _charged = 0;
 	};
-}}
\ No newline at end of file
+}}
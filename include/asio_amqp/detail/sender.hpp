@@ -1,68 +1,432 @@
 #pragma once
 #include <asio_amqp/config.hpp>
+#include <asio_amqp/capture.hpp>
+#include <asio_amqp/trace.hpp>
+#include <asio_amqp/options.hpp>
+#include <asio_amqp/memory_accountant.hpp>
+#include <asio_amqp/detail/frame_scanner.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
 #include <deque>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
 #include <vector>
 #include <cstdint>
-#include <boost/log/trivial.hpp>
 
 namespace asio_amqp { namespace detail {
     
     
+    /// Frames queued in the control lane are written ahead of those queued in
+    /// the bulk lane, except where that would reorder frames of one channel.
+    /// AMQP allows frames of different channels to interleave, even inside
+    /// another channel's content, so jumping ahead at any frame boundary is
+    /// safe for a control frame whose channel has nothing in the bulk lane.
     template<class StreamType>
     struct sender
     {
-        sender(StreamType& stream) : _stream(stream) {}
+        using clock_type = std::chrono::steady_clock;
+        
+        sender(StreamType& stream)
+        : _stream(stream)
+        , _linger_timer(stream.get_io_service())
+        {}
         
         template<class Iter>
         void queue_for_send(Iter first, Iter last)
         {
             if (first != last) {
-                _send_buffers.emplace_back(first, last);
-                check_send();
+                encode_for_send(std::size_t(std::distance(first, last)),
+                                [first, last](std::vector<char>& out)
+                                {
+                                    out.insert(out.end(), first, last);
+                                });
+            }
+        }
+        
+        /// Have encode(std::vector<char>&) append frames directly to the bulk
+        /// lane. They go on the end of the last queued buffer while it is
+        /// under max_batch_bytes, otherwise into a new one with room for at
+        /// least size_hint bytes. If encode throws, whatever it appended is
+        /// removed.
+        template<class Encode>
+        void encode_for_send(std::size_t size_hint, Encode&& encode)
+        {
+            auto appendable = not _bulk.empty()
+            and _bulk.back().size() < _options.max_batch_bytes
+            and not (_front_in_flight and _bulk.size() == 1);
+            auto added = append(_bulk, appendable, size_hint, std::forward<Encode>(encode));
+            if (added.second) {
+                note_channels(added.first, added.second);
+                queued(added.second);
+            }
+        }
+        
+        /// As encode_for_send, but the frames, all on channel, go in the control
+        /// lane unless the bulk lane holds frames of that channel.
+        template<class Encode>
+        void encode_control(std::uint16_t channel, std::size_t size_hint, Encode&& encode)
+        {
+            if (bulk_holds(channel)) {
+                encode_for_send(size_hint, std::forward<Encode>(encode));
+                return;
+            }
+            auto added = append(_control, not _control.empty(), size_hint, std::forward<Encode>(encode));
+            if (added.second) {
+                queued(added.second);
+            }
+        }
+        
+        /// Queue an already built buffer in the bulk lane without copying it
+        void queue_for_send(std::vector<char>&& buffer)
+        {
+            if (not buffer.empty()) {
+                if (_bulk.empty() and _control.empty()) {
+                    _batch_start = clock_type::now();
+                }
+                _bulk.push_back(std::move(buffer));
+                auto const& buf = _bulk.back();
+                note_channels(buf.data(), buf.size());
+                queued(buf.size());
             }
         }
         
+        /// May be called from any thread; takes effect from the next write.
+        void set_capture(std::shared_ptr<capture_sink> capture) {
+            std::atomic_store(&_capture, std::move(capture));
+        }
+        
+        /// Take mutex in the sender's own completion handlers, as the owner
+        /// takes it around every other call
+        void set_mutex(std::recursive_mutex* mutex) {
+            _mutex = mutex;
+        }
+        
+        /// Charge queued and in-flight bytes to memory
+        void set_memory(memory_accountant* memory) {
+            _memory = memory;
+        }
+        
+        void set_options(const send_options& options) {
+            _options = options;
+        }
+        
+        const send_options& options() const {
+            return _options;
+        }
+        
+        /// bytes queued but not yet handed to a write
+        std::size_t queued_bytes() const {
+            return _queued_bytes;
+        }
+        
+        /// bytes queued or being written
+        std::size_t pending_bytes() const {
+            return _queued_bytes + _sending_bytes;
+        }
+        
+        /// the error that stopped the last write, if any
+        const system::error_code& error() const {
+            return _error;
+        }
+        
+        /// Call f once a write completes leaving no more than limit bytes
+        /// pending, or once a write fails. f is called without the mutex.
+        void notify_when_below(std::size_t limit, std::function<void()> f)
+        {
+            _drain_waiters.emplace_back(limit, std::move(f));
+        }
+        
+        
     private:
+        /// smallest buffer started by encode_for_send, so that small frames coalesce
+        static constexpr std::size_t min_buffer_size = 4096;
+        
+        /// Append to the last buffer of lane if appendable, otherwise to a new
+        /// one. Returns where the new bytes are and how many there are.
+        template<class Lane, class Encode>
+        std::pair<const char*, std::size_t> append(Lane& lane, bool appendable,
+                                                   std::size_t size_hint, Encode&& encode)
+        {
+            if (not appendable)
+            {
+                if (_bulk.empty() and _control.empty()) {
+                    _batch_start = clock_type::now();
+                }
+                lane.emplace_back();
+                lane.back().reserve(std::max(size_hint, std::size_t(min_buffer_size)));
+            }
+            auto& buf = lane.back();
+            auto start = buf.size();
+            try {
+                encode(buf);
+            }
+            catch(...) {
+                // never leave part of a frame queued
+                buf.resize(start);
+                if (buf.empty()) {
+                    lane.pop_back();
+                }
+                throw;
+            }
+            auto added = buf.size() - start;
+            if (not added and buf.empty()) {
+                lane.pop_back();
+                return { nullptr, 0 };
+            }
+            return { buf.data() + start, added };
+        }
+        
+        void queued(std::size_t added)
+        {
+            _queued_bytes += added;
+            if (_memory) {
+                _memory->charge(added);
+            }
+            ASIO_AMQP_TRACE(trace_event::send_queued, added, _bulk.size() + _control.size());
+            check_send();
+        }
+        
+        /// Call f(channel) for each frame in [data, data + size), walking the
+        /// same units frame_prefix cuts at, so that a range is uncounted
+        /// exactly as it was counted however take_bulk splits it. The
+        /// protocol header counts as a frame of channel 0; bytes that parse as
+        /// neither are not counted.
+        template<class F>
+        static void for_each_frame_channel(const char* data, std::size_t size, F&& f)
+        {
+            auto first = reinterpret_cast<const unsigned char*>(data);
+            std::size_t pos = 0;
+            while (pos < size)
+            {
+                auto total = unit_size(first + pos, size - pos);
+                if (not total) {
+                    return;
+                }
+                f(is_frame_type(first[pos]) ? read_frame_channel(first + pos) : std::uint16_t(0));
+                pos += total;
+            }
+        }
+        
+        using channel_count = std::pair<std::uint16_t, std::size_t>;
+        
+        static bool channel_less(const channel_count& entry, std::uint16_t channel) {
+            return entry.first < channel;
+        }
+        
+        bool bulk_holds(std::uint16_t channel) const
+        {
+            auto i = std::lower_bound(_bulk_channels.begin(), _bulk_channels.end(), channel, &channel_less);
+            return i != _bulk_channels.end() and i->first == channel;
+        }
+        
+        /// Count the frames in [data, data + size), just queued in the bulk lane
+        void note_channels(const char* data, std::size_t size)
+        {
+            for_each_frame_channel(data, size, [this](std::uint16_t channel)
+                                   {
+                                       auto i = std::lower_bound(_bulk_channels.begin(), _bulk_channels.end(),
+                                                                 channel, &channel_less);
+                                       if (i == _bulk_channels.end() or i->first != channel) {
+                                           i = _bulk_channels.insert(i, channel_count(channel, 0));
+                                       }
+                                       ++i->second;
+                                   });
+        }
+        
+        /// Uncount the frames in [data, data + size), just handed to a write.
+        /// A channel is dropped once none of its frames are left queued.
+        void forget_channels(const char* data, std::size_t size)
+        {
+            for_each_frame_channel(data, size, [this](std::uint16_t channel)
+                                   {
+                                       auto i = std::lower_bound(_bulk_channels.begin(), _bulk_channels.end(),
+                                                                 channel, &channel_less);
+                                       if (i != _bulk_channels.end() and i->first == channel and --i->second == 0) {
+                                           _bulk_channels.erase(i);
+                                       }
+                                   });
+        }
+        
         void check_send()
         {
-            if (_send_in_progress or _send_buffers.empty()) { return; }
+            if (_send_in_progress or (_bulk.empty() and _control.empty())) { return; }
+            if (_control.empty() and should_linger()) {
+                arm_linger();
+                return;
+            }
+            if (_linger_armed) {
+                _linger_armed = false;
+                _linger_timer.cancel();
+            }
+            _send_in_progress = true;
             _sending_buffers.clear();
-            std::swap(_sending_buffers, _send_buffers);
-            build_asio_buffers();
+            _asio_buffers.clear();
+            take_control();
+            take_bulk();
+            _queued_bytes -= _sending_bytes;
+            if (auto capture = std::atomic_load(&_capture)) {
+                for (auto const& buf : _asio_buffers) {
+                    capture->record(capture_sink::direction::outbound,
+                                     asio::buffer_cast<const char*>(buf), asio::buffer_size(buf));
+                }
+            }
             asio::async_write(_stream,
                               _asio_buffers,
                               [this] (const system::error_code& ec,
                                       std::size_t sent)
                               {
+                                  auto lock = lock_handler();
                                   _send_in_progress = false;
+                                  _front_in_flight = false;
+                                  if (_memory) {
+                                      _memory->release(_sending_bytes);
+                                  }
+                                  _sending_bytes = 0;
                                   if (ec) {
-                                      BOOST_LOG_TRIVIAL(info) << "asio_amqp::send failure: " << ec.message();
-                                      // somehow send this error up the chain
+                                      ASIO_AMQP_WARNING(trace_event::send_failure, ec.value());
+                                      _error = ec;
                                   }
                                   else {
+                                      ASIO_AMQP_TRACE(trace_event::send_complete, sent);
                                       check_send();
                                   }
+                                  auto ready = take_drained();
+                                  if (lock) {
+                                      lock.unlock();
+                                  }
+                                  for (auto& f : ready) {
+                                      f();
+                                  }
                               });
             
         }
         
-        void build_asio_buffers()
+        /// Hand the whole control lane to the next write
+        void take_control()
         {
-            _asio_buffers.clear();
-            _asio_buffers.reserve(_sending_buffers.size());
-            std::transform(std::begin(_sending_buffers), std::end(_sending_buffers),
-                           std::back_inserter(_asio_buffers),
-                           [](const auto& buf) {
-                               return asio::buffer(buf);
-                           });
+            for (auto& buf : _control) {
+                _sending_bytes += buf.size();
+                _sending_buffers.push_back(std::move(buf));
+                const auto& sending = _sending_buffers.back();
+                _asio_buffers.push_back(asio::buffer(sending));
+            }
+            _control.clear();
+        }
+        
+        /// Hand up to max_write_bytes of the bulk lane to the next write, cut
+        /// at a frame boundary. A partly written first buffer stays queued.
+        void take_bulk()
+        {
+            auto budget = _options.max_write_bytes ? _options.max_write_bytes
+            : std::numeric_limits<std::size_t>::max();
+            std::size_t taken = 0;
+            while (not _bulk.empty() and taken < budget)
+            {
+                auto& front = _bulk.front();
+                const char* data = front.data() + _bulk_offset;
+                auto available = front.size() - _bulk_offset;
+                auto length = available;
+                if (taken + available > budget) {
+                    length = frame_prefix(data, available, budget - taken);
+                    if (taken and taken + length > budget) {
+                        break;
+                    }
+                }
+                _asio_buffers.push_back(asio::buffer(data, length));
+                forget_channels(data, length);
+                taken += length;
+                if (length == available) {
+                    _sending_buffers.push_back(std::move(front));
+                    _bulk.pop_front();
+                    _bulk_offset = 0;
+                }
+                else {
+                    _bulk_offset += length;
+                    _front_in_flight = true;
+                    break;
+                }
+            }
+            _sending_bytes += taken;
+            assert(not _bulk.empty() or _bulk_channels.empty());
+        }
+        
+        /// Remove and return the drain waiters whose condition now holds
+        std::vector<std::function<void()>> take_drained()
+        {
+            std::vector<std::function<void()>> ready;
+            if (_drain_waiters.empty()) { return ready; }
+            auto waiters = std::move(_drain_waiters);
+            _drain_waiters.clear();
+            for (auto& waiter : waiters)
+            {
+                if (_error or pending_bytes() <= waiter.first) {
+                    ready.push_back(std::move(waiter.second));
+                }
+                else {
+                    _drain_waiters.push_back(std::move(waiter));
+                }
+            }
+            return ready;
         }
         
+        std::unique_lock<std::recursive_mutex> lock_handler()
+        {
+            return _mutex ? std::unique_lock<std::recursive_mutex>(*_mutex)
+            : std::unique_lock<std::recursive_mutex>();
+        }
+        
+        /// true if the current batch should wait for more frames
+        bool should_linger() const
+        {
+            return _options.linger.count() > 0
+            and _queued_bytes < _options.max_batch_bytes
+            and clock_type::now() < _batch_start + _options.linger;
+        }
+        
+        void arm_linger()
+        {
+            if (_linger_armed) { return; }
+            _linger_armed = true;
+            _linger_timer.expires_at(_batch_start + _options.linger);
+            _linger_timer.async_wait([this](const system::error_code& ec)
+                                     {
+                                         if (ec == asio::error::operation_aborted) { return; }
+                                         auto lock = lock_handler();
+                                         // cancelled too late to be aborted
+                                         if (_linger_armed) {
+                                             _linger_armed = false;
+                                             check_send();
+                                         }
+                                     });
+        }
         
         
         StreamType& _stream;
-        std::vector<std::vector<char>> _send_buffers;
+        std::vector<std::vector<char>> _control;
+        std::deque<std::vector<char>> _bulk;
+        std::size_t _bulk_offset = 0;               ///< bytes of _bulk.front() already handed to writes
+        bool _front_in_flight = false;              ///< the write in progress ends inside _bulk.front()
+        std::vector<channel_count> _bulk_channels;  ///< sorted; channels with frames in _bulk, and how many
         std::vector<std::vector<char>> _sending_buffers;
         std::vector<asio::const_buffers_1> _asio_buffers;
         bool _send_in_progress = false;
+        std::size_t _sending_bytes = 0;
+        system::error_code _error;
+        std::vector<std::pair<std::size_t, std::function<void()>>> _drain_waiters;
+        std::shared_ptr<capture_sink> _capture;
+        memory_accountant* _memory = nullptr;
+        std::recursive_mutex* _mutex = nullptr;
+        
+        send_options _options;
+        std::size_t _queued_bytes = 0;
+        clock_type::time_point _batch_start;
+        asio::steady_timer _linger_timer;
+        bool _linger_armed = false;
     };
-}}
+}}
\ No newline at end of file
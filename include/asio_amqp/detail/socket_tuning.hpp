@@ -0,0 +1,92 @@
+#pragma once
+#include <asio_amqp/config.hpp>
+#include <asio_amqp/options.hpp>
+
+#include <boost/asio/ip/tcp.hpp>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+namespace asio_amqp { namespace detail {
+
+    template<int Level, int Name>
+    using int_socket_option = asio::detail::socket_option::integer<Level, Name>;
+
+    /// Set an integer option, ignoring refusal: tuning never fails a connect
+    template<int Level, int Name, class Socket>
+    void set_int_option(Socket& socket, long long value)
+    {
+        if (value > 0) {
+            system::error_code sink;
+            socket.set_option(int_socket_option<Level, Name>(int(value)), sink);
+        }
+    }
+
+    /// Re-enable TCP_QUICKACK, which the kernel turns off again by itself
+    template<class Socket>
+    void renew_quick_ack(Socket& socket, const socket_options& options)
+    {
+#if defined(TCP_QUICKACK)
+        if (options.quick_ack) {
+            set_int_option<IPPROTO_TCP, TCP_QUICKACK>(socket, 1);
+        }
+#endif
+    }
+
+    /// SO_SNDBUF and SO_RCVBUF as the kernel reports them, or zero if it
+    /// would not say
+    struct socket_buffer_sizes
+    {
+        int send_buffer = 0;
+        int receive_buffer = 0;
+    };
+
+    /// Apply options to an open socket which is about to connect. Buffer
+    /// sizes must be set before the connect for the window scale offered in
+    /// the SYN to account for them. Returns the buffer sizes in effect
+    /// afterwards, which Linux doubles and caps at wmem_max / rmem_max.
+    /// Never throws: an option the socket refuses is left as it was.
+    template<class Socket>
+    socket_buffer_sizes apply_socket_options(Socket& socket, const socket_options& options)
+    {
+        system::error_code sink;
+        socket.set_option(asio::ip::tcp::no_delay(options.no_delay), sink);
+        if (options.send_buffer > 0) {
+            socket.set_option(asio::socket_base::send_buffer_size(options.send_buffer), sink);
+        }
+        if (options.receive_buffer > 0) {
+            socket.set_option(asio::socket_base::receive_buffer_size(options.receive_buffer), sink);
+        }
+        if (options.keepalive) {
+            socket.set_option(asio::socket_base::keep_alive(true), sink);
+#if defined(TCP_KEEPIDLE)
+            set_int_option<IPPROTO_TCP, TCP_KEEPIDLE>(socket, options.keepalive_idle.count());
+#endif
+#if defined(TCP_KEEPINTVL)
+            set_int_option<IPPROTO_TCP, TCP_KEEPINTVL>(socket, options.keepalive_interval.count());
+#endif
+#if defined(TCP_KEEPCNT)
+            set_int_option<IPPROTO_TCP, TCP_KEEPCNT>(socket, options.keepalive_count);
+#endif
+        }
+#if defined(TCP_USER_TIMEOUT)
+        set_int_option<IPPROTO_TCP, TCP_USER_TIMEOUT>(socket, options.user_timeout.count());
+#endif
+#if defined(TCP_NOTSENT_LOWAT)
+        set_int_option<IPPROTO_TCP, TCP_NOTSENT_LOWAT>(socket, static_cast<long long>(options.notsent_lowat));
+#endif
+        renew_quick_ack(socket, options);
+
+        socket_buffer_sizes effective;
+        asio::socket_base::send_buffer_size send_buffer;
+        socket.get_option(send_buffer, sink);
+        if (not sink) {
+            effective.send_buffer = send_buffer.value();
+        }
+        asio::socket_base::receive_buffer_size receive_buffer;
+        socket.get_option(receive_buffer, sink);
+        if (not sink) {
+            effective.receive_buffer = receive_buffer.value();
+        }
+        return effective;
+    }
+}}
@@ -0,0 +1,125 @@
+#pragma once
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+
+namespace asio_amqp { namespace detail {
+
+    /// A fixed size binary trace record
+    struct trace_record
+    {
+        static constexpr std::size_t max_args = 4;
+
+        std::uint64_t timestamp;    ///< nanoseconds, steady clock
+        std::uint16_t event;
+        std::uint8_t level;
+        std::uint8_t nargs;
+        std::uint64_t args[max_args];
+    };
+
+    /// Lock-free multi-producer ring of trace records. Producers never block
+    /// and never fail; when the ring is full the oldest records are overwritten,
+    /// and records of producers that lap each other on one slot are dropped.
+    /// A single consumer drains records with drain(), which skips records that
+    /// were overwritten or are still being written.
+    struct trace_ring
+    {
+        /// @pre capacity is a power of 2
+        explicit trace_ring(std::size_t capacity)
+        : _mask(capacity - 1)
+        , _slots(new slot[capacity])
+        {
+            assert(capacity and (capacity & _mask) == 0);
+            for (std::size_t i = 0 ; i < capacity ; ++i) {
+                _slots[i].seq.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        void push(const trace_record& rec) noexcept
+        {
+            auto index = _head.fetch_add(1, std::memory_order_relaxed);
+            auto& s = _slots[index & _mask];
+            // a producer a lap behind may still be writing this slot; then
+            // neither record can be trusted and neither is published
+            auto contended = s.writers.fetch_add(1, std::memory_order_acq_rel) != 0;
+            // odd sequence: being written
+            auto writing = index * 2 + 1;
+            s.seq.store(writing, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            s.words[0].store(rec.timestamp, std::memory_order_relaxed);
+            s.words[1].store(std::uint64_t(rec.event)
+                             | std::uint64_t(rec.level) << 16
+                             | std::uint64_t(rec.nargs) << 24,
+                             std::memory_order_relaxed);
+            for (std::size_t i = 0 ; i < trace_record::max_args ; ++i) {
+                s.words[2 + i].store(rec.args[i], std::memory_order_relaxed);
+            }
+            if (not contended) {
+                // fails if a producer a lap ahead has claimed the slot meanwhile
+                s.seq.compare_exchange_strong(writing, index * 2 + 2,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed);
+            }
+            s.writers.fetch_sub(1, std::memory_order_release);
+        }
+
+        /// Deliver every complete record written since the last drain to f, oldest
+        /// first. Returns the number of records lost to overwriting or torn reads.
+        template<class F>
+        std::size_t drain(F&& f)
+        {
+            std::size_t lost = 0;
+            auto head = _head.load(std::memory_order_acquire);
+            auto capacity = _mask + 1;
+            if (head - _tail > capacity) {
+                lost += head - _tail - capacity;
+                _tail = head - capacity;
+            }
+            for ( ; _tail != head ; ++_tail)
+            {
+                auto& s = _slots[_tail & _mask];
+                auto expected = _tail * 2 + 2;
+                if (s.seq.load(std::memory_order_acquire) != expected) {
+                    ++lost;
+                    continue;
+                }
+                trace_record rec;
+                rec.timestamp = s.words[0].load(std::memory_order_relaxed);
+                auto w = s.words[1].load(std::memory_order_relaxed);
+                rec.event = std::uint16_t(w);
+                rec.level = std::uint8_t(w >> 16);
+                rec.nargs = std::uint8_t(w >> 24);
+                for (std::size_t i = 0 ; i < trace_record::max_args ; ++i) {
+                    rec.args[i] = s.words[2 + i].load(std::memory_order_relaxed);
+                }
+                // a writer that started while we copied has changed the sequence
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (s.seq.load(std::memory_order_relaxed) != expected) {
+                    ++lost;
+                    continue;
+                }
+                f(rec);
+            }
+            return lost;
+        }
+
+        std::size_t capacity() const {
+            return _mask + 1;
+        }
+
+    private:
+        struct slot
+        {
+            std::atomic<std::uint64_t> seq;
+            std::atomic<std::uint32_t> writers { 0 };
+            std::atomic<std::uint64_t> words[2 + trace_record::max_args];
+        };
+
+        const std::uint64_t _mask;
+        std::unique_ptr<slot[]> _slots;
+        std::atomic<std::uint64_t> _head { 0 };
+        std::uint64_t _tail = 0;
+    };
+}}
@@ -7,12 +7,23 @@ namespace asio_amqp {
     enum class logic_error_code
     {
         wrong_state_for_connect,
-        zombie
+        zombie,
+        channel_not_open,
+        invalid_uri
     };
     
+    /// Failures reported by the library itself. Failures from the operating
+    /// system keep their own codes: a failed lookup arrives in asio's netdb or
+    /// addrinfo category, a failed connect in the system category.
     enum class runtime_error_code
     {
-        authentication
+        authentication,
+        memory_limit,
+        timed_out,
+        cancelled,
+        connection_failed,      ///< the broker refused or closed the connection
+        channel_failed,         ///< the broker refused or closed the channel
+        unspecified             ///< an exception that carries no error_code
     };
     
     system::error_code make_error_code( logic_error_code e ) noexcept;
@@ -86,9 +97,9 @@ namespace asio_amqp {
         return ec;
     }
     
-    struct resolve_failure : std::runtime_error
+    struct resolve_failure : system::system_error
     {
-        using std::runtime_error::runtime_error;
+        using system::system_error::system_error;
     };
     
     
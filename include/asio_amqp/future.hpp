@@ -1,9 +1,79 @@
 #pragma once
 #include <asio_amqp/config.hpp>
-
+#include <asio_amqp/error.hpp>
+#include <asio_amqp/detail/completion_guard.hpp>
+#include <boost/asio/associated_allocator.hpp>
+#include <atomic>
+#include <functional>
 
 namespace asio_amqp {
     
+    /// Builds the exception of a failure when it is first asked for
+    using exception_factory = std::function<std::exception_ptr()>;
+    
+    /// A failed result as operations report it: the error_code every
+    /// completion receives, and the exception that future<T>& callbacks see.
+    /// The exception may be left to make_exception, or to a system_error
+    /// built from code, so that completions taking only the code never pay
+    /// for it. Building one never throws.
+    struct failure
+    {
+        system::error_code code;
+        std::exception_ptr exception;
+        exception_factory make_exception;
+        
+        explicit operator bool() const {
+            return bool(code) or bool(exception) or bool(make_exception);
+        }
+        
+        /// exception, built now if it was left for later
+        std::exception_ptr get_exception() const
+        {
+            if (exception) {
+                return exception;
+            }
+            if (make_exception) {
+                return make_exception();
+            }
+            if (code) {
+                return std::make_exception_ptr(system::system_error(code));
+            }
+            return {};
+        }
+    };
+    
+    /// A failure carrying e, with its code if e is a system_error
+    template<class E, std::enable_if_t<std::is_base_of<system::system_error, std::decay_t<E>>::value>* = nullptr>
+    failure make_failure(E&& e)
+    {
+        auto code = e.code();
+        return failure { code, std::make_exception_ptr(std::forward<E>(e)) };
+    }
+    
+    template<class E, std::enable_if_t<not std::is_base_of<system::system_error, std::decay_t<E>>::value>* = nullptr>
+    failure make_failure(E&& e)
+    {
+        return failure { runtime_error_code::unspecified, std::make_exception_ptr(std::forward<E>(e)) };
+    }
+    
+    /// The code pe carries, found by rethrowing it. Used once, when a failure
+    /// is built from an exception that came without a code.
+    inline system::error_code error_code_of(const std::exception_ptr& pe)
+    {
+        if (not pe) {
+            return {};
+        }
+        try {
+            std::rethrow_exception(pe);
+        }
+        catch(const system::system_error& e) {
+            return e.code();
+        }
+        catch(...) {
+            return runtime_error_code::unspecified;
+        }
+    }
+    
     struct not_set_type {};
     constexpr auto not_set() { return not_set_type{}; }
     
@@ -44,8 +114,11 @@ namespace asio_amqp {
             return v;
         }
         
-        T& operator()(const std::exception_ptr& pe) const {
-            std::rethrow_exception(pe);
+        T& operator()(failure& f) const {
+            if (not f.exception) {
+                f.exception = f.get_exception();
+            }
+            std::rethrow_exception(f.exception);
         }
         
         T& operator()(const not_set_type&) const {
@@ -60,12 +133,33 @@ namespace asio_amqp {
         template<class Exception>
         void set_exception(Exception&& e)
         {
-            check_not_set() = std::make_exception_ptr(std::forward<Exception>(e));
+            set_failure(make_failure(std::forward<Exception>(e)));
         }
         
+        /// Store pe. The code it carries is found now, by rethrowing it once.
         void set_exception(std::exception_ptr pe)
         {
-            check_not_set() = std::move(pe);
+            auto ec = error_code_of(pe);
+            set_failure(failure { ec, std::move(pe) });
+        }
+        
+        /// Store pe together with the code it carries
+        void set_exception(std::exception_ptr pe, system::error_code ec)
+        {
+            set_failure(failure { ec, std::move(pe) });
+        }
+        
+        /// Store f. Its exception is built only if get_exception() or get()
+        /// asks for it. A failure without a code is given one now, so that
+        /// get_error_code() never has to build or rethrow the exception.
+        void set_failure(failure f)
+        {
+            if (f and not f.code) {
+                f.code = f.exception
+                ? error_code_of(f.exception)
+                : system::error_code(runtime_error_code::unspecified);
+            }
+            check_not_set() = std::move(f);
         }
         
         bool valid() const {
@@ -73,13 +167,40 @@ namespace asio_amqp {
         }
         
         bool is_exception() const {
-            return boost::get<const std::exception_ptr>(std::addressof(_data));
+            return boost::get<const failure>(std::addressof(_data));
         }
         
         bool is_value() const {
             return boost::get<const T>(std::addressof(_data));
         }
         
+        /// the stored exception, or a null exception_ptr if none is stored
+        std::exception_ptr get_exception() const {
+            if (auto f = boost::get<failure>(std::addressof(_data))) {
+                if (not f->exception) {
+                    f->exception = f->get_exception();
+                }
+                return f->exception;
+            }
+            return {};
+        }
+        
+        /// the code of the stored exception, or a clear code if none is stored
+        system::error_code get_error_code() const {
+            if (auto f = boost::get<const failure>(std::addressof(_data))) {
+                return f->code;
+            }
+            return {};
+        }
+        
+        /// the stored failure as it was set, without building its exception
+        failure get_failure() const {
+            if (auto f = boost::get<const failure>(std::addressof(_data))) {
+                return *f;
+            }
+            return {};
+        }
+        
         
     protected:
         T& get_impl() {
@@ -95,8 +216,9 @@ namespace asio_amqp {
         
         
     private:
-        using data_type = variant<not_set_type, std::exception_ptr, T>;
-        data_type _data;
+        using data_type = variant<not_set_type, failure, T>;
+        // a failure's exception is built on first use, even through const access
+        mutable data_type _data;
         
         data_type& check_not_set()
         {
@@ -104,7 +226,7 @@ namespace asio_amqp {
             {
                 return _data;
             }
-            else if (boost::get<std::exception_ptr>(&_data))
+            else if (boost::get<failure>(&_data))
             {
                 throw std::logic_error("exception already set");
             }
@@ -141,48 +263,81 @@ namespace asio_amqp {
         }
     };
     
+    /// How a completed operation's handler is delivered to its io_service
+    enum class completion_policy
+    {
+        /// run the handler inline if the completing thread is already running
+        /// the io_service, otherwise post it. The handler may then run inside
+        /// the connection's parser with its mutex held, so it must not wait on
+        /// another connection.
+        dispatch,
+        
+        /// always post the handler, even from a thread running the io_service
+        post
+    };
+    
     template<class T>
     struct future_callback_interface
     {
         virtual void trigger() = 0;
         virtual auto promise() -> future<T>& = 0;
+        
+        /// Set while the initiating function runs: a completion then is always
+        /// posted, so that no handler runs inside the call that started it
+        std::atomic<bool> initiating { false };
     };
     
+    /// Delivers the handler to its io_service through the io_service's
+    /// completion_guard: a completion after the io_service has shut down, e.g.
+    /// on a pool thread, is dropped.
     template<class T, class Handler>
     struct future_callback
     : future_callback_interface<T>
     , std::enable_shared_from_this<future_callback<T, Handler>>
     {
-        future_callback(asio::io_service& io_service, Handler handler)
-        : _io_service(io_service)
-        , _handler(handler)
+        future_callback(asio::io_service& io_service, Handler handler,
+                        completion_policy policy = completion_policy::post)
+        : _guard(detail::completion_guard::of(io_service))
+        , _handler(std::move(handler))
+        , _policy(policy)
         {}
         
         void trigger() override
         {
             assert(_future.valid());
-            _io_service.post([this, self = this->shared_from_this()]()
-                             {
-                                 _handler(_future);
-                             });
+            auto f = [this, self = this->shared_from_this()]()
+            {
+                _handler(_future);
+            };
+            if (_policy == completion_policy::post or this->initiating) {
+                _guard->post(std::move(f));
+            }
+            else {
+                _guard->dispatch(std::move(f));
+            }
         }
         
         future<T>& promise() override {
             return _future;
         }
         
-        asio::io_service& _io_service;
+        std::shared_ptr<detail::completion_guard> _guard;
         Handler _handler;
+        completion_policy _policy;
         future<T> _future;
     };
     
     template<class T, class Handler>
-    auto make_future_callback(asio::io_service& io_service, Handler&& handler)
+    auto make_future_callback(asio::io_service& io_service, Handler&& handler,
+                              completion_policy policy = completion_policy::post)
     {
         using handler_type = std::decay_t<Handler>;
         using future_callback_type = future_callback<T, handler_type>;
-        return std::make_shared<future_callback_type>(io_service,
-                                                std::forward<Handler>(handler));
+        auto alloc = asio::get_associated_allocator(handler);
+        return std::allocate_shared<future_callback_type>(alloc,
+                                                          io_service,
+                                                          std::forward<Handler>(handler),
+                                                          policy);
     }
     
     
@@ -194,19 +349,39 @@ namespace asio_amqp {
         failable_handler& operator=(failable_handler&&) noexcept = default;
         virtual ~failable_handler() noexcept = default;
         
+        /// Fail with pe. Its code is found now, by rethrowing it once.
         virtual void operator()(std::exception_ptr pe) const
         {
-            impl_fail(std::move(pe));
+            auto ec = error_code_of(pe);
+            impl_fail(failure { ec, std::move(pe) });
+        }
+        
+        /// Fail with pe, which carries ec
+        void operator()(std::exception_ptr pe, system::error_code ec) const
+        {
+            impl_fail(failure { ec, std::move(pe) });
+        }
+        
+        void operator()(failure f) const
+        {
+            impl_fail(std::move(f));
+        }
+        
+        /// Fail with ec alone. future<T>& callbacks see it as a system_error,
+        /// built only if they ask for it.
+        void operator()(system::error_code ec) const
+        {
+            impl_fail(failure { ec });
         }
 
         template<class E, std::enable_if_t<std::is_base_of<std::exception, std::decay_t<E>>::value>* = nullptr>
         void operator()(E&& e) const
         {
-            impl_fail(std::make_exception_ptr(std::forward<E>(e)));
+            (*this)(make_failure(std::forward<E>(e)));
         }
         
     private:
-        virtual void impl_fail(std::exception_ptr pe) const = 0;
+        virtual void impl_fail(failure f) const = 0;
     };
     
     template<class T>
@@ -220,10 +395,18 @@ namespace asio_amqp {
         future_handler_base() = default;
         
         template<class Handler>
-        future_handler_base(asio::io_service& dispatcher, Handler&& handler)
+        future_handler_base(asio::io_service& dispatcher, Handler&& handler,
+                            completion_policy policy = completion_policy::post)
         : _pcallback(make_future_callback<T>(dispatcher,
-                                             std::forward<Handler>(handler)))
+                                             std::forward<Handler>(handler),
+                                             policy))
         {}
+        
+        /// While set, completions are posted whatever the policy
+        void set_initiating(bool initiating) const {
+            callback().initiating = initiating;
+        }
+        
     protected:
         interface_type& callback() const {
             assert(_pcallback.get());
@@ -231,10 +414,10 @@ namespace asio_amqp {
         }
         
     private:
-        void impl_fail(std::exception_ptr pe) const override
+        void impl_fail(failure f) const override
         {
             auto& cb = callback();
-            cb.promise().set_exception(std::move(pe));
+            cb.promise().set_failure(std::move(f));
             cb.trigger();
         }
         
@@ -274,11 +457,13 @@ namespace asio_amqp {
     };
     
     template<class T, class Handler>
-    auto make_future_handler(asio::io_service& dispatcher, Handler&& handler)
+    auto make_future_handler(asio::io_service& dispatcher, Handler&& handler,
+                             completion_policy policy = completion_policy::post)
     {
         using handler_type = std::decay_t<Handler>;
         return future_handler<T>(dispatcher,
-                                 std::forward<Handler>(handler));
+                                 std::forward<Handler>(handler),
+                                 policy);
     }
     
     
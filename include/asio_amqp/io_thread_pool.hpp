@@ -0,0 +1,67 @@
+#pragma once
+#include <asio_amqp/config.hpp>
+#include <asio_amqp/options.hpp>
+
+#include <boost/asio.hpp>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace asio_amqp {
+
+    /// A fixed set of io_services, each run by exactly one thread. Connections
+    /// are handed out round robin, so every connection is still serviced by a
+    /// single thread and needs no more locking than with a dedicated thread.
+    struct io_thread_pool
+    {
+        /// Start threads threads (at least one). busy_poll applies to each
+        /// thread; thread i is pinned to service_cpus[i % service_cpus.size()].
+        io_thread_pool(std::size_t threads, const service_options& options);
+        ~io_thread_pool();
+
+        io_thread_pool(const io_thread_pool&) = delete;
+        io_thread_pool& operator=(const io_thread_pool&) = delete;
+
+        /// The io_service the next connection should be serviced on
+        asio::io_service& next();
+
+        std::size_t size() const {
+            return _workers.size();
+        }
+
+        /// The first failure to pin a thread to service_cpus, or a clear code.
+        /// Threads are pinned before the constructor returns.
+        const system::error_code& affinity_error() const {
+            return _affinity_error;
+        }
+
+        /// The process wide pool. The first call creates it from
+        /// options.shared_pool_threads and the thread options; later calls
+        /// return the same pool whatever options they pass. It is stopped and
+        /// joined at static destruction.
+        static io_thread_pool& shared(const service_options& options);
+
+    private:
+        struct worker
+        {
+            asio::io_service io_service;
+            std::unique_ptr<asio::io_service::work> work;
+            std::thread thread;
+        };
+
+        std::vector<std::unique_ptr<worker>> _workers;
+        std::atomic<std::size_t> _next { 0 };
+        system::error_code _affinity_error;
+    };
+
+    namespace detail {
+
+        /// Run io_service until it is stopped, spinning for up to busy_poll
+        /// between blocking waits. Uncaught handler exceptions are reported and
+        /// the loop resumes.
+        void run_service_loop(asio::io_service& io_service,
+                              std::chrono::microseconds busy_poll);
+    }
+}
@@ -0,0 +1,129 @@
+#pragma once
+#include <asio_amqp/config.hpp>
+#include <asio_amqp/message.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace asio_amqp {
+
+    struct channel;
+
+    /// Runs message handlers on a pool of worker threads while keeping the
+    /// messages of any one key in delivery order.
+    ///
+    /// Each key has a serial queue. A queue with work is scheduled on one
+    /// worker's run list at a time, so its messages never run concurrently or
+    /// out of order; idle workers steal scheduled queues from busy ones.
+    /// Because messages of different keys complete out of order, settle them
+    /// individually (channel::ack with multiple = false), as wrap_acking does.
+    struct keyed_dispatcher
+    {
+        using key_function = std::function<std::string(const message&)>;
+        using handler_type = std::function<void(message&)>;
+
+        /// Start workers threads (at least one), keying messages with key
+        keyed_dispatcher(std::size_t workers, key_function key);
+
+        /// Stops the workers once their current handlers return. Messages not
+        /// yet handled are passed to the on_discard given with them, and so are
+        /// messages passed to wrapped handlers afterwards.
+        ~keyed_dispatcher();
+
+        keyed_dispatcher(const keyed_dispatcher&) = delete;
+        keyed_dispatcher& operator=(const keyed_dispatcher&) = delete;
+
+        /// Queue msg to be passed to handler after every earlier message with
+        /// the same key. If the dispatcher is destroyed first, msg is passed to
+        /// on_discard instead, if there is one.
+        void submit(message&& msg, std::shared_ptr<const handler_type> handler,
+                    std::shared_ptr<const handler_type> on_discard = nullptr);
+
+        /// A handler for channel::async_consume which hands each delivery to
+        /// this dispatcher. It may outlive the dispatcher; deliveries then go
+        /// straight to on_discard, which should settle them.
+        handler_type wrap(handler_type handler, handler_type on_discard = nullptr);
+
+        /// As wrap, and ack each message once handler returns, or reject it
+        /// for requeueing if handler throws or the message is discarded.
+        /// chan must outlive the consumer.
+        handler_type wrap_acking(channel& chan, handler_type handler);
+
+        std::size_t workers() const {
+            return _workers.size();
+        }
+
+        /// number of times a worker took a queue from another worker's run list
+        std::size_t steals() const {
+            return _steals.load(std::memory_order_relaxed);
+        }
+
+        static key_function by_routing_key();
+        static key_function by_consumer_tag();
+
+        /// Key on the string value of header name; messages without it share
+        /// the empty key.
+        static key_function by_header(std::string name);
+
+    private:
+        struct task
+        {
+            message msg;
+            std::shared_ptr<const handler_type> handler;
+            std::shared_ptr<const handler_type> on_discard;
+        };
+
+        /// Lets wrapped handlers find out whether the dispatcher still exists
+        struct owner
+        {
+            std::mutex mutex;
+            keyed_dispatcher* dispatcher;
+        };
+
+        struct serial_queue
+        {
+            std::string key;
+            std::deque<task> tasks;     // guarded by _keys_mutex
+            bool scheduled = false;     // guarded by _keys_mutex
+        };
+
+        using queue_ptr = std::shared_ptr<serial_queue>;
+
+        struct worker
+        {
+            std::mutex mutex;
+            std::deque<queue_ptr> runnable;
+            std::thread thread;
+        };
+
+        void schedule(queue_ptr q);
+        void requeue(queue_ptr q);
+        queue_ptr take(std::size_t self);
+        void run(const queue_ptr& q);
+        void worker_loop(std::size_t self);
+        static void discard(task& t);
+
+        key_function _key;
+        std::shared_ptr<owner> _owner;
+        std::vector<std::unique_ptr<worker>> _workers;
+
+        std::mutex _keys_mutex;
+        std::unordered_map<std::string, queue_ptr> _queues;
+
+        std::mutex _idle_mutex;
+        std::condition_variable _idle;
+        std::atomic<std::size_t> _ready { 0 };
+        std::atomic<std::size_t> _next { 0 };
+        std::atomic<std::size_t> _steals { 0 };
+        std::atomic<bool> _stopping { false };     // set with _idle_mutex held
+    };
+}
@@ -0,0 +1,147 @@
+#pragma once
+#include <asio_amqp/config.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace asio_amqp {
+
+    /// A snapshot of a memory_accountant
+    struct memory_stats
+    {
+        std::size_t used = 0;       ///< bytes currently charged
+        std::size_t peak = 0;       ///< highest value of used
+        std::size_t limit = 0;      ///< zero means unlimited
+    };
+
+    /// Counts the bytes held on behalf of one owner and, optionally, charges
+    /// them to a parent as well, e.g. a connection's buffers to its service.
+    /// Charging never fails; callers consult over_limit() before taking on more
+    /// and notify_below_limit() to learn when they may.
+    struct memory_accountant
+    {
+        explicit memory_accountant(std::size_t limit = 0,
+                                   std::shared_ptr<memory_accountant> parent = nullptr)
+        : _limit(limit)
+        , _parent(std::move(parent))
+        {}
+
+        memory_accountant(const memory_accountant&) = delete;
+        memory_accountant& operator=(const memory_accountant&) = delete;
+
+        ~memory_accountant()
+        {
+            if (_parent) {
+                _parent->release(_used.load(std::memory_order_relaxed));
+            }
+        }
+
+        void charge(std::size_t bytes)
+        {
+            if (not bytes) { return; }
+            auto used = _used.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+            auto peak = _peak.load(std::memory_order_relaxed);
+            while (used > peak
+                   and not _peak.compare_exchange_weak(peak, used, std::memory_order_relaxed))
+            {}
+            if (_parent) {
+                _parent->charge(bytes);
+            }
+        }
+
+        void release(std::size_t bytes)
+        {
+            if (not bytes) { return; }
+            // ordered against the registration in notify_below_limit
+            _used.fetch_sub(bytes);
+            if (_waiting.load()) {
+                notify_waiters();
+            }
+            if (_parent) {
+                _parent->release(bytes);
+            }
+        }
+        
+        /// If this accountant or a parent is over its limit, arrange for f to be
+        /// called once by the first release that brings that one back under,
+        /// and return true. f is called on the releasing thread and should only
+        /// hand over to its owner, which must check over_limit() again.
+        /// Otherwise return false without calling f.
+        bool notify_below_limit(std::function<void()> f)
+        {
+            if (_limit)
+            {
+                std::lock_guard<std::mutex> lock(_waiters_mutex);
+                _waiting.store(true);
+                if (_used.load() >= _limit) {
+                    _waiters.push_back(std::move(f));
+                    return true;
+                }
+                _waiting.store(not _waiters.empty());
+            }
+            return _parent and _parent->notify_below_limit(std::move(f));
+        }
+
+        /// Move the charge for something whose size changed from before to after
+        void adjust(std::size_t before, std::size_t after)
+        {
+            if (after > before) {
+                charge(after - before);
+            }
+            else {
+                release(before - after);
+            }
+        }
+
+        /// true if this accountant or any parent is at or over its limit
+        bool over_limit() const
+        {
+            if (_limit and _used.load(std::memory_order_relaxed) >= _limit) {
+                return true;
+            }
+            return _parent and _parent->over_limit();
+        }
+
+        std::size_t used() const {
+            return _used.load(std::memory_order_relaxed);
+        }
+
+        memory_stats stats() const
+        {
+            memory_stats result;
+            result.used = _used.load(std::memory_order_relaxed);
+            result.peak = _peak.load(std::memory_order_relaxed);
+            result.limit = _limit;
+            return result;
+        }
+
+    private:
+        void notify_waiters()
+        {
+            std::vector<std::function<void()>> ready;
+            {
+                std::lock_guard<std::mutex> lock(_waiters_mutex);
+                if (_used.load() >= _limit) {
+                    return;
+                }
+                ready.swap(_waiters);
+                _waiting.store(false);
+            }
+            for (auto& f : ready) {
+                f();
+            }
+        }
+        
+        const std::size_t _limit;
+        const std::shared_ptr<memory_accountant> _parent;
+        std::atomic<std::size_t> _used { 0 };
+        std::atomic<std::size_t> _peak { 0 };
+        std::atomic<bool> _waiting { false };       ///< _waiters may be non-empty
+        std::mutex _waiters_mutex;
+        std::vector<std::function<void()>> _waiters;
+    };
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <asio_amqp/config.hpp>
+#include <amqpcpp.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace asio_amqp {
+
+    /// A message delivered to a consumer. Unlike AMQP::Message it owns its body
+    /// and so may outlive the callback on the connection's thread.
+    struct message
+    {
+        message() = default;
+
+        /// Properties only, as carried by a content header
+        explicit message(const AMQP::MetaData& m)
+        : content_type(m.hasContentType() ? m.contentType() : std::string())
+        , content_encoding(m.hasContentEncoding() ? m.contentEncoding() : std::string())
+        , correlation_id(m.hasCorrelationID() ? m.correlationID() : std::string())
+        , reply_to(m.hasReplyTo() ? m.replyTo() : std::string())
+        , message_id(m.hasMessageID() ? m.messageID() : std::string())
+        , headers(m.headers())
+        {}
+
+        message(const AMQP::Message& m, std::uint64_t delivery_tag, bool redelivered)
+        : message(static_cast<const AMQP::MetaData&>(m))
+        {
+            exchange = m.exchange();
+            routing_key = m.routingKey();
+            body.assign(m.body(), m.bodySize());
+            this->delivery_tag = delivery_tag;
+            this->redelivered = redelivered;
+        }
+
+        std::string exchange;
+        std::string routing_key;
+        std::string body;
+        std::string content_type;
+        std::string content_encoding;
+        std::string correlation_id;
+        std::string reply_to;
+        std::string message_id;
+        AMQP::Table headers;
+        std::string consumer_tag;
+        std::uint64_t delivery_tag = 0;
+        bool redelivered = false;
+    };
+
+    /// Callbacks for a consumer that takes each delivery as a header followed
+    /// by body chunks, so the body is never assembled in memory.
+    struct stream_consumer
+    {
+        /// A delivery begins. header holds its properties; the exchange, routing
+        /// key and delivery tag are not known yet.
+        std::function<void(message& header, std::uint64_t body_size)> on_header;
+
+        /// The next piece of the body, one body frame at a time
+        std::function<void(const char* data, std::size_t size)> on_data;
+
+        /// The body is complete
+        std::function<void(std::uint64_t delivery_tag, bool redelivered)> on_complete;
+
+        /// Run the callbacks on the connection's thread, with on_data pointing
+        /// into the receive buffer. This avoids copying each chunk but stalls
+        /// the connection while a callback runs. Otherwise each chunk is copied
+        /// and the callbacks run in order on the channel's io_service.
+        bool on_connection_thread = false;
+
+        /// Bytes of copied chunks not yet passed to on_data. Beyond this the
+        /// connection stops reading from its socket, for all its channels,
+        /// until the channel's io_service catches up. The copies are charged
+        /// to the connection's memory meanwhile.
+        std::size_t max_in_flight = 1024 * 1024;
+    };
+}
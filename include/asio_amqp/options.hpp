@@ -0,0 +1,148 @@
+#pragma once
+#include <asio_amqp/config.hpp>
+#include <asio_amqp/future.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+namespace asio_amqp {
+
+    /// Controls how the sender coalesces outbound frames into writes
+    struct send_options
+    {
+        /// How long queued frames may wait for more frames before a write is
+        /// started. Zero writes as soon as the socket is idle.
+        std::chrono::microseconds linger { 0 };
+
+        /// A write is started without waiting for linger once this many bytes
+        /// are queued.
+        std::size_t max_batch_bytes = 64 * 1024;
+
+        /// A streaming publish stops pulling body frames from its source while
+        /// more than this many frames' worth of bytes wait to be written.
+        std::size_t stream_window_frames = 4;
+
+        /// Queued publish data is written at most this many bytes at a time,
+        /// cut at frame boundaries, so that a heartbeat or acknowledgement
+        /// queued behind it waits for one such write rather than all of it.
+        /// Zero writes everything queued at once.
+        std::size_t max_write_bytes = 256 * 1024;
+    };
+
+    /// Caching of the host name lookups made by async_connect_transport
+    struct resolve_options
+    {
+        /// How long a successful lookup is reused. Zero disables the cache and
+        /// every connect resolves afresh.
+        std::chrono::seconds ttl { 30 };
+
+        /// How long a failed lookup is remembered and reported without asking
+        /// the resolver again
+        std::chrono::seconds negative_ttl { 5 };
+
+        /// For this long after ttl an expired result is still handed out while
+        /// a fresh lookup runs in the background. If that lookup fails the old
+        /// result keeps being used until this runs out.
+        std::chrono::seconds stale_ttl { 60 };
+    };
+
+    /// Tuning applied to each connection's socket before it connects. Zero
+    /// leaves the system default in place. Options the platform does not
+    /// have, or refuses, are skipped without failing the connect.
+    struct socket_options
+    {
+        /// TCP_NODELAY
+        bool no_delay = true;
+
+        /// SO_SNDBUF and SO_RCVBUF in bytes. Setting them disables the
+        /// kernel's autotuning for that direction, and the kernel doubles the
+        /// value and caps it at net.core.wmem_max / rmem_max. On links with a
+        /// large bandwidth-delay product they must cover bandwidth x RTT.
+        int send_buffer = 0;
+        int receive_buffer = 0;
+
+        /// TCP_QUICKACK (Linux). The kernel clears it again by itself, so it
+        /// is renewed after every read.
+        bool quick_ack = false;
+
+        /// TCP_USER_TIMEOUT (Linux): how long written data may stay
+        /// unacknowledged before the connection is dropped.
+        std::chrono::milliseconds user_timeout { 0 };
+
+        /// SO_KEEPALIVE, and with it TCP_KEEPIDLE, TCP_KEEPINTVL and TCP_KEEPCNT
+        bool keepalive = false;
+        std::chrono::seconds keepalive_idle { 0 };
+        std::chrono::seconds keepalive_interval { 0 };
+        int keepalive_count = 0;
+
+        /// TCP_NOTSENT_LOWAT: limits the bytes held unsent in the kernel, so
+        /// queued frames wait in the sender where they can still be batched.
+        std::size_t notsent_lowat = 0;
+
+        /// Bytes asked for by each read from the socket
+        std::size_t read_size = 64 * 1024;
+    };
+
+    /// Options for a connection_service. Apply them with configure_connection_service
+    /// before the first connection is created on the io_service.
+    struct service_options
+    {
+        /// Time the service thread spins polling for ready handlers before it
+        /// blocks in the reactor. Trades a busy core for lower wake-up latency.
+        /// Zero blocks immediately.
+        std::chrono::microseconds busy_poll { 0 };
+
+        /// If non-zero, SO_BUSY_POLL is set to this value on each connected
+        /// socket (Linux only) so the kernel polls the device queue on reads.
+        std::chrono::microseconds socket_busy_poll { 0 };
+
+        /// Applied to every connection's socket
+        socket_options socket;
+
+        /// cpus the service thread is pinned to. Empty leaves it to the scheduler.
+        /// A failure to pin is reported by connection_service::affinity_error().
+        /// When set, each service thread keeps its own receive buffers.
+        std::vector<int> service_cpus;
+
+        /// cpus to pin the thread delivering completions to. This is done by
+        /// posting to the client io_service, so it is only meaningful when a
+        /// single thread runs that io_service.
+        std::vector<int> client_cpus;
+
+        /// How completions reach the client io_service. post always queues a
+        /// handler. dispatch runs it inline when the completing thread is
+        /// already running the client io_service, e.g. with
+        /// run_on_client_io_service; it may then run inside the connection's
+        /// parser with its mutex held. Either way a completion is never run
+        /// inside the initiating function.
+        completion_policy completion = completion_policy::post;
+
+        /// Service sockets on the client io_service instead of a dedicated
+        /// service thread. With a single threaded client io_service this removes
+        /// the thread hop in both directions and lets every completion run inline.
+        /// The client io_service must then be run by exactly one thread.
+        bool run_on_client_io_service = false;
+
+        /// If non-zero, connections are serviced by the process wide
+        /// io_thread_pool instead of a thread per connection_service. The pool
+        /// is sized by the first service to use it, and that service's
+        /// busy_poll and service_cpus configure its threads. Ignored when
+        /// run_on_client_io_service is set.
+        std::size_t shared_pool_threads = 0;
+
+        /// Bytes each connection may hold in receive and send buffers and in
+        /// deliveries not yet acknowledged. Over the limit the connection stops
+        /// reading from its socket and refuses new publishes. Zero is unlimited.
+        std::size_t connection_memory_limit = 0;
+
+        /// The same bound over all connections of the service
+        std::size_t service_memory_limit = 0;
+
+        /// Host name lookups are shared by every connection in the process
+        /// through resolve_cache::shared. The first service with a non-zero ttl
+        /// configures it; configuring a later one with a different non-zero
+        /// setting throws std::invalid_argument.
+        resolve_options resolve;
+    };
+}
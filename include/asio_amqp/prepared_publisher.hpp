@@ -0,0 +1,92 @@
+#pragma once
+#include <asio_amqp/channel.hpp>
+#include <asio_amqp/detail/publish_template.hpp>
+
+#include <string>
+#include <vector>
+
+namespace asio_amqp {
+
+    /// Publishes to one exchange and routing key with fixed properties. The
+    /// basic.publish method frame and the fixed properties are encoded once;
+    /// each publish copies them, patches the body size and the optional per
+    /// message correlation and message ids, and appends the body frames. The
+    /// frames are built on the calling thread and handed to the sender without
+    /// passing through AMQP-CPP.
+    struct prepared_publisher
+    {
+        /// properties supplies content type, content encoding and reply-to;
+        /// its body is ignored and its headers must be empty. chan must be open
+        /// and must outlive the publisher.
+        /// @throws std::logic_error if the channel is not open
+        /// @throws std::length_error if a name or property exceeds 255 octets
+        /// @throws std::invalid_argument if properties has headers
+        prepared_publisher(channel& chan,
+                           const std::string& exchange,
+                           const std::string& routing_key,
+                           const message& properties = message())
+        : _channel(&chan)
+        , _template(open_channel_id(chan), chan.get_impl_ptr()->frame_max(),
+                    exchange, routing_key, properties)
+        {}
+        
+        /// Encode a complete publish of body into out, replacing its contents.
+        /// Empty ids are left out.
+        void encode(const char* data, std::size_t size,
+                    const std::string& correlation_id,
+                    const std::string& message_id,
+                    std::vector<char>& out) const
+        {
+            _template.encode(data, size, correlation_id, message_id, out);
+        }
+        
+        /// Publish body. Completes once the frames have been queued.
+        template<class CompletionToken>
+        auto async_publish(const std::string& body, CompletionToken&& token)
+        {
+            return async_publish(body, std::string(), std::string(),
+                                 std::forward<CompletionToken>(token));
+        }
+        
+        template<class CompletionToken>
+        auto async_publish(const std::string& body,
+                           const std::string& correlation_id,
+                           const std::string& message_id,
+                           CompletionToken&& token)
+        {
+            return async_initiate_future<void>(_channel->get_owner(),
+                                               _channel->get_service().options().completion,
+                                               std::forward<CompletionToken>(token),
+                                               [this, &body, &correlation_id, &message_id](auto&& my_handler)
+            {
+                auto& impl = _channel->get_impl_ptr();
+                if (not impl) {
+                    my_handler(system::error_code(logic_error_code::channel_not_open));
+                    return;
+                }
+                std::vector<char> frames;
+                try {
+                    encode(body.data(), body.size(), correlation_id, message_id, frames);
+                }
+                catch(const std::length_error& e) {
+                    my_handler(e);
+                    return;
+                }
+                impl->async_publish_frames(std::move(frames), std::move(my_handler));
+            });
+        }
+        
+    private:
+        static std::uint16_t open_channel_id(channel& chan)
+        {
+            auto& impl = chan.get_impl_ptr();
+            if (not impl or not impl->id()) {
+                throw std::logic_error("prepared_publisher: channel not open");
+            }
+            return impl->id();
+        }
+        
+        channel* _channel;
+        detail::publish_template _template;
+    };
+}
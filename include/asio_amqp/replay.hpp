@@ -0,0 +1,81 @@
+#pragma once
+#include <asio_amqp/config.hpp>
+#include <asio_amqp/capture.hpp>
+#include <asio_amqp/detail/receiver.hpp>
+#include <amqpcpp.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace asio_amqp {
+
+    /// Feeds the inbound half of a capture back through the library's receive
+    /// path without a network or broker: each record is written to a local
+    /// socket, read by the same receiver a connection uses and parsed in
+    /// batches of whole frames. Create the same channels and consumers on
+    /// connection() as the captured session did, in the same order, so that
+    /// channel ids line up, then call run().
+    struct replay_driver
+    : ::AMQP::ConnectionHandler
+    {
+        enum class pacing {
+            full_speed,     ///< parse records back to back
+            original        ///< honour the captured inter-record timing
+        };
+
+        struct statistics
+        {
+            std::size_t records = 0;
+            std::size_t bytes = 0;
+            std::chrono::nanoseconds elapsed { 0 };
+        };
+
+        replay_driver(const std::string& path,
+                      const AMQP::Login& login = AMQP::Login("guest", "guest"),
+                      const std::string& vhost = "/");
+
+        AMQP::Connection& connection() {
+            return *_connection;
+        }
+
+        statistics run(pacing p = pacing::full_speed);
+
+        /// Record the bytes the receive path reads during run(), e.g. to
+        /// compare them with the capture being replayed
+        void set_capture(std::shared_ptr<capture_sink> capture) {
+            _receiver.set_capture(std::move(capture));
+        }
+
+    private:
+        /// replies to the broker are discarded
+        void onData(AMQP::Connection* connection, const char* buffer, size_t size) override {}
+
+        void onError(AMQP::Connection* connection, const char* message) override;
+
+        /// write data to the receive path and run until all of it is parsed
+        /// or held as an incomplete frame
+        void feed(const std::vector<char>& data);
+
+        void read();
+
+        using socket_type = asio::local::stream_protocol::socket;
+
+        capture_reader _reader;
+        std::unique_ptr<AMQP::Connection> _connection;
+        asio::io_service _io_service;
+        socket_type _input { _io_service };
+        socket_type _output { _io_service };
+        detail::receiver _receiver;
+        std::size_t _written = 0;           ///< bytes written to _input
+        std::size_t _received = 0;          ///< bytes read from _output
+        std::size_t _parsed = 0;
+        std::string _error;
+    };
+
+    struct replay_error : std::runtime_error
+    {
+        using std::runtime_error::runtime_error;
+    };
+}
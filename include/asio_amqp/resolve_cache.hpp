@@ -0,0 +1,87 @@
+#pragma once
+#include <asio_amqp/config.hpp>
+#include <asio_amqp/options.hpp>
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace asio_amqp {
+
+    /// A process wide cache of host name lookups for async_resolve_and_connect.
+    ///
+    /// Results are reused for resolve_options::ttl and failures for
+    /// negative_ttl. Concurrent requests for a name that is being looked up
+    /// wait for that lookup instead of starting their own, so many connections
+    /// reconnecting at once cost one resolver call per name. An expired result
+    /// is still handed out for up to stale_ttl while a single background lookup
+    /// refreshes it.
+    struct resolve_cache
+    {
+        using protocol_type = asio::ip::tcp;
+        using query_type = protocol_type::resolver::query;
+        using endpoint_type = protocol_type::endpoint;
+        using results_type = std::vector<endpoint_type>;
+        using clock_type = std::chrono::steady_clock;
+        using handler_type = std::function<void(const system::error_code&, const results_type&)>;
+
+        /// Performs a lookup, calling its handler on io_service. The default
+        /// uses asio's resolver.
+        using lookup_function = std::function<void(asio::io_service& io_service,
+                                                   const query_type& query,
+                                                   handler_type handler)>;
+
+        /// The time against which entries expire. The default is clock_type::now.
+        using now_function = std::function<clock_type::time_point()>;
+
+        /// Counters since construction
+        struct stats_type
+        {
+            std::size_t hits = 0;       ///< answered from a fresh entry, including failures
+            std::size_t stale = 0;      ///< answered from an expired entry being refreshed
+            std::size_t waits = 0;      ///< joined a lookup already in progress
+            std::size_t lookups = 0;    ///< resolver calls made
+        };
+
+        explicit resolve_cache(const resolve_options& options,
+                               lookup_function lookup = lookup_function(),
+                               now_function now = now_function());
+
+        /// Stops and joins the lookup thread. Lookups still running are
+        /// abandoned and their waiters never called.
+        ~resolve_cache();
+
+        resolve_cache(const resolve_cache&) = delete;
+        resolve_cache& operator=(const resolve_cache&) = delete;
+
+        /// Resolve query. handler is always posted to io_service, never called
+        /// from within this function. Lookups run on a thread of the cache's
+        /// own, started by the first one, so a lookup completes for every
+        /// waiter even if the io_service that asked first is stopped.
+        void async_resolve(asio::io_service& io_service,
+                           const query_type& query,
+                           handler_type handler);
+
+        /// Forget every entry. Lookups in progress still complete their waiters.
+        void clear();
+
+        std::size_t size() const;
+
+        stats_type stats() const;
+
+        const resolve_options& options() const;
+
+        /// The cache used by connections. The first call creates it from
+        /// options.
+        /// @throws std::invalid_argument if a later call passes different options
+        static resolve_cache& shared(const resolve_options& options);
+
+    private:
+        struct state;
+        std::shared_ptr<state> _state;
+    };
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <asio_amqp/channel.hpp>
+
+#include <chrono>
+#include <memory>
+
+namespace asio_amqp {
+
+    /// Request/response over RabbitMQ's direct reply-to. Requests are published
+    /// with reply_to set to amq.rabbitmq.reply-to and a correlation id chosen by
+    /// the client; replies arrive on the same channel without a reply queue.
+    ///
+    /// Replies are matched to calls on the connection's thread, through an open
+    /// addressing table, and handed to the call's completion handler according
+    /// to the service's completion_policy. Under the default, post, every
+    /// reply costs a post to the channel's io_service; it runs inline only with
+    /// completion_policy::dispatch and a connection serviced on that same
+    /// io_service (service_options::run_on_client_io_service).
+    struct rpc_client
+    {
+        using clock_type = std::chrono::steady_clock;
+
+        /// chan must be open and must outlive the client. Direct reply-to
+        /// delivers replies on the publishing channel, so give the client a
+        /// channel of its own.
+        explicit rpc_client(channel& chan);
+
+        /// Fails calls still waiting with runtime_error_code::cancelled. Late
+        /// replies are discarded.
+        ~rpc_client();
+
+        rpc_client(const rpc_client&) = delete;
+        rpc_client& operator=(const rpc_client&) = delete;
+
+        /// Start consuming replies. Calls may be made as soon as this returns;
+        /// they are sent after the consume.
+        template<class CompletionToken>
+        auto async_start(CompletionToken&& token)
+        {
+            return async_initiate_future<void>(_channel->get_owner(),
+                                               _channel->get_service().options().completion,
+                                               std::forward<CompletionToken>(token),
+                                               [this](auto&& my_handler)
+            {
+                start(std::move(my_handler));
+            });
+        }
+
+        /// Publish request to its exchange and routing key and complete with
+        /// the reply. The client sets reply_to and correlation_id. Fails with
+        /// runtime_error_code::timed_out if no reply arrives within timeout;
+        /// zero waits indefinitely.
+        template<class CompletionToken>
+        auto async_call(message request, clock_type::duration timeout, CompletionToken&& token)
+        {
+            return async_initiate_future<message>(_channel->get_owner(),
+                                                  _channel->get_service().options().completion,
+                                                  std::forward<CompletionToken>(token),
+                                                  [this, &request, timeout](auto&& my_handler)
+            {
+                call(std::move(request), timeout, std::move(my_handler));
+            });
+        }
+
+        /// calls awaiting a reply
+        std::size_t outstanding() const;
+
+        /// the reply queue pseudo-name
+        static const char* const reply_queue;
+
+    private:
+        struct state;
+
+        void start(future_handler<void> handler);
+        void call(message&& request, clock_type::duration timeout, future_handler<message> handler);
+
+        channel* _channel;
+        std::shared_ptr<state> _state;
+    };
+}
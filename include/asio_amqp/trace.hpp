@@ -0,0 +1,115 @@
+#pragma once
+#include <asio_amqp/detail/trace_ring.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+/// Compile time trace threshold. Trace points below this level expand to nothing,
+/// including their arguments.
+///   0 trace, 1 debug, 2 info, 3 warning, 4 error, 5 off
+#ifndef ASIO_AMQP_TRACE_LEVEL
+#define ASIO_AMQP_TRACE_LEVEL 2
+#endif
+
+namespace asio_amqp {
+
+    enum class trace_level : std::uint8_t
+    {
+        trace = 0,
+        debug = 1,
+        info = 2,
+        warning = 3,
+        error = 4
+    };
+
+    enum class trace_event : std::uint16_t
+    {
+        receive,            ///< bytes read, bytes buffered
+        consume,            ///< bytes consumed by the parser, read position
+        send_queued,        ///< bytes queued, buffers waiting
+        send_complete,      ///< bytes written
+        send_failure        ///< error value
+    };
+
+    const char* to_string(trace_level level);
+    const char* to_string(trace_event event);
+
+    using trace_record = detail::trace_record;
+    using trace_ring = detail::trace_ring;
+
+    std::ostream& operator<<(std::ostream& os, const trace_record& rec);
+
+    /// The ring that kept trace points are written to. Until a ring is installed
+    /// trace points that survive compilation cost one relaxed load.
+    inline std::atomic<trace_ring*>& trace_sink()
+    {
+        static std::atomic<trace_ring*> sink { nullptr };
+        return sink;
+    }
+
+    /// Install ring as the trace sink, or remove it with nullptr. The caller
+    /// retains ownership and must keep the ring alive while it is installed.
+    inline void set_trace_sink(trace_ring* ring)
+    {
+        trace_sink().store(ring, std::memory_order_release);
+    }
+
+    namespace detail {
+
+        template<class...Args>
+        void trace_emit(trace_level level, trace_event event, Args...args) noexcept
+        {
+            static_assert(sizeof...(Args) <= trace_record::max_args, "too many trace arguments");
+            auto ring = trace_sink().load(std::memory_order_acquire);
+            if (not ring) {
+                return;
+            }
+            trace_record rec {};
+            rec.timestamp = std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>
+                                          (std::chrono::steady_clock::now().time_since_epoch()).count());
+            rec.event = std::uint16_t(event);
+            rec.level = std::uint8_t(level);
+            rec.nargs = std::uint8_t(sizeof...(Args));
+            std::uint64_t values[] = { std::uint64_t(args)..., 0 };
+            for (std::size_t i = 0 ; i < sizeof...(Args) ; ++i) {
+                rec.args[i] = values[i];
+            }
+            ring->push(rec);
+        }
+    }
+}
+
+#define ASIO_AMQP_TRACE_EMIT(level, ...) \
+    ::asio_amqp::detail::trace_emit(::asio_amqp::trace_level::level, __VA_ARGS__)
+
+#if ASIO_AMQP_TRACE_LEVEL <= 0
+#define ASIO_AMQP_TRACE(...) ASIO_AMQP_TRACE_EMIT(trace, __VA_ARGS__)
+#else
+#define ASIO_AMQP_TRACE(...) ((void)0)
+#endif
+
+#if ASIO_AMQP_TRACE_LEVEL <= 1
+#define ASIO_AMQP_DEBUG(...) ASIO_AMQP_TRACE_EMIT(debug, __VA_ARGS__)
+#else
+#define ASIO_AMQP_DEBUG(...) ((void)0)
+#endif
+
+#if ASIO_AMQP_TRACE_LEVEL <= 2
+#define ASIO_AMQP_INFO(...) ASIO_AMQP_TRACE_EMIT(info, __VA_ARGS__)
+#else
+#define ASIO_AMQP_INFO(...) ((void)0)
+#endif
+
+#if ASIO_AMQP_TRACE_LEVEL <= 3
+#define ASIO_AMQP_WARNING(...) ASIO_AMQP_TRACE_EMIT(warning, __VA_ARGS__)
+#else
+#define ASIO_AMQP_WARNING(...) ((void)0)
+#endif
+
+#if ASIO_AMQP_TRACE_LEVEL <= 4
+#define ASIO_AMQP_ERROR(...) ASIO_AMQP_TRACE_EMIT(error, __VA_ARGS__)
+#else
+#define ASIO_AMQP_ERROR(...) ((void)0)
+#endif
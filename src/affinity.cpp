@@ -0,0 +1,31 @@
+#include <asio_amqp/affinity.hpp>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace asio_amqp {
+
+    system::error_code pin_current_thread(const std::vector<int>& cpus,
+                                          system::error_code& ec)
+    {
+        if (cpus.empty()) {
+            return assign_error(ec, system::error_code());
+        }
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (auto cpu : cpus) {
+            if (cpu < 0 or cpu >= CPU_SETSIZE) {
+                return assign_error(ec, system::errc::make_error_code(system::errc::invalid_argument));
+            }
+            CPU_SET(cpu, &set);
+        }
+        auto rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        return assign_error(ec, system::error_code(rc, system::system_category()));
+#else
+        return assign_error(ec, asio::error::operation_not_supported);
+#endif
+    }
+}
@@ -0,0 +1,94 @@
+#include <asio_amqp/capture.hpp>
+
+#include <cstring>
+
+namespace asio_amqp {
+
+    namespace {
+
+        constexpr char capture_magic[8] = { 'A', 'A', 'M', 'Q', 'C', 'A', 'P', '1' };
+
+        template<class Int>
+        void put_le(std::ostream& os, Int value)
+        {
+            char bytes[sizeof(Int)];
+            for (std::size_t i = 0 ; i < sizeof(Int) ; ++i) {
+                bytes[i] = char((std::uint64_t(value) >> (8 * i)) & 0xff);
+            }
+            os.write(bytes, sizeof(bytes));
+        }
+
+        template<class Int>
+        bool get_le(std::istream& is, Int& value)
+        {
+            unsigned char bytes[sizeof(Int)];
+            if (not is.read(reinterpret_cast<char*>(bytes), sizeof(bytes))) {
+                return false;
+            }
+            std::uint64_t result = 0;
+            for (std::size_t i = 0 ; i < sizeof(Int) ; ++i) {
+                result |= std::uint64_t(bytes[i]) << (8 * i);
+            }
+            value = Int(result);
+            return true;
+        }
+    }
+
+    file_capture::file_capture(const std::string& path)
+    : _stream(path, std::ios::binary | std::ios::trunc)
+    , _epoch(clock_type::now())
+    {
+        if (not _stream) {
+            throw std::runtime_error("unable to open capture file " + path);
+        }
+        _stream.write(capture_magic, sizeof(capture_magic));
+    }
+
+    void file_capture::record(direction dir, const char* data, std::size_t size)
+    {
+        // stamped under the lock so that timestamps rise in file order
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - _epoch);
+        put_le(_stream, std::uint64_t(elapsed.count()));
+        put_le(_stream, std::uint8_t(dir));
+        put_le(_stream, std::uint32_t(size));
+        _stream.write(data, size);
+    }
+
+    void file_capture::flush()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stream.flush();
+    }
+
+    capture_reader::capture_reader(const std::string& path)
+    : _stream(path, std::ios::binary)
+    {
+        char magic[sizeof(capture_magic)];
+        if (not _stream.read(magic, sizeof(magic))
+            or std::memcmp(magic, capture_magic, sizeof(magic)))
+        {
+            throw capture_format_error("not a capture file: " + path);
+        }
+    }
+
+    bool capture_reader::next(capture_record& record)
+    {
+        std::uint64_t timestamp;
+        std::uint8_t dir;
+        std::uint32_t length;
+        if (not get_le(_stream, timestamp)) {
+            return false;
+        }
+        if (not get_le(_stream, dir) or not get_le(_stream, length)) {
+            throw capture_format_error("truncated capture record");
+        }
+        record.timestamp = std::chrono::nanoseconds(timestamp);
+        record.dir = static_cast<capture_sink::direction>(dir);
+        record.data.resize(length);
+        if (length and not _stream.read(record.data.data(), length)) {
+            throw capture_format_error("truncated capture record");
+        }
+        return true;
+    }
+}
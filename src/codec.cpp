@@ -0,0 +1,281 @@
+#include <asio_amqp/codec.hpp>
+
+#if defined(ASIO_AMQP_HAS_ZLIB)
+#include <zlib.h>
+#endif
+#if defined(ASIO_AMQP_HAS_LZ4)
+#include <lz4frame.h>
+#endif
+#if defined(ASIO_AMQP_HAS_ZSTD)
+#include <zstd.h>
+#endif
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+
+namespace asio_amqp {
+
+    namespace {
+
+        // decoders grow the output in steps of at least this much
+        constexpr std::size_t decode_chunk = 16 * 1024;
+
+        /// Make room at the end of out for the next step of a decoder of an
+        /// input of size bytes, never beyond one byte more than max_size.
+        /// Returns the offset of the room, which is at least one byte.
+        std::size_t grow(std::string& out, std::size_t size, std::size_t max_size)
+        {
+            auto used = out.size();
+            auto room = std::max(decode_chunk, size * 2);
+            if (room > max_size - used) {
+                room = max_size - used + 1;
+            }
+            out.resize(used + room);
+            return used;
+        }
+
+        /// @throws codec_error if a decoder has produced more than max_size
+        void check_size(const char* codec, const std::string& out, std::size_t max_size)
+        {
+            if (out.size() > max_size) {
+                throw codec_error(std::string(codec) + ": decoded body too large");
+            }
+        }
+
+#if defined(ASIO_AMQP_HAS_ZLIB)
+        /// zlib counts in uInt, so bodies are fed to it in pieces of at most this
+        constexpr std::size_t zlib_chunk = std::numeric_limits<uInt>::max();
+
+        /// Give zs the next piece of the remaining input
+        void feed(z_stream& zs, const char*& data, std::size_t& size)
+        {
+            if (zs.avail_in == 0 and size) {
+                auto piece = std::min(size, zlib_chunk);
+                zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+                zs.avail_in = uInt(piece);
+                data += piece;
+                size -= piece;
+            }
+        }
+
+        struct deflate_codec : body_codec
+        {
+            const char* name() const override { return "deflate"; }
+
+            void encode(const char* data, std::size_t size, std::string& out) const override
+            {
+                z_stream zs {};
+                if (::deflateInit(&zs, Z_DEFAULT_COMPRESSION) != Z_OK) {
+                    throw codec_error("deflate: deflateInit failed");
+                }
+                std::unique_ptr<z_stream, int(*)(z_stream*)> guard(&zs, &::deflateEnd);
+
+                out.clear();
+                int rc = Z_OK;
+                while (rc != Z_STREAM_END)
+                {
+                    feed(zs, data, size);
+                    auto used = out.size();
+                    out.resize(used + std::min(std::max(decode_chunk, std::size_t(zs.avail_in) / 2 + 64),
+                                               zlib_chunk));
+                    zs.next_out = reinterpret_cast<Bytef*>(&out[used]);
+                    zs.avail_out = uInt(out.size() - used);
+                    rc = ::deflate(&zs, size ? Z_NO_FLUSH : Z_FINISH);
+                    out.resize(out.size() - zs.avail_out);
+                    if (rc != Z_OK and rc != Z_STREAM_END and rc != Z_BUF_ERROR) {
+                        throw codec_error("deflate: compression failed");
+                    }
+                }
+            }
+
+            void decode(const char* data, std::size_t size, std::string& out,
+                        std::size_t max_size) const override
+            {
+                z_stream zs {};
+                if (::inflateInit(&zs) != Z_OK) {
+                    throw codec_error("deflate: inflateInit failed");
+                }
+                std::unique_ptr<z_stream, int(*)(z_stream*)> guard(&zs, &::inflateEnd);
+
+                out.clear();
+                auto step = size;
+                int rc = Z_OK;
+                while (rc != Z_STREAM_END)
+                {
+                    feed(zs, data, size);
+                    auto used = grow(out, step, max_size);
+                    auto room = std::min(out.size() - used, zlib_chunk);
+                    out.resize(used + room);
+                    zs.next_out = reinterpret_cast<Bytef*>(&out[used]);
+                    zs.avail_out = uInt(room);
+                    rc = ::inflate(&zs, Z_NO_FLUSH);
+                    out.resize(out.size() - zs.avail_out);
+                    if (rc != Z_OK and rc != Z_STREAM_END) {
+                        throw codec_error("deflate: corrupt body");
+                    }
+                    check_size("deflate", out, max_size);
+                    if (rc == Z_OK and zs.avail_in == 0 and not size and zs.avail_out != 0) {
+                        throw codec_error("deflate: truncated body");
+                    }
+                }
+            }
+        };
+#endif
+
+#if defined(ASIO_AMQP_HAS_LZ4)
+        struct lz4_codec : body_codec
+        {
+            const char* name() const override { return "lz4"; }
+
+            void encode(const char* data, std::size_t size, std::string& out) const override
+            {
+                LZ4F_preferences_t prefs {};
+                prefs.frameInfo.contentSize = size;
+                out.resize(::LZ4F_compressFrameBound(size, &prefs));
+                auto length = ::LZ4F_compressFrame(&out[0], out.size(), data, size, &prefs);
+                if (::LZ4F_isError(length)) {
+                    throw codec_error("lz4: compression failed");
+                }
+                out.resize(length);
+            }
+
+            void decode(const char* data, std::size_t size, std::string& out,
+                        std::size_t max_size) const override
+            {
+                LZ4F_dctx* dctx = nullptr;
+                if (::LZ4F_isError(::LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION))) {
+                    throw codec_error("lz4: unable to create context");
+                }
+                std::unique_ptr<LZ4F_dctx, LZ4F_errorCode_t(*)(LZ4F_dctx*)> guard(dctx, &::LZ4F_freeDecompressionContext);
+
+                out.clear();
+                std::size_t hint = 1;
+                while (hint)
+                {
+                    auto used = grow(out, size, max_size);
+                    auto produced = out.size() - used;
+                    auto consumed = size;
+                    hint = ::LZ4F_decompress(dctx, &out[used], &produced, data, &consumed, nullptr);
+                    if (::LZ4F_isError(hint)) {
+                        throw codec_error("lz4: corrupt body");
+                    }
+                    out.resize(used + produced);
+                    check_size("lz4", out, max_size);
+                    data += consumed;
+                    size -= consumed;
+                    if (not consumed and not produced) {
+                        break;
+                    }
+                }
+                if (hint) {
+                    throw codec_error("lz4: truncated body");
+                }
+            }
+        };
+#endif
+
+#if defined(ASIO_AMQP_HAS_ZSTD)
+        struct zstd_codec : body_codec
+        {
+            const char* name() const override { return "zstd"; }
+
+            void encode(const char* data, std::size_t size, std::string& out) const override
+            {
+                out.resize(::ZSTD_compressBound(size));
+                auto length = ::ZSTD_compress(&out[0], out.size(), data, size, 3);
+                if (::ZSTD_isError(length)) {
+                    throw codec_error("zstd: compression failed");
+                }
+                out.resize(length);
+            }
+
+            void decode(const char* data, std::size_t size, std::string& out,
+                        std::size_t max_size) const override
+            {
+                std::unique_ptr<ZSTD_DStream, std::size_t(*)(ZSTD_DStream*)> ds(::ZSTD_createDStream(), &::ZSTD_freeDStream);
+                if (not ds) {
+                    throw codec_error("zstd: unable to create context");
+                }
+                ::ZSTD_initDStream(ds.get());
+
+                out.clear();
+                ZSTD_inBuffer in { data, size, 0 };
+                std::size_t hint = 1;
+                while (hint)
+                {
+                    auto used = grow(out, size, max_size);
+                    ZSTD_outBuffer o { &out[used], out.size() - used, 0 };
+                    hint = ::ZSTD_decompressStream(ds.get(), &o, &in);
+                    if (::ZSTD_isError(hint)) {
+                        throw codec_error("zstd: corrupt body");
+                    }
+                    out.resize(used + o.pos);
+                    check_size("zstd", out, max_size);
+                    if (hint and in.pos == in.size and o.pos < o.size) {
+                        throw codec_error("zstd: truncated body");
+                    }
+                }
+            }
+        };
+#endif
+    }
+
+    const body_codec* find_codec(const std::string& name)
+    {
+#if defined(ASIO_AMQP_HAS_ZLIB)
+        static deflate_codec deflate;
+        if (name == deflate.name()) return &deflate;
+#endif
+#if defined(ASIO_AMQP_HAS_LZ4)
+        static lz4_codec lz4;
+        if (name == lz4.name()) return &lz4;
+#endif
+#if defined(ASIO_AMQP_HAS_ZSTD)
+        static zstd_codec zstd;
+        if (name == zstd.name()) return &zstd;
+#endif
+        return nullptr;
+    }
+
+    bool encode_body(message& msg, const codec_options& options)
+    {
+        if (not options.codec
+            or msg.body.size() < options.threshold
+            or not msg.content_encoding.empty())
+        {
+            return false;
+        }
+        std::string encoded;
+        options.codec->encode(msg.body.data(), msg.body.size(), encoded);
+        if (encoded.size() >= msg.body.size()) {
+            return false;
+        }
+        msg.body = std::move(encoded);
+        msg.content_encoding = options.codec->name();
+        return true;
+    }
+
+    bool decode_body(message& msg, const codec_options& options)
+    {
+        if (not options.decode_on_consume or msg.content_encoding.empty()) {
+            return false;
+        }
+        auto codec = (options.codec and msg.content_encoding == options.codec->name())
+        ? options.codec
+        : find_codec(msg.content_encoding);
+        if (not codec) {
+            return false;
+        }
+        std::string decoded;
+        try {
+            codec->decode(msg.body.data(), msg.body.size(), decoded, options.max_decoded_size);
+        }
+        catch(const codec_error&) {
+            return false;
+        }
+        msg.body = std::move(decoded);
+        msg.content_encoding.clear();
+        return true;
+    }
+}
@@ -1,23 +1,15 @@
 #include <asio_amqp/connection_service.hpp>
-#include <valuelib/debug/unwrap.hpp>
-#include <iostream>
 
 namespace asio_amqp {
 
 
-    void connection_service::run()
+    void connection_service::run(std::promise<system::error_code> pinned)
     {
-        while (!_service_dispatcher.stopped())
-        {
-            try {
-                _service_dispatcher.run();
-            }
-            catch(...)
-            {
-                std::cerr << "fatal error: uncaught exception in asio_amqp::connection_service loop\n";
-                std::cerr << value::debug::unwrap(std::current_exception());
-            }
-        }
+        system::error_code ec;
+        pin_current_thread(_options.service_cpus, ec);
+        pinned.set_value(ec);
+        
+        detail::run_service_loop(_service_dispatcher, _options.busy_poll);
     }
 
 }
\ No newline at end of file
@@ -15,6 +15,8 @@ namespace asio_amqp
                 {
                     case logic_error_code::wrong_state_for_connect: return "wrong state for connect";
                     case logic_error_code::zombie: return "operation on zombie object";
+                    case logic_error_code::channel_not_open: return "channel not open";
+                    case logic_error_code::invalid_uri: return "invalid amqp uri";
                 }
                 return "utter balls up";
             }
@@ -37,10 +39,15 @@ namespace asio_amqp
         }
         
         std::string message( int ev ) const override {
-            switch (static_cast<logic_error_code>(ev))
+            switch (static_cast<runtime_error_code>(ev))
             {
-                case logic_error_code::wrong_state_for_connect: return "wrong state for connect request";
-                case logic_error_code::zombie: return "operation on zombie object";
+                case runtime_error_code::authentication: return "authentication failed";
+                case runtime_error_code::memory_limit: return "memory limit exceeded";
+                case runtime_error_code::timed_out: return "timed out";
+                case runtime_error_code::cancelled: return "cancelled";
+                case runtime_error_code::connection_failed: return "connection failed";
+                case runtime_error_code::channel_failed: return "channel failed";
+                case runtime_error_code::unspecified: return "unspecified failure";
             }
             return "utter balls up";
         }
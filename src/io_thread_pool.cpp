@@ -0,0 +1,113 @@
+#include <asio_amqp/io_thread_pool.hpp>
+#include <asio_amqp/affinity.hpp>
+#include <valuelib/debug/unwrap.hpp>
+#include <algorithm>
+#include <future>
+#include <iostream>
+
+namespace asio_amqp {
+
+    namespace detail {
+
+        namespace {
+            void run_busy_poll(asio::io_service& io_service,
+                               std::chrono::microseconds busy_poll)
+            {
+                using clock_type = std::chrono::steady_clock;
+
+                while (!io_service.stopped())
+                {
+                    // poll() runs the reactor without blocking, so an arriving frame is
+                    // picked up on the next spin rather than after a wake-up
+                    auto deadline = clock_type::now() + busy_poll;
+                    std::size_t handled = 0;
+                    do {
+                        handled = io_service.poll();
+                    } while (not handled
+                             and not io_service.stopped()
+                             and clock_type::now() < deadline);
+
+                    if (not handled) {
+                        io_service.run_one();
+                    }
+                }
+            }
+        }
+
+        void run_service_loop(asio::io_service& io_service,
+                              std::chrono::microseconds busy_poll)
+        {
+            while (!io_service.stopped())
+            {
+                try {
+                    if (busy_poll.count()) {
+                        run_busy_poll(io_service, busy_poll);
+                    }
+                    else {
+                        io_service.run();
+                    }
+                }
+                catch(...)
+                {
+                    std::cerr << "fatal error: uncaught exception in asio_amqp service loop\n";
+                    std::cerr << value::debug::unwrap(std::current_exception());
+                }
+            }
+        }
+    }
+
+    io_thread_pool::io_thread_pool(std::size_t threads, const service_options& options)
+    {
+        threads = std::max<std::size_t>(threads, 1);
+        _workers.reserve(threads);
+        for (std::size_t i = 0 ; i < threads ; ++i)
+        {
+            auto w = std::make_unique<worker>();
+            w->work = std::make_unique<asio::io_service::work>(w->io_service);
+            std::vector<int> cpus;
+            if (not options.service_cpus.empty()) {
+                cpus.push_back(options.service_cpus[i % options.service_cpus.size()]);
+            }
+            std::promise<system::error_code> pinned;
+            auto result = pinned.get_future();
+            w->thread = std::thread([io = &w->io_service, cpus, busy_poll = options.busy_poll,
+                                     pinned = std::move(pinned)] () mutable
+                                    {
+                                        system::error_code ec;
+                                        pin_current_thread(cpus, ec);
+                                        pinned.set_value(ec);
+                                        detail::run_service_loop(*io, busy_poll);
+                                    });
+            _workers.push_back(std::move(w));
+            auto ec = result.get();
+            if (ec and not _affinity_error) {
+                _affinity_error = ec;
+            }
+        }
+    }
+
+    io_thread_pool::~io_thread_pool()
+    {
+        for (auto& w : _workers) {
+            w->work.reset();
+            w->io_service.stop();
+        }
+        for (auto& w : _workers) {
+            if (w->thread.joinable()) {
+                w->thread.join();
+            }
+        }
+    }
+
+    asio::io_service& io_thread_pool::next()
+    {
+        auto i = _next.fetch_add(1, std::memory_order_relaxed);
+        return _workers[i % _workers.size()]->io_service;
+    }
+
+    io_thread_pool& io_thread_pool::shared(const service_options& options)
+    {
+        static io_thread_pool pool(options.shared_pool_threads, options);
+        return pool;
+    }
+}
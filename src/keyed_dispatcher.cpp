@@ -0,0 +1,272 @@
+#include <asio_amqp/keyed_dispatcher.hpp>
+#include <asio_amqp/channel.hpp>
+#include <valuelib/debug/unwrap.hpp>
+#include <algorithm>
+#include <iostream>
+
+namespace asio_amqp {
+
+    namespace {
+        // the dispatcher and worker index of the calling thread, if it is a worker
+        thread_local const keyed_dispatcher* current_dispatcher = nullptr;
+        thread_local std::size_t current_worker = 0;
+
+        // tasks a worker runs from one queue before letting other queues in
+        constexpr std::size_t batch_size = 16;
+    }
+
+    keyed_dispatcher::keyed_dispatcher(std::size_t workers, key_function key)
+    : _key(std::move(key))
+    , _owner(std::make_shared<owner>())
+    {
+        _owner->dispatcher = this;
+        workers = std::max<std::size_t>(workers, 1);
+        _workers.reserve(workers);
+        for (std::size_t i = 0 ; i < workers ; ++i) {
+            _workers.push_back(std::make_unique<worker>());
+        }
+        for (std::size_t i = 0 ; i < workers ; ++i) {
+            _workers[i]->thread = std::thread(&keyed_dispatcher::worker_loop, this, i);
+        }
+    }
+
+    keyed_dispatcher::~keyed_dispatcher()
+    {
+        {
+            // wrapped handlers stop submitting
+            std::lock_guard<std::mutex> lock(_owner->mutex);
+            _owner->dispatcher = nullptr;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_idle_mutex);
+            _stopping = true;
+        }
+        _idle.notify_all();
+        for (auto& w : _workers) {
+            if (w->thread.joinable()) {
+                w->thread.join();
+            }
+        }
+        for (auto& entry : _queues) {
+            for (auto& t : entry.second->tasks) {
+                discard(t);
+            }
+        }
+    }
+
+    void keyed_dispatcher::discard(task& t)
+    {
+        if (not t.on_discard) {
+            return;
+        }
+        try {
+            (*t.on_discard)(t.msg);
+        }
+        catch(...) {
+            std::cerr << "asio_amqp::keyed_dispatcher: uncaught exception in discard handler\n";
+            std::cerr << value::debug::unwrap(std::current_exception());
+        }
+    }
+
+    void keyed_dispatcher::submit(message&& msg, std::shared_ptr<const handler_type> handler,
+                                  std::shared_ptr<const handler_type> on_discard)
+    {
+        auto key = _key(msg);
+        queue_ptr to_schedule;
+        {
+            std::lock_guard<std::mutex> lock(_keys_mutex);
+            auto& q = _queues[key];
+            if (not q) {
+                q = std::make_shared<serial_queue>();
+                q->key = std::move(key);
+            }
+            q->tasks.push_back(task { std::move(msg), std::move(handler), std::move(on_discard) });
+            if (not q->scheduled) {
+                q->scheduled = true;
+                to_schedule = q;
+            }
+        }
+        if (to_schedule) {
+            schedule(std::move(to_schedule));
+        }
+    }
+
+    auto keyed_dispatcher::wrap(handler_type handler, handler_type on_discard) -> handler_type
+    {
+        auto phandler = std::make_shared<const handler_type>(std::move(handler));
+        auto pdiscard = on_discard
+        ? std::make_shared<const handler_type>(std::move(on_discard))
+        : nullptr;
+        return [owner = _owner, phandler, pdiscard](message& msg)
+        {
+            std::unique_lock<std::mutex> lock(owner->mutex);
+            if (owner->dispatcher) {
+                owner->dispatcher->submit(std::move(msg), phandler, pdiscard);
+                return;
+            }
+            lock.unlock();
+            if (pdiscard) {
+                (*pdiscard)(msg);
+            }
+        };
+    }
+
+    auto keyed_dispatcher::wrap_acking(channel& chan, handler_type handler) -> handler_type
+    {
+        return wrap([&chan, handler = std::move(handler)](message& msg)
+                    {
+                        auto tag = msg.delivery_tag;
+                        try {
+                            handler(msg);
+                        }
+                        catch(...) {
+                            // settled here, so nothing is left for the dispatcher to report
+                            chan.reject(tag, true);
+                            return;
+                        }
+                        chan.ack(tag);
+                    },
+                    [&chan](message& msg)
+                    {
+                        chan.reject(msg.delivery_tag, true);
+                    });
+    }
+
+    /// Work made runnable by a worker stays on that worker's list, where it is
+    /// likely to find its data in cache; anything else is spread round robin.
+    void keyed_dispatcher::schedule(queue_ptr q)
+    {
+        auto target = current_dispatcher == this
+        ? current_worker
+        : _next.fetch_add(1, std::memory_order_relaxed) % _workers.size();
+        {
+            std::lock_guard<std::mutex> lock(_workers[target]->mutex);
+            _workers[target]->runnable.push_back(std::move(q));
+        }
+        {
+            std::lock_guard<std::mutex> lock(_idle_mutex);
+            ++_ready;
+        }
+        _idle.notify_one();
+    }
+
+    /// A queue that used up its batch goes to the front of the worker's own
+    /// list, which the worker takes from last, and thieves first
+    void keyed_dispatcher::requeue(queue_ptr q)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_workers[current_worker]->mutex);
+            _workers[current_worker]->runnable.push_front(std::move(q));
+        }
+        {
+            std::lock_guard<std::mutex> lock(_idle_mutex);
+            ++_ready;
+        }
+        _idle.notify_one();
+    }
+
+    /// Own list from the back, other lists from the front
+    auto keyed_dispatcher::take(std::size_t self) -> queue_ptr
+    {
+        {
+            auto& own = *_workers[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (not own.runnable.empty()) {
+                auto q = std::move(own.runnable.back());
+                own.runnable.pop_back();
+                --_ready;
+                return q;
+            }
+        }
+        for (std::size_t i = 1 ; i < _workers.size() ; ++i)
+        {
+            auto& victim = *_workers[(self + i) % _workers.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (not victim.runnable.empty()) {
+                auto q = std::move(victim.runnable.front());
+                victim.runnable.pop_front();
+                --_ready;
+                _steals.fetch_add(1, std::memory_order_relaxed);
+                return q;
+            }
+        }
+        return nullptr;
+    }
+
+    /// Stops early when the dispatcher is stopping; the rest of q is then
+    /// discarded by the destructor.
+    void keyed_dispatcher::run(const queue_ptr& q)
+    {
+        for (std::size_t n = 0 ; n < batch_size ; ++n)
+        {
+            if (_stopping) {
+                return;
+            }
+            task t;
+            {
+                std::lock_guard<std::mutex> lock(_keys_mutex);
+                if (q->tasks.empty()) {
+                    q->scheduled = false;
+                    auto i = _queues.find(q->key);
+                    if (i != _queues.end() and i->second == q) {
+                        _queues.erase(i);
+                    }
+                    return;
+                }
+                t = std::move(q->tasks.front());
+                q->tasks.pop_front();
+            }
+            try {
+                (*t.handler)(t.msg);
+            }
+            catch(...) {
+                std::cerr << "asio_amqp::keyed_dispatcher: uncaught exception in message handler\n";
+                std::cerr << value::debug::unwrap(std::current_exception());
+            }
+        }
+        // still scheduled: requeue behind other work so one busy key cannot starve the rest
+        requeue(q);
+    }
+
+    void keyed_dispatcher::worker_loop(std::size_t self)
+    {
+        current_dispatcher = this;
+        current_worker = self;
+        for (;;)
+        {
+            if (_stopping) {
+                return;
+            }
+            if (auto q = take(self)) {
+                run(q);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(_idle_mutex);
+            _idle.wait(lock, [this] { return _stopping or _ready.load() != 0; });
+            if (_stopping) {
+                return;
+            }
+        }
+    }
+
+    auto keyed_dispatcher::by_routing_key() -> key_function
+    {
+        return [](const message& msg) { return msg.routing_key; };
+    }
+
+    auto keyed_dispatcher::by_consumer_tag() -> key_function
+    {
+        return [](const message& msg) { return msg.consumer_tag; };
+    }
+
+    auto keyed_dispatcher::by_header(std::string name) -> key_function
+    {
+        return [name = std::move(name)](const message& msg)
+        {
+            if (not msg.headers.contains(name)) {
+                return std::string();
+            }
+            return std::string(static_cast<const std::string&>(msg.headers.get(name)));
+        };
+    }
+}
@@ -0,0 +1,87 @@
+#include <asio_amqp/replay.hpp>
+
+#include <thread>
+
+namespace asio_amqp {
+
+    replay_driver::replay_driver(const std::string& path,
+                                 const AMQP::Login& login,
+                                 const std::string& vhost)
+    : _reader(path)
+    {
+        _connection = std::make_unique<AMQP::Connection>(this, login, vhost);
+        asio::local::connect_pair(_input, _output);
+    }
+
+    void replay_driver::onError(AMQP::Connection* connection, const char* message)
+    {
+        _error = message;
+    }
+
+    auto replay_driver::run(pacing p) -> statistics
+    {
+        using clock_type = std::chrono::steady_clock;
+
+        statistics stats;
+        capture_record record;
+        auto start = clock_type::now();
+        optional<std::chrono::nanoseconds> first_timestamp;
+        read();
+
+        while (_reader.next(record))
+        {
+            if (record.dir != capture_sink::direction::inbound) {
+                continue;
+            }
+            if (p == pacing::original) {
+                if (not first_timestamp) {
+                    first_timestamp = record.timestamp;
+                }
+                std::this_thread::sleep_until(start + (record.timestamp - *first_timestamp));
+            }
+            feed(record.data);
+            ++stats.records;
+            stats.bytes += record.data.size();
+            if (not _error.empty()) {
+                throw replay_error("replay failed: " + _error);
+            }
+        }
+
+        stats.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start);
+        return stats;
+    }
+
+    void replay_driver::feed(const std::vector<char>& data)
+    {
+        bool writing = true;
+        _written += data.size();
+        asio::async_write(_input, asio::buffer(data),
+                          [this, &writing](const system::error_code& ec, std::size_t)
+                          {
+                              writing = false;
+                              if (ec) {
+                                  _error = ec.message();
+                              }
+                          });
+        while ((writing or _received < _written) and _error.empty())
+        {
+            _io_service.run_one();
+        }
+    }
+
+    void replay_driver::read()
+    {
+        _receiver.async_read(_output, [this](const system::error_code& ec, std::size_t available)
+                             {
+                                 if (ec) {
+                                     if (ec != asio::error::operation_aborted) {
+                                         _error = ec.message();
+                                     }
+                                     return;
+                                 }
+                                 _received = _parsed + available;
+                                 _parsed += _receiver.parse(*_connection);
+                                 read();
+                             });
+    }
+}
@@ -0,0 +1,262 @@
+#include <asio_amqp/resolve_cache.hpp>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+namespace asio_amqp {
+
+    namespace {
+        void resolve_with_asio(asio::io_service& io_service,
+                               const resolve_cache::query_type& query,
+                               resolve_cache::handler_type handler)
+        {
+            using resolver_type = resolve_cache::protocol_type::resolver;
+            auto resolver = std::make_shared<resolver_type>(io_service);
+            resolver->async_resolve(query,
+                                    [resolver, handler = std::move(handler)]
+                                    (const system::error_code& ec, resolver_type::iterator iter)
+                                    {
+                                        resolve_cache::results_type results;
+                                        for ( ; iter != resolver_type::iterator() ; ++iter) {
+                                            results.push_back(iter->endpoint());
+                                        }
+                                        handler(ec, results);
+                                    });
+        }
+    }
+
+    struct resolve_cache::state
+    : std::enable_shared_from_this<state>
+    {
+        struct waiter
+        {
+            asio::io_service* io_service;
+            handler_type handler;
+        };
+
+        struct entry
+        {
+            results_type endpoints;
+            system::error_code error;
+            clock_type::time_point fresh_until;
+            clock_type::time_point stale_until;
+            bool looking_up = false;
+            std::vector<waiter> waiters;
+
+            bool has_result() const {
+                return error or not endpoints.empty();
+            }
+        };
+
+        state(const resolve_options& options, lookup_function lookup, now_function now)
+        : options(options)
+        , lookup(lookup ? std::move(lookup) : lookup_function(&resolve_with_asio))
+        , now(now ? std::move(now) : now_function(&clock_type::now))
+        {}
+
+        static std::string key_of(const query_type& query)
+        {
+            return query.host_name() + '\0' + query.service_name();
+        }
+
+        void async_resolve(asio::io_service& io_service,
+                           const query_type& query,
+                           handler_type handler)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            auto now = this->now();
+            auto& e = entries[key_of(query)];
+            if (e.has_result() and now < e.fresh_until)
+            {
+                ++counters.hits;
+                post(io_service, std::move(handler), e.error, e.endpoints);
+                return;
+            }
+            if (not e.error and not e.endpoints.empty() and now < e.stale_until)
+            {
+                ++counters.stale;
+                post(io_service, std::move(handler), e.error, e.endpoints);
+                if (not e.looking_up) {
+                    start_lookup(e, query, lock);
+                }
+                return;
+            }
+            e.waiters.push_back(waiter { &io_service, std::move(handler) });
+            if (e.looking_up) {
+                ++counters.waits;
+            }
+            else {
+                start_lookup(e, query, lock);
+            }
+        }
+
+        /// @pre lock is held. Releases it.
+        void start_lookup(entry& e,
+                          const query_type& query,
+                          std::unique_lock<std::mutex>& lock)
+        {
+            e.looking_up = true;
+            ++counters.lookups;
+            auto& executor = lookup_executor();
+            lock.unlock();
+            lookup(executor, query,
+                   [self = shared_from_this(), key = key_of(query)]
+                   (const system::error_code& ec, const results_type& results)
+                   {
+                       self->complete(key, ec, results);
+                   });
+        }
+
+        void complete(const std::string& key,
+                      const system::error_code& ec,
+                      const results_type& results)
+        {
+            std::vector<waiter> waiters;
+            results_type endpoints;
+            system::error_code error;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto& e = entries[key];
+                e.looking_up = false;
+                auto now = this->now();
+                auto failed = ec or results.empty();
+                if (not failed)
+                {
+                    e.endpoints = results;
+                    e.error.clear();
+                    e.fresh_until = now + options.ttl;
+                    e.stale_until = e.fresh_until + options.stale_ttl;
+                }
+                else if (not e.error and not e.endpoints.empty() and now < e.stale_until)
+                {
+                    // a failed refresh: keep serving what we have until it runs out
+                }
+                else
+                {
+                    e.endpoints.clear();
+                    e.error = ec ? ec : system::error_code(asio::error::host_not_found);
+                    e.fresh_until = now + options.negative_ttl;
+                    e.stale_until = e.fresh_until;
+                }
+                waiters = std::move(e.waiters);
+                e.waiters.clear();
+                endpoints = e.endpoints;
+                error = e.error;
+            }
+            for (auto& w : waiters) {
+                post(*w.io_service, std::move(w.handler), error, endpoints);
+            }
+        }
+
+        static void post(asio::io_service& io_service,
+                         handler_type handler,
+                         const system::error_code& ec,
+                         const results_type& endpoints)
+        {
+            io_service.post([handler = std::move(handler), ec, endpoints]
+                            {
+                                handler(ec, endpoints);
+                            });
+        }
+
+        /// The io_service lookups run on, with its thread started
+        /// @pre mutex is taken
+        asio::io_service& lookup_executor()
+        {
+            if (not lookup_thread.joinable()) {
+                lookup_work = std::make_unique<asio::io_service::work>(*lookup_service);
+                lookup_thread = std::thread([service = lookup_service.get()] { service->run(); });
+            }
+            return *lookup_service;
+        }
+
+        void shutdown()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                lookup_work.reset();
+            }
+            lookup_service->stop();
+            if (lookup_thread.joinable()) {
+                lookup_thread.join();
+            }
+            // drops unfinished lookups and the references they hold to this
+            lookup_service.reset();
+        }
+
+        const resolve_options options;
+        const lookup_function lookup;
+        const now_function now;
+        std::unique_ptr<asio::io_service> lookup_service = std::make_unique<asio::io_service>();
+        std::unique_ptr<asio::io_service::work> lookup_work;
+        std::thread lookup_thread;
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, entry> entries;
+        stats_type counters;
+    };
+
+    resolve_cache::resolve_cache(const resolve_options& options, lookup_function lookup, now_function now)
+    : _state(std::make_shared<state>(options, std::move(lookup), std::move(now)))
+    {}
+
+    resolve_cache::~resolve_cache()
+    {
+        _state->shutdown();
+    }
+
+    void resolve_cache::async_resolve(asio::io_service& io_service,
+                                      const query_type& query,
+                                      handler_type handler)
+    {
+        _state->async_resolve(io_service, query, std::move(handler));
+    }
+
+    void resolve_cache::clear()
+    {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        for (auto i = _state->entries.begin() ; i != _state->entries.end() ; )
+        {
+            if (i->second.looking_up) {
+                // the lookup's waiters are still owed an answer
+                i->second.endpoints.clear();
+                i->second.error.clear();
+                ++i;
+            }
+            else {
+                i = _state->entries.erase(i);
+            }
+        }
+    }
+
+    std::size_t resolve_cache::size() const
+    {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        return _state->entries.size();
+    }
+
+    auto resolve_cache::stats() const -> stats_type
+    {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        return _state->counters;
+    }
+
+    const resolve_options& resolve_cache::options() const
+    {
+        return _state->options;
+    }
+
+    resolve_cache& resolve_cache::shared(const resolve_options& options)
+    {
+        static resolve_cache cache(options);
+        auto& mine = cache.options();
+        if (options.ttl != mine.ttl
+            or options.negative_ttl != mine.negative_ttl
+            or options.stale_ttl != mine.stale_ttl)
+        {
+            throw std::invalid_argument("resolve_cache::shared: options differ from those it was created with");
+        }
+        return cache;
+    }
+}
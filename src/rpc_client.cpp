@@ -0,0 +1,262 @@
+#include <asio_amqp/rpc_client.hpp>
+#include <asio_amqp/detail/correlation_table.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <atomic>
+#include <functional>
+#include <queue>
+#include <vector>
+
+namespace asio_amqp {
+
+    const char* const rpc_client::reply_queue = "amq.rabbitmq.reply-to";
+
+    namespace {
+        std::string to_hex(std::uint64_t v)
+        {
+            static const char digits[] = "0123456789abcdef";
+            char buf[16];
+            auto p = buf + sizeof(buf);
+            do {
+                *--p = digits[v & 15];
+                v >>= 4;
+            } while (v);
+            return std::string(p, buf + sizeof(buf));
+        }
+
+        /// zero if s is not one of our correlation ids
+        std::uint64_t from_hex(const std::string& s)
+        {
+            if (s.empty() or s.size() > 16) { return 0; }
+            std::uint64_t v = 0;
+            for (auto c : s)
+            {
+                v <<= 4;
+                if (c >= '0' and c <= '9') v |= std::uint64_t(c - '0');
+                else if (c >= 'a' and c <= 'f') v |= std::uint64_t(c - 'a' + 10);
+                else return 0;
+            }
+            return v;
+        }
+
+        /// completes the start handler from async_consume's results
+        struct consume_started
+        {
+            void operator()(const std::string&) const {
+                handler();
+            }
+
+            void operator()(std::exception_ptr pe) const {
+                handler(std::move(pe));
+            }
+
+            void operator()(std::exception_ptr pe, system::error_code ec) const {
+                handler(std::move(pe), ec);
+            }
+
+            void operator()(failure f) const {
+                handler(std::move(f));
+            }
+
+            void operator()(system::error_code ec) const {
+                handler(ec);
+            }
+
+            template<class E, std::enable_if_t<std::is_base_of<std::exception, std::decay_t<E>>::value>* = nullptr>
+            void operator()(E&& e) const {
+                handler(std::forward<E>(e));
+            }
+
+            future_handler<void> handler;
+        };
+    }
+
+    /// Lives on the connection's thread: every member function below runs
+    /// with the connection's mutex taken.
+    struct rpc_client::state
+    : std::enable_shared_from_this<state>
+    {
+        state(std::shared_ptr<channel_impl> impl)
+        : _impl(std::move(impl))
+        , _timer(_impl->get_connection().get_io_service())
+        {}
+
+        void on_reply(message& reply)
+        {
+            pending p;
+            if (_stopped or not _pending.take(from_hex(reply.correlation_id), p)) {
+                return;     // late, or not ours
+            }
+            _outstanding.fetch_sub(1, std::memory_order_relaxed);
+            p.handler(std::move(reply));
+        }
+
+        void call(message& request, clock_type::duration timeout, future_handler<message>& handler)
+        {
+            if (_stopped) {
+                handler(system::error_code(runtime_error_code::cancelled));
+                return;
+            }
+            auto id = ++_next_id;
+            request.reply_to = reply_queue;
+            request.correlation_id = to_hex(id);
+            // the reply cannot be processed before we return, so publishing
+            // first saves an insert and erase when the publish fails
+            if (auto failed = _impl->publish_now(request)) {
+                handler(std::move(failed));
+                return;
+            }
+            auto deadline = timeout.count() ? clock_type::now() + timeout : clock_type::time_point::max();
+            _pending.insert(id, pending { std::move(handler), deadline });
+            _outstanding.fetch_add(1, std::memory_order_relaxed);
+            if (timeout.count()) {
+                _deadlines.emplace(deadline, id);
+                if (_deadlines.size() > 2 * _pending.size() + 1024) {
+                    prune_deadlines();
+                }
+                arm_timer();
+            }
+        }
+
+        void stop()
+        {
+            _stopped = true;
+            _timer.cancel();
+            _deadlines = deadline_queue();
+            _pending.drain([this](std::uint64_t, pending& p)
+                           {
+                               _outstanding.fetch_sub(1, std::memory_order_relaxed);
+                               p.handler(system::error_code(runtime_error_code::cancelled));
+                           });
+        }
+
+        std::shared_ptr<channel_impl> _impl;
+        std::atomic<std::size_t> _outstanding { 0 };
+
+    private:
+        struct pending
+        {
+            future_handler<message> handler;
+            clock_type::time_point deadline;
+        };
+
+        using deadline_entry = std::pair<clock_type::time_point, std::uint64_t>;
+        using deadline_queue = std::priority_queue<deadline_entry,
+                                                   std::vector<deadline_entry>,
+                                                   std::greater<deadline_entry>>;
+
+        /// One timer serves every call: it is set for the earliest deadline.
+        /// Entries of calls already answered stay queued until they expire or
+        /// the queue is pruned.
+        void arm_timer()
+        {
+            auto expiry = _deadlines.top().first;
+            if (_timer_armed and expiry >= _timer_expiry) {
+                return;
+            }
+            _timer_armed = true;
+            _timer_expiry = expiry;
+            _timer.expires_at(expiry);
+            _timer.async_wait([weak = std::weak_ptr<state>(shared_from_this())](const system::error_code& ec)
+                              {
+                                  auto self = weak.lock();
+                                  if (ec == asio::error::operation_aborted or not self) {
+                                      return;
+                                  }
+                                  auto lock = self->_impl->get_connection().get_lock();
+                                  self->_timer_armed = false;
+                                  self->expire();
+                              });
+        }
+
+        void expire()
+        {
+            if (_stopped) { return; }
+            auto now = clock_type::now();
+            while (not _deadlines.empty() and _deadlines.top().first <= now)
+            {
+                auto id = _deadlines.top().second;
+                _deadlines.pop();
+                pending p;
+                auto pp = _pending.find(id);
+                if (pp and pp->deadline <= now and _pending.take(id, p)) {
+                    _outstanding.fetch_sub(1, std::memory_order_relaxed);
+                    p.handler(system::error_code(runtime_error_code::timed_out));
+                }
+            }
+            if (not _deadlines.empty()) {
+                arm_timer();
+            }
+        }
+
+        /// Rebuild the deadline queue from the calls still waiting
+        void prune_deadlines()
+        {
+            std::vector<deadline_entry> live;
+            live.reserve(_pending.size());
+            _pending.for_each([&live](std::uint64_t id, pending& p)
+                              {
+                                  if (p.deadline != clock_type::time_point::max()) {
+                                      live.emplace_back(p.deadline, id);
+                                  }
+                              });
+            _deadlines = deadline_queue(std::greater<deadline_entry>(), std::move(live));
+        }
+
+        asio::steady_timer _timer;
+        bool _timer_armed = false;
+        clock_type::time_point _timer_expiry;
+        detail::correlation_table<pending> _pending;
+        deadline_queue _deadlines;
+        std::uint64_t _next_id = 0;
+        bool _stopped = false;
+    };
+
+    rpc_client::rpc_client(channel& chan)
+    : _channel(&chan)
+    {
+        auto& impl = chan.get_impl_ptr();
+        if (not impl or not impl->id()) {
+            throw std::logic_error("rpc_client: channel not open");
+        }
+        _state = std::make_shared<state>(impl);
+    }
+
+    rpc_client::~rpc_client()
+    {
+        _state->_impl->execute([self = _state]
+        {
+            self->stop();
+        });
+    }
+
+    std::size_t rpc_client::outstanding() const
+    {
+        return _state->_outstanding.load(std::memory_order_relaxed);
+    }
+
+    void rpc_client::start(future_handler<void> handler)
+    {
+        std::weak_ptr<state> weak = _state;
+        _state->_impl->async_consume(reply_queue,
+                                     [weak](message& reply)
+                                     {
+                                         if (auto self = weak.lock()) {
+                                             self->on_reply(reply);
+                                         }
+                                     },
+                                     consume_started { std::move(handler) },
+                                     true,      // no ack
+                                     true);     // deliver on the connection's thread
+    }
+
+    void rpc_client::call(message&& request, clock_type::duration timeout, future_handler<message> handler)
+    {
+        _state->_impl->execute([self = _state,
+                                request = std::move(request),
+                                timeout,
+                                handler = std::move(handler)] () mutable
+        {
+            self->call(request, timeout, handler);
+        });
+    }
+}
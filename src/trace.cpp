@@ -0,0 +1,41 @@
+#include <asio_amqp/trace.hpp>
+
+namespace asio_amqp {
+
+    const char* to_string(trace_level level)
+    {
+        switch(level)
+        {
+            case trace_level::trace: return "trace";
+            case trace_level::debug: return "debug";
+            case trace_level::info: return "info";
+            case trace_level::warning: return "warning";
+            case trace_level::error: return "error";
+        }
+        return "unknown";
+    }
+
+    const char* to_string(trace_event event)
+    {
+        switch(event)
+        {
+            case trace_event::receive: return "receive";
+            case trace_event::consume: return "consume";
+            case trace_event::send_queued: return "send_queued";
+            case trace_event::send_complete: return "send_complete";
+            case trace_event::send_failure: return "send_failure";
+        }
+        return "unknown";
+    }
+
+    std::ostream& operator<<(std::ostream& os, const trace_record& rec)
+    {
+        os << rec.timestamp << ' '
+        << to_string(static_cast<trace_level>(rec.level)) << ' '
+        << to_string(static_cast<trace_event>(rec.event));
+        for (std::size_t i = 0 ; i < rec.nargs ; ++i) {
+            os << ' ' << rec.args[i];
+        }
+        return os;
+    }
+}
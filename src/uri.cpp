@@ -0,0 +1,111 @@
+#include <asio_amqp/uri.hpp>
+#include <asio_amqp/error.hpp>
+
+namespace asio_amqp {
+
+    namespace {
+        [[noreturn]] void invalid()
+        {
+            throw logic_system_error(logic_error_code::invalid_uri,
+                                     system::error_code(logic_error_code::invalid_uri).message());
+        }
+
+        int hex_value(char c)
+        {
+            if (c >= '0' and c <= '9') return c - '0';
+            if (c >= 'a' and c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' and c <= 'F') return c - 'A' + 10;
+            return -1;
+        }
+
+        std::string decode(const std::string& s)
+        {
+            std::string result;
+            result.reserve(s.size());
+            for (std::size_t i = 0 ; i < s.size() ; ++i)
+            {
+                if (s[i] != '%') {
+                    result += s[i];
+                    continue;
+                }
+                if (i + 2 >= s.size()) {
+                    invalid();
+                }
+                auto hi = hex_value(s[i + 1]);
+                auto lo = hex_value(s[i + 2]);
+                if (hi < 0 or lo < 0) {
+                    invalid();
+                }
+                result += char(hi << 4 | lo);
+                i += 2;
+            }
+            return result;
+        }
+    }
+
+    amqp_uri amqp_uri::parse(const std::string& uri)
+    {
+        static const std::string scheme = "amqp://";
+        if (uri.compare(0, scheme.size(), scheme) != 0) {
+            invalid();
+        }
+        amqp_uri result;
+        auto rest = uri.substr(scheme.size());
+
+        auto slash = rest.find('/');
+        if (slash != std::string::npos) {
+            result.vhost = decode(rest.substr(slash + 1));
+            rest.erase(slash);
+        }
+
+        auto at = rest.rfind('@');
+        if (at != std::string::npos)
+        {
+            auto userinfo = rest.substr(0, at);
+            rest.erase(0, at + 1);
+            auto colon = userinfo.find(':');
+            result.user = decode(userinfo.substr(0, colon));
+            if (colon != std::string::npos) {
+                result.password = decode(userinfo.substr(colon + 1));
+            }
+        }
+
+        std::string port;
+        if (not rest.empty() and rest[0] == '[')
+        {
+            auto close = rest.find(']');
+            if (close == std::string::npos) {
+                invalid();
+            }
+            result.host = rest.substr(1, close - 1);
+            auto after = rest.substr(close + 1);
+            if (not after.empty()) {
+                if (after[0] != ':') {
+                    invalid();
+                }
+                port = after.substr(1);
+            }
+        }
+        else
+        {
+            auto colon = rest.find(':');
+            auto host = rest.substr(0, colon);
+            if (not host.empty()) {
+                result.host = decode(host);
+            }
+            if (colon != std::string::npos) {
+                port = rest.substr(colon + 1);
+            }
+        }
+
+        if (not port.empty())
+        {
+            if (port.size() > 5 or port.find_first_not_of("0123456789") != std::string::npos
+                or std::stoul(port) == 0 or std::stoul(port) > 65535) {
+                invalid();
+            }
+            result.port = port;
+        }
+        return result;
+    }
+}
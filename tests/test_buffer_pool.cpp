@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+#include <asio_amqp/detail/buffer_pool.hpp>
+#include <asio_amqp/detail/receiver.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/write.hpp>
+#include <string>
+
+using asio_amqp::detail::buffer_pool;
+namespace asio = asio_amqp::asio;
+
+TEST(test_buffer_pool, reuses_released_blocks)
+{
+    buffer_pool pool;
+    char* first;
+    {
+        auto block = pool.acquire(1024);
+        first = block.get();
+    }
+    EXPECT_EQ(1024u, pool.retained());
+    auto again = pool.acquire(1024);
+    EXPECT_EQ(first, again.get());
+    EXPECT_EQ(0u, pool.retained());
+    auto other = pool.acquire(2048);
+    EXPECT_NE(first, other.get());
+}
+
+TEST(test_buffer_pool, retention_is_bounded)
+{
+    buffer_pool pool(3000);
+    {
+        auto a = pool.acquire(1024);
+        auto b = pool.acquire(1024);
+        auto c = pool.acquire(1024);
+    }
+    EXPECT_EQ(2048u, pool.retained());
+}
+
+TEST(test_buffer_pool, blocks_return_to_the_pool_they_came_from)
+{
+    asio::io_service a, b;
+    auto pool_a = buffer_pool::of(a);
+    auto pool_b = buffer_pool::of(b);
+    EXPECT_EQ(pool_a, buffer_pool::of(a));
+    EXPECT_NE(pool_a, pool_b);
+
+    auto shared_before = buffer_pool::shared().retained();
+    {
+        auto block = pool_a->acquire(1024);
+        auto other = pool_b->acquire(2048);
+    }
+    EXPECT_EQ(1024u, pool_a->retained());
+    EXPECT_EQ(2048u, pool_b->retained());
+    EXPECT_EQ(shared_before, buffer_pool::shared().retained());
+}
+
+TEST(test_buffer_pool, receiver_keeps_its_pool_alive)
+{
+    asio::io_service io_service;
+    asio::local::stream_protocol::socket a(io_service), b(io_service);
+    asio::local::connect_pair(a, b);
+
+    std::weak_ptr<buffer_pool> weak;
+    {
+        asio_amqp::detail::receiver r;
+        {
+            auto pool = std::make_shared<buffer_pool>();
+            weak = pool;
+            r.set_pool(std::move(pool));
+        }
+        r.set_read_size(64);
+        asio::write(b, asio::buffer(std::string("partial")));
+        r.async_read(a, [](const asio_amqp::system::error_code&, std::size_t) {});
+        io_service.run();
+        EXPECT_FALSE(weak.expired());
+    }
+    EXPECT_TRUE(weak.expired());
+}
+
+TEST(test_buffer_pool, receiver_holds_a_block_only_while_data_is_unparsed)
+{
+    asio::io_service io_service;
+    asio::local::stream_protocol::socket a(io_service), b(io_service);
+    asio::local::connect_pair(a, b);
+
+    buffer_pool pool;
+    asio_amqp::detail::receiver r;
+    r.set_pool(pool);
+    r.set_read_size(64);
+
+    asio::write(b, asio::buffer(std::string("hello, world")));
+    std::size_t available = 0;
+    r.async_read(a, [&](const asio_amqp::system::error_code& ec, std::size_t n)
+                 {
+                     EXPECT_FALSE(ec);
+                     available = n;
+                 });
+    io_service.run();
+    ASSERT_EQ(12u, available);
+    EXPECT_EQ(0u, pool.retained());
+
+    // a partial frame stays in the block
+    r.consume(5);
+    r.normalise();
+    EXPECT_EQ(0u, pool.retained());
+    EXPECT_EQ(std::string(", world"),
+              std::string(asio::buffer_cast<const char*>(r.data()), asio::buffer_size(r.data())));
+
+    // fully parsed after a short read: the block goes back
+    r.consume(7);
+    r.normalise();
+    EXPECT_EQ(64u, pool.retained());
+}
@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+#include <asio_amqp/capture.hpp>
+#include <asio_amqp/channel.hpp>
+#include <asio_amqp/connection.hpp>
+#include <asio_amqp/replay.hpp>
+#include "stand_in_fixture.hpp"
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+
+TEST(test_capture, round_trip)
+{
+    auto path = ::testing::TempDir() + "asio_amqp_test.cap";
+    {
+        asio_amqp::file_capture capture(path);
+        capture.record(asio_amqp::capture_sink::direction::outbound, "AMQP\0\0\x09\x01", 8);
+        capture.record(asio_amqp::capture_sink::direction::inbound, "\x08\0\0\0\0\0\0\xce", 8);
+        capture.record(asio_amqp::capture_sink::direction::inbound, "", 0);
+    }
+
+    asio_amqp::capture_reader reader(path);
+    asio_amqp::capture_record record;
+
+    ASSERT_TRUE(reader.next(record));
+    EXPECT_EQ(asio_amqp::capture_sink::direction::outbound, record.dir);
+    EXPECT_EQ(std::string("AMQP\0\0\x09\x01", 8), std::string(record.data.begin(), record.data.end()));
+    auto first = record.timestamp;
+
+    ASSERT_TRUE(reader.next(record));
+    EXPECT_EQ(asio_amqp::capture_sink::direction::inbound, record.dir);
+    EXPECT_EQ(std::string("\x08\0\0\0\0\0\0\xce", 8), std::string(record.data.begin(), record.data.end()));
+    EXPECT_LE(first, record.timestamp);
+
+    ASSERT_TRUE(reader.next(record));
+    EXPECT_TRUE(record.data.empty());
+
+    EXPECT_FALSE(reader.next(record));
+    std::remove(path.c_str());
+}
+
+TEST(test_capture, rejects_foreign_file)
+{
+    auto path = ::testing::TempDir() + "asio_amqp_test.cap";
+    {
+        std::ofstream os(path);
+        os << "not a capture";
+    }
+    EXPECT_THROW(asio_amqp::capture_reader reader(path), asio_amqp::capture_format_error);
+    std::remove(path.c_str());
+}
+
+namespace {
+    struct memory_capture : asio_amqp::capture_sink
+    {
+        void record(direction dir, const char* data, std::size_t size) override
+        {
+            if (dir == direction::inbound) {
+                inbound.append(data, size);
+            }
+        }
+        
+        std::string inbound;
+    };
+}
+
+TEST(test_capture, replay_round_trip)
+{
+    namespace asio = asio_amqp::asio;
+    auto path = ::testing::TempDir() + "asio_amqp_replay_test.cap";
+    auto capture = std::make_shared<asio_amqp::file_capture>(path);
+    {
+        stand_in_fixture broker;
+        asio::io_service io_service;
+        asio_amqp::connection conn(io_service);
+        conn.set_capture(capture);
+        asio_amqp::channel chan(io_service, conn);
+        
+        asio_amqp::system::error_code error;
+        bool opened = false, consuming = false;
+        std::string received;
+        chan.async_open(broker.uri(), [&](asio_amqp::system::error_code ec, unsigned) {
+            error = ec;
+            opened = true;
+        });
+        ASSERT_TRUE(run_until(io_service, [&] { return opened; }));
+        ASSERT_FALSE(error) << error.message();
+        chan.async_consume("replies",
+                           [&](asio_amqp::message& msg) { received = msg.body; },
+                           [&](asio_amqp::system::error_code ec, std::string) {
+                               error = ec;
+                               consuming = true;
+                           });
+        ASSERT_TRUE(run_until(io_service, [&] { return consuming; }));
+        ASSERT_FALSE(error) << error.message();
+        
+        asio_amqp::message request;
+        request.routing_key = "requests";
+        request.reply_to = "amq.rabbitmq.reply-to";
+        request.body = "round trip";
+        chan.async_publish(std::move(request), [](asio_amqp::system::error_code) {});
+        ASSERT_TRUE(run_until(io_service, [&] { return not received.empty(); }));
+        EXPECT_EQ("round trip", received);
+        conn.set_capture(nullptr);
+    }
+    capture->flush();
+    
+    std::string captured;
+    {
+        asio_amqp::capture_reader reader(path);
+        asio_amqp::capture_record record;
+        while (reader.next(record)) {
+            if (record.dir == asio_amqp::capture_sink::direction::inbound) {
+                captured.append(record.data.begin(), record.data.end());
+            }
+        }
+    }
+    ASSERT_FALSE(captured.empty());
+    
+    asio_amqp::replay_driver driver(path);
+    auto replayed = std::make_shared<memory_capture>();
+    driver.set_capture(replayed);
+    std::string redelivered;
+    AMQP::Channel channel(&driver.connection());
+    channel.consume("replies").onReceived([&](const AMQP::Message& m, uint64_t, bool) {
+        redelivered.assign(m.body(), m.bodySize());
+    });
+    auto stats = driver.run();
+    EXPECT_EQ(captured.size(), stats.bytes);
+    EXPECT_EQ(captured, replayed->inbound);
+    EXPECT_EQ("round trip", redelivered);
+    std::remove(path.c_str());
+}
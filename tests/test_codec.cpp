@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+#include <asio_amqp/codec.hpp>
+#include <string>
+
+namespace {
+    std::string make_json(std::size_t records)
+    {
+        std::string body = "[";
+        for (std::size_t i = 0 ; i < records ; ++i) {
+            body += R"({"id":)" + std::to_string(i) + R"(,"name":"record","tags":["a","b"]},)";
+        }
+        body.back() = ']';
+        return body;
+    }
+
+    void round_trip(const asio_amqp::body_codec* codec)
+    {
+        auto name = codec->name();
+        asio_amqp::codec_options options;
+        options.codec = codec;
+
+        asio_amqp::message msg;
+        msg.body = make_json(1000);
+        auto original = msg.body;
+
+        ASSERT_TRUE(asio_amqp::encode_body(msg, options)) << name;
+        EXPECT_EQ(name, msg.content_encoding);
+        EXPECT_LT(msg.body.size(), original.size());
+
+        ASSERT_TRUE(asio_amqp::decode_body(msg, asio_amqp::codec_options())) << name;
+        EXPECT_TRUE(msg.content_encoding.empty());
+        EXPECT_EQ(original, msg.body);
+    }
+}
+
+TEST(test_codec, round_trip_deflate)
+{
+    auto codec = asio_amqp::find_codec("deflate");
+    if (not codec) {
+        GTEST_SKIP() << "deflate not compiled in";
+    }
+    round_trip(codec);
+}
+
+TEST(test_codec, round_trip_lz4)
+{
+    auto codec = asio_amqp::find_codec("lz4");
+    if (not codec) {
+        GTEST_SKIP() << "lz4 not compiled in";
+    }
+    round_trip(codec);
+}
+
+TEST(test_codec, round_trip_zstd)
+{
+    auto codec = asio_amqp::find_codec("zstd");
+    if (not codec) {
+        GTEST_SKIP() << "zstd not compiled in";
+    }
+    round_trip(codec);
+}
+
+TEST(test_codec, decode_limit)
+{
+    auto codec = asio_amqp::find_codec("deflate");
+    if (not codec) {
+        GTEST_SKIP() << "deflate not compiled in";
+    }
+    // a few kilobytes that inflate to 16 MiB
+    asio_amqp::message msg;
+    codec->encode(std::string(16 << 20, '\0').data(), 16 << 20, msg.body);
+    msg.content_encoding = "deflate";
+    auto encoded = msg.body;
+
+    asio_amqp::codec_options options;
+    options.max_decoded_size = 1 << 20;
+    EXPECT_FALSE(asio_amqp::decode_body(msg, options));
+    EXPECT_EQ("deflate", msg.content_encoding);
+    EXPECT_EQ(encoded, msg.body);
+
+    std::string out;
+    EXPECT_THROW(codec->decode(encoded.data(), encoded.size(), out, 1 << 20), asio_amqp::codec_error);
+    EXPECT_NO_THROW(codec->decode(encoded.data(), encoded.size(), out, 16 << 20));
+    EXPECT_EQ(std::size_t(16 << 20), out.size());
+}
+
+TEST(test_codec, below_threshold)
+{
+    auto codec = asio_amqp::find_codec("deflate");
+    if (not codec) {
+        GTEST_SKIP() << "deflate not compiled in";
+    }
+    asio_amqp::codec_options options;
+    options.codec = codec;
+    options.threshold = 1024;
+
+    asio_amqp::message msg;
+    msg.body = std::string(100, 'x');
+    EXPECT_FALSE(asio_amqp::encode_body(msg, options));
+    EXPECT_EQ(std::string(100, 'x'), msg.body);
+    EXPECT_TRUE(msg.content_encoding.empty());
+}
+
+TEST(test_codec, unknown_or_corrupt)
+{
+    asio_amqp::message msg;
+    msg.body = "not compressed";
+    msg.content_encoding = "gzip-nonsense";
+    EXPECT_FALSE(asio_amqp::decode_body(msg, asio_amqp::codec_options()));
+    EXPECT_EQ("gzip-nonsense", msg.content_encoding);
+
+    if (not asio_amqp::find_codec("deflate")) {
+        GTEST_SKIP() << "deflate not compiled in";
+    }
+    msg.content_encoding = "deflate";
+    EXPECT_FALSE(asio_amqp::decode_body(msg, asio_amqp::codec_options()));
+    EXPECT_EQ("not compressed", msg.body);
+}
@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+#include <asio_amqp/connection.hpp>
+#include <asio_amqp/channel.hpp>
+#include <thread>
+
+namespace asio = asio_amqp::asio;
+
+TEST(test_completion, immediate_failure_is_posted)
+{
+    asio::io_service io_service;
+    asio_amqp::connection conn(io_service);
+    asio_amqp::channel chan(io_service, conn);
+    
+    bool called = false;
+    asio_amqp::system::error_code error;
+    chan.async_publish("", "queue", "body", [&](asio_amqp::system::error_code ec) {
+        called = true;
+        error = ec;
+    });
+    EXPECT_FALSE(called);
+    io_service.poll();
+    EXPECT_TRUE(called);
+    EXPECT_EQ(asio_amqp::system::error_code(asio_amqp::logic_error_code::channel_not_open), error);
+}
+
+TEST(test_completion, immediate_failure_is_posted_under_dispatch)
+{
+    asio::io_service io_service;
+    asio_amqp::service_options options;
+    options.completion = asio_amqp::completion_policy::dispatch;
+    asio_amqp::configure_connection_service(io_service, options);
+    asio_amqp::connection conn(io_service);
+    asio_amqp::channel chan(io_service, conn);
+    
+    bool called = false;
+    // initiated from a handler, so the io_service is running on this thread
+    io_service.post([&] {
+        chan.async_publish("", "queue", "body", [&](asio_amqp::future<void>& f) {
+            called = true;
+            EXPECT_TRUE(f.is_exception());
+        });
+        EXPECT_FALSE(called);
+    });
+    io_service.poll();
+    EXPECT_TRUE(called);
+}
+
+TEST(test_completion, completion_after_shutdown_is_dropped)
+{
+    bool called = false;
+    asio_amqp::future_handler<void> handler;
+    {
+        asio::io_service io_service;
+        handler = asio_amqp::make_future_handler<void>(io_service, [&](asio_amqp::future<void>&) {
+            called = true;
+        });
+    }
+    // as a connection on the shared pool would, after the client io_service is gone
+    std::thread([&] { handler(); }).join();
+    EXPECT_FALSE(called);
+}
+
+TEST(test_completion, exception_is_built_only_when_asked_for)
+{
+    asio::io_service io_service;
+    int built = 0;
+    auto failed = [&] {
+        return asio_amqp::failure { asio_amqp::runtime_error_code::timed_out, nullptr, [&built] {
+            ++built;
+            return std::make_exception_ptr(asio_amqp::system::system_error(asio_amqp::runtime_error_code::timed_out));
+        } };
+    };
+
+    // a completion taking the code never needs it
+    asio_amqp::system::error_code error;
+    asio_amqp::async_initiate_future<void>(io_service, asio_amqp::completion_policy::post,
+                                           [&](asio_amqp::system::error_code ec) { error = ec; },
+                                           [&](auto&& handler) { handler(failed()); });
+    io_service.run();
+    EXPECT_EQ(asio_amqp::system::error_code(asio_amqp::runtime_error_code::timed_out), error);
+    EXPECT_EQ(0, built);
+
+    // a future<T>& callback builds it once, when it looks
+    bool threw = false;
+    auto handler = asio_amqp::make_future_handler<void>(io_service, [&](asio_amqp::future<void>& f) {
+        EXPECT_EQ(asio_amqp::system::error_code(asio_amqp::runtime_error_code::timed_out), f.get_error_code());
+        EXPECT_EQ(0, built);
+        try {
+            f.get();
+        }
+        catch(const asio_amqp::system::system_error& e) {
+            threw = e.code() == asio_amqp::system::error_code(asio_amqp::runtime_error_code::timed_out);
+        }
+        EXPECT_EQ(f.get_exception(), f.get_exception());
+    });
+    handler(failed());
+    io_service.reset();
+    io_service.run();
+    EXPECT_TRUE(threw);
+    EXPECT_EQ(1, built);
+}
+
+TEST(test_completion, failure_without_a_code_is_given_one_when_stored)
+{
+    asio::io_service io_service;
+    int built = 0;
+    asio_amqp::system::error_code error;
+    asio_amqp::async_initiate_future<void>(io_service, asio_amqp::completion_policy::post,
+                                           [&](asio_amqp::system::error_code ec) { error = ec; },
+                                           [&](auto&& handler) {
+                                               handler(asio_amqp::failure { {}, nullptr, [&built] {
+                                                   ++built;
+                                                   return std::make_exception_ptr(std::runtime_error("no code"));
+                                               } });
+                                           });
+    io_service.run();
+    EXPECT_EQ(asio_amqp::system::error_code(asio_amqp::runtime_error_code::unspecified), error);
+    EXPECT_EQ(0, built);
+
+    asio_amqp::future<void> f;
+    f.set_exception(std::make_exception_ptr(std::runtime_error("no code")));
+    EXPECT_EQ(asio_amqp::system::error_code(asio_amqp::runtime_error_code::unspecified), f.get_error_code());
+}
@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 #include <asio_amqp/connection.hpp>
 #include <asio_amqp/channel.hpp>
+#include <boost/asio/use_future.hpp>
 #include <future>
 #include <condition_variable>
 #include <chrono>
@@ -132,6 +133,30 @@ TEST(test_connection, resolve_failure)
     ASSERT_TRUE((throws_exception<asio_amqp::resolve_failure>([&]{shared_result.get();})));
 }
 
+TEST(test_connection, resolve_failure_error_code)
+{
+    asio_amqp::asio::io_service io_service;
+    asio_amqp::connection conn(io_service);
+    
+    asio_amqp::system::error_code result;
+    conn.async_connect_transport(asio_amqp::connection::query_type("nonexistentaddress.local", "5672"),
+                                 [&](asio_amqp::system::error_code ec) { result = ec; });
+    ASSERT_TRUE(tick(io_service));
+    ASSERT_TRUE(result);
+    ASSERT_NE(asio_amqp::runtime_error_category(), result.category());
+}
+
+TEST(test_connection, completion_token)
+{
+    asio_amqp::asio::io_service io_service;
+    asio_amqp::connection conn(io_service);
+    
+    auto result = conn.async_connect_transport(asio_amqp::connection::query_type("localhost", "5672"),
+                                               asio_amqp::asio::use_future);
+    ASSERT_TRUE(tick(io_service));
+    ASSERT_TRUE(no_exception([&]{result.get();}));
+}
+
 TEST(test_connection, logon_failure)
 {
     asio_amqp::asio::io_service io_service;
@@ -152,6 +177,8 @@ TEST(test_connection, logon_failure)
     ASSERT_TRUE(tick(io_service));
     ASSERT_TRUE(shared_result.valid());
     ASSERT_TRUE(throws_exception<asio_amqp::connection_failure>([&]{shared_result.get();}));
+    EXPECT_EQ(asio_amqp::system::error_code(asio_amqp::runtime_error_code::authentication),
+              shared_result.get_error_code());
 }
 
 TEST(test_connection, create_channel)
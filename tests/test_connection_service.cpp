@@ -0,0 +1,35 @@
+#include <gtest/gtest.h>
+#include <asio_amqp/connection_service.hpp>
+
+namespace asio = asio_amqp::asio;
+
+TEST(test_connection_service, configure_twice_throws)
+{
+    asio::io_service io_service;
+    asio_amqp::configure_connection_service(io_service, asio_amqp::service_options());
+    // the rejected service has already started its thread; it must be joined
+    EXPECT_THROW(asio_amqp::configure_connection_service(io_service, asio_amqp::service_options()),
+                 asio::service_already_exists);
+}
+
+TEST(test_connection_service, reports_service_pin_failure)
+{
+    asio::io_service io_service;
+    asio_amqp::service_options options;
+    options.service_cpus = { -1 };
+    auto& service = asio_amqp::configure_connection_service(io_service, options);
+    EXPECT_EQ(asio_amqp::system::errc::make_error_code(asio_amqp::system::errc::invalid_argument),
+              service.affinity_error());
+}
+
+TEST(test_connection_service, reports_client_pin_failure)
+{
+    asio::io_service io_service;
+    asio_amqp::service_options options;
+    options.client_cpus = { -1 };
+    auto& service = asio_amqp::configure_connection_service(io_service, options);
+    EXPECT_FALSE(service.affinity_error());
+    io_service.poll();
+    EXPECT_EQ(asio_amqp::system::errc::make_error_code(asio_amqp::system::errc::invalid_argument),
+              service.affinity_error());
+}
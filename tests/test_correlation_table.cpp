@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+#include <asio_amqp/detail/correlation_table.hpp>
+#include <map>
+#include <random>
+#include <string>
+
+using asio_amqp::detail::correlation_table;
+
+TEST(test_correlation_table, insert_find_take)
+{
+    correlation_table<std::string> table(8);
+    table.insert(1, "one");
+    table.insert(2, "two");
+
+    ASSERT_NE(nullptr, table.find(2));
+    EXPECT_EQ("two", *table.find(2));
+    EXPECT_EQ(nullptr, table.find(3));
+    EXPECT_EQ(nullptr, table.find(0));
+
+    std::string out;
+    EXPECT_TRUE(table.take(1, out));
+    EXPECT_EQ("one", out);
+    EXPECT_FALSE(table.take(1, out));
+    EXPECT_EQ(1u, table.size());
+}
+
+TEST(test_correlation_table, grows_when_half_full)
+{
+    correlation_table<int> table(8);
+    for (int i = 1 ; i <= 100 ; ++i) {
+        table.insert(std::uint64_t(i), i);
+    }
+    EXPECT_EQ(100u, table.size());
+    EXPECT_GE(table.capacity(), 200u);
+    for (int i = 1 ; i <= 100 ; ++i) {
+        ASSERT_NE(nullptr, table.find(std::uint64_t(i)));
+        EXPECT_EQ(i, *table.find(std::uint64_t(i)));
+    }
+}
+
+TEST(test_correlation_table, erase_keeps_probe_runs_intact)
+{
+    // random inserts and erases checked against std::map
+    correlation_table<std::uint64_t> table(16);
+    std::map<std::uint64_t, std::uint64_t> reference;
+    std::mt19937_64 rng(42);
+    for (int round = 0 ; round < 20000 ; ++round)
+    {
+        auto key = rng() % 512 + 1;
+        if (reference.count(key)) {
+            std::uint64_t out = 0;
+            ASSERT_TRUE(table.take(key, out));
+            EXPECT_EQ(reference[key], out);
+            reference.erase(key);
+        }
+        else {
+            table.insert(key, key * 3);
+            reference[key] = key * 3;
+        }
+        ASSERT_EQ(reference.size(), table.size());
+    }
+    for (std::uint64_t key = 1 ; key <= 512 ; ++key) {
+        auto p = table.find(key);
+        EXPECT_EQ(reference.count(key) != 0, p != nullptr);
+    }
+
+    std::size_t drained = 0;
+    table.drain([&](std::uint64_t key, std::uint64_t& value)
+                {
+                    EXPECT_EQ(key * 3, value);
+                    ++drained;
+                });
+    EXPECT_EQ(reference.size(), drained);
+    EXPECT_EQ(0u, table.size());
+}
@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+#include <asio_amqp/detail/frame_encoder.hpp>
+#include <asio_amqp/detail/frame_scanner.hpp>
+#include <asio_amqp/detail/publish_template.hpp>
+#include <string>
+#include <vector>
+
+using asio_amqp::detail::frame_encoder;
+
+TEST(test_frame_encoder, publish_method)
+{
+    std::vector<char> out;
+    frame_encoder encoder(out);
+    encoder.publish_method(5, "amq.direct", "key");
+
+    std::string expected("\x01\x00\x05\x00\x00\x00\x16"     // method frame, channel 5, size 22
+                         "\x00\x3c\x00\x28"                 // basic.publish
+                         "\x00\x00"                         // reserved
+                         "\x0a" "amq.direct"
+                         "\x03" "key"
+                         "\x00"                             // no flags
+                         "\xce", 30);
+    EXPECT_EQ(expected, std::string(out.begin(), out.end()));
+}
+
+TEST(test_frame_encoder, content_header_and_body_scan_as_frames)
+{
+    std::vector<char> out;
+    frame_encoder encoder(out);
+    encoder.begin_content_header(1, 3, frame_encoder::content_type_flag);
+    encoder.put_shortstr("text/plain");
+    encoder.end_frame();
+    encoder.begin_frame(frame_encoder::body_frame, 1);
+    encoder.put_bytes("abc", 3);
+    encoder.end_frame();
+
+    auto scan = asio_amqp::detail::scan_frames(out.data(), out.size());
+    EXPECT_EQ(2u, scan.frames);
+    EXPECT_EQ(out.size(), scan.bytes);
+    EXPECT_FALSE(scan.malformed);
+    // header payload: class, weight, u64 size, flags, shortstr
+    EXPECT_EQ(std::uint32_t(2 + 2 + 8 + 2 + 11),
+              asio_amqp::detail::read_frame_size(reinterpret_cast<const unsigned char*>(out.data())));
+}
+
+TEST(test_frame_encoder, short_string_limit)
+{
+    std::vector<char> out;
+    frame_encoder encoder(out);
+    EXPECT_THROW(encoder.put_shortstr(std::string(256, 'x')), std::length_error);
+}
+
+TEST(test_frame_encoder, publish_template_matches_direct_encoding)
+{
+    asio_amqp::message properties;
+    properties.content_type = "application/json";
+    properties.reply_to = "replies";
+    asio_amqp::detail::publish_template tmpl(3, 4096 + 8, "ex", "rk", properties);
+
+    std::string body(10000, 'b');
+    std::vector<char> stamped;
+    tmpl.encode(body.data(), body.size(), "corr", "id-1", stamped);
+
+    std::vector<char> expected;
+    frame_encoder encoder(expected);
+    encoder.publish_method(3, "ex", "rk");
+    encoder.begin_content_header(3, body.size(),
+                                 frame_encoder::content_type_flag
+                                 | frame_encoder::correlation_id_flag
+                                 | frame_encoder::reply_to_flag
+                                 | frame_encoder::message_id_flag);
+    encoder.put_shortstr("application/json");
+    encoder.put_shortstr("corr");
+    encoder.put_shortstr("replies");
+    encoder.put_shortstr("id-1");
+    encoder.end_frame();
+    for (std::size_t offset = 0 ; offset < body.size() ; offset += 4096) {
+        encoder.begin_frame(frame_encoder::body_frame, 3);
+        encoder.put_bytes(body.data() + offset, std::min<std::size_t>(4096, body.size() - offset));
+        encoder.end_frame();
+    }
+    EXPECT_EQ(expected, stamped);
+
+    // a second message without ids reuses the same template
+    tmpl.encode("x", 1, "", "", stamped);
+    auto scan = asio_amqp::detail::scan_frames(stamped.data(), stamped.size());
+    EXPECT_EQ(3u, scan.frames);
+    EXPECT_EQ(stamped.size(), scan.bytes);
+}
+
+TEST(test_frame_encoder, settlement_methods)
+{
+    std::vector<char> out;
+    frame_encoder encoder(out);
+    encoder.ack(2, 7, true);
+    EXPECT_EQ(std::string("\x01\x00\x02\x00\x00\x00\x0d"   // method frame, channel 2, size 13
+                          "\x00\x3c\x00\x50"               // basic.ack
+                          "\x00\x00\x00\x00\x00\x00\x00\x07"
+                          "\x01"                           // multiple
+                          "\xce", 21),
+              std::string(out.begin(), out.end()));
+
+    out.clear();
+    encoder.nack(2, 7, false, true);
+    EXPECT_EQ(std::string("\x00\x3c\x00\x78", 4), std::string(out.begin() + 7, out.begin() + 11));
+    EXPECT_EQ('\x02', out[19]);                            // requeue
+
+    out.clear();
+    encoder.heartbeat();
+    EXPECT_EQ(std::string("\x08\x00\x00\x00\x00\x00\x00\xce", 8), std::string(out.begin(), out.end()));
+}
+
+TEST(test_frame_encoder, body_frames_split_at_limit)
+{
+    std::vector<char> out;
+    frame_encoder encoder(out);
+    std::string body(250, 'z');
+    encoder.body_frames(1, body.data(), body.size(), 100);
+
+    auto scan = asio_amqp::detail::scan_frames(out.data(), out.size());
+    EXPECT_EQ(3u, scan.frames);
+    EXPECT_EQ(body.size() + 3 * asio_amqp::detail::frame_overhead, scan.bytes);
+}
@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+#include <asio_amqp/detail/frame_scanner.hpp>
+#include <string>
+
+namespace {
+    std::string make_frame(char type, std::uint16_t channel, const std::string& payload)
+    {
+        std::string frame;
+        frame += type;
+        frame += char(channel >> 8);
+        frame += char(channel & 0xff);
+        auto size = std::uint32_t(payload.size());
+        frame += char(size >> 24);
+        frame += char(size >> 16);
+        frame += char(size >> 8);
+        frame += char(size);
+        frame += payload;
+        frame += char(0xce);
+        return frame;
+    }
+}
+
+TEST(test_frame_scanner, empty)
+{
+    auto scan = asio_amqp::detail::scan_frames(nullptr, 0);
+    EXPECT_EQ(0u, scan.frames);
+    EXPECT_EQ(0u, scan.bytes);
+    EXPECT_FALSE(scan.malformed);
+}
+
+TEST(test_frame_scanner, complete_frames_and_partial_tail)
+{
+    auto a = make_frame(1, 1, "method");
+    auto b = make_frame(3, 1, std::string(300, 'x'));
+    auto c = make_frame(8, 0, "");
+    auto d = make_frame(3, 2, "partial");
+    auto buffer = a + b + c + d.substr(0, 9);
+
+    auto scan = asio_amqp::detail::scan_frames(buffer.data(), buffer.size());
+    EXPECT_EQ(3u, scan.frames);
+    EXPECT_EQ(a.size() + b.size() + c.size(), scan.bytes);
+    EXPECT_FALSE(scan.malformed);
+}
+
+TEST(test_frame_scanner, partial_header)
+{
+    auto a = make_frame(1, 1, "method");
+    auto buffer = a + std::string("\x03\x00\x01", 3);
+    auto scan = asio_amqp::detail::scan_frames(buffer.data(), buffer.size());
+    EXPECT_EQ(1u, scan.frames);
+    EXPECT_EQ(a.size(), scan.bytes);
+}
+
+TEST(test_frame_scanner, missing_frame_end)
+{
+    auto a = make_frame(1, 1, "method");
+    auto bad = make_frame(1, 1, "method");
+    bad.back() = 'x';
+    auto buffer = a + bad;
+    auto scan = asio_amqp::detail::scan_frames(buffer.data(), buffer.size());
+    EXPECT_EQ(1u, scan.frames);
+    EXPECT_EQ(a.size(), scan.bytes);
+    EXPECT_TRUE(scan.malformed);
+}
+
+TEST(test_frame_scanner, protocol_header_is_not_a_frame)
+{
+    std::string buffer("AMQP\x00\x00\x09\x01", 8);
+    auto scan = asio_amqp::detail::scan_frames(buffer.data(), buffer.size());
+    EXPECT_EQ(0u, scan.bytes);
+    EXPECT_TRUE(scan.malformed);
+}
+
+TEST(test_frame_scanner, frame_above_frame_max_is_malformed)
+{
+    auto a = make_frame(1, 1, "method");
+    auto big = make_frame(3, 1, std::string(5000, 'x'));
+    // only the header of the oversized frame has arrived
+    auto buffer = a + big.substr(0, 16);
+    auto scan = asio_amqp::detail::scan_frames(buffer.data(), buffer.size(), 4096);
+    EXPECT_EQ(1u, scan.frames);
+    EXPECT_EQ(a.size(), scan.bytes);
+    EXPECT_TRUE(scan.malformed);
+
+    // no limit: it is simply incomplete
+    scan = asio_amqp::detail::scan_frames(buffer.data(), buffer.size());
+    EXPECT_FALSE(scan.malformed);
+}
+
+TEST(test_frame_scanner, frame_prefix_cuts_at_frame_boundaries)
+{
+    auto a = make_frame(3, 1, std::string(100, 'x'));
+    auto b = make_frame(3, 1, std::string(100, 'y'));
+    auto buffer = a + b;
+    using asio_amqp::detail::frame_prefix;
+    EXPECT_EQ(a.size(), frame_prefix(buffer.data(), buffer.size(), a.size() + 10));
+    EXPECT_EQ(a.size(), frame_prefix(buffer.data(), buffer.size(), 10));
+    EXPECT_EQ(buffer.size(), frame_prefix(buffer.data(), buffer.size(), buffer.size()));
+
+    // the protocol header is a unit of its own
+    std::string header("AMQP\x00\x00\x09\x01", 8);
+    auto coalesced = header + a;
+    EXPECT_EQ(header.size(), frame_prefix(coalesced.data(), coalesced.size(), 4));
+    EXPECT_EQ(coalesced.size(), frame_prefix(coalesced.data(), coalesced.size(), coalesced.size()));
+
+    // anything else is never split
+    std::string junk(20, 'z');
+    EXPECT_EQ(junk.size(), frame_prefix(junk.data(), junk.size(), 4));
+}
+
+TEST(test_frame_scanner, channel_close)
+{
+    std::uint16_t channel = 0;
+    auto close = make_frame(1, 7, std::string("\x00\x14\x00\x28", 4) + std::string(8, '\0'));
+    EXPECT_TRUE(asio_amqp::detail::is_channel_close(close.data(), close.size(), channel));
+    EXPECT_EQ(7u, channel);
+
+    auto publish = make_frame(1, 7, std::string("\x00\x3c\x00\x28", 4) + std::string(8, '\0'));
+    EXPECT_FALSE(asio_amqp::detail::is_channel_close(publish.data(), publish.size(), channel));
+}
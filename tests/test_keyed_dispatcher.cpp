@@ -0,0 +1,171 @@
+#include <gtest/gtest.h>
+#include <asio_amqp/keyed_dispatcher.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+TEST(test_keyed_dispatcher, preserves_order_per_key)
+{
+    constexpr std::size_t keys = 10, per_key = 500;
+
+    std::mutex mutex;
+    std::map<std::string, std::vector<std::uint64_t>> seen;
+    std::map<std::string, int> running;     // handlers of each key running now
+    int max_running_per_key = 0;
+    std::atomic<std::size_t> in_flight { 0 }, max_in_flight { 0 };
+    std::promise<void> done;
+    std::size_t handled = 0;
+
+    asio_amqp::keyed_dispatcher dispatcher(4, asio_amqp::keyed_dispatcher::by_routing_key());
+    auto handler = dispatcher.wrap([&](asio_amqp::message& msg)
+                                   {
+                                       {
+                                           std::lock_guard<std::mutex> lock(mutex);
+                                           max_running_per_key = std::max(max_running_per_key,
+                                                                          ++running[msg.routing_key]);
+                                       }
+                                       auto now = ++in_flight;
+                                       auto prev = max_in_flight.load();
+                                       while (now > prev and not max_in_flight.compare_exchange_weak(prev, now)) {}
+                                       // hold the first handlers until another key runs alongside
+                                       auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+                                       while (max_in_flight.load() < 2 and std::chrono::steady_clock::now() < give_up) {
+                                           std::this_thread::yield();
+                                       }
+                                       --in_flight;
+
+                                       std::lock_guard<std::mutex> lock(mutex);
+                                       --running[msg.routing_key];
+                                       seen[msg.routing_key].push_back(msg.delivery_tag);
+                                       if (++handled == keys * per_key) {
+                                           done.set_value();
+                                       }
+                                   });
+
+    std::map<std::string, std::vector<std::uint64_t>> expected;
+    for (std::uint64_t i = 0 ; i < keys * per_key ; ++i) {
+        asio_amqp::message msg;
+        msg.routing_key = "key" + std::to_string(i % keys);
+        msg.delivery_tag = i;
+        expected[msg.routing_key].push_back(i);
+        handler(msg);
+    }
+
+    ASSERT_EQ(std::future_status::ready,
+              done.get_future().wait_for(std::chrono::seconds(10)));
+    std::lock_guard<std::mutex> lock(mutex);
+    EXPECT_EQ(expected, seen);
+    EXPECT_EQ(1, max_running_per_key);
+    EXPECT_GE(max_in_flight.load(), 2u);
+}
+
+TEST(test_keyed_dispatcher, handler_exception_does_not_stop_the_key)
+{
+    std::promise<void> done;
+    asio_amqp::keyed_dispatcher dispatcher(2, asio_amqp::keyed_dispatcher::by_routing_key());
+    auto handler = dispatcher.wrap([&](asio_amqp::message& msg)
+                                   {
+                                       if (msg.delivery_tag == 1) {
+                                           throw std::runtime_error("expected");
+                                       }
+                                       done.set_value();
+                                   });
+    asio_amqp::message first, second;
+    first.delivery_tag = 1;
+    second.delivery_tag = 2;
+    handler(first);
+    handler(second);
+    EXPECT_EQ(std::future_status::ready,
+              done.get_future().wait_for(std::chrono::seconds(10)));
+}
+
+TEST(test_keyed_dispatcher, destruction_discards_queued_messages)
+{
+    std::promise<void> started, release;
+    auto released = release.get_future().share();
+    std::atomic<int> handled { 0 }, discarded { 0 };
+    asio_amqp::keyed_dispatcher::handler_type handler;
+    std::thread releaser;
+    {
+        asio_amqp::keyed_dispatcher dispatcher(1, asio_amqp::keyed_dispatcher::by_routing_key());
+        handler = dispatcher.wrap([&](asio_amqp::message& msg)
+                                  {
+                                      if (msg.delivery_tag == 0) {
+                                          started.set_value();
+                                          released.wait();
+                                      }
+                                      ++handled;
+                                  },
+                                  [&](asio_amqp::message&) { ++discarded; });
+        for (std::uint64_t i = 0 ; i < 5 ; ++i) {
+            asio_amqp::message msg;
+            msg.delivery_tag = i;
+            handler(msg);
+        }
+        started.get_future().wait();
+        releaser = std::thread([&] {
+            // let the destructor begin stopping before the first handler returns
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            release.set_value();
+        });
+    }
+    releaser.join();
+    EXPECT_EQ(1, handled);
+    EXPECT_EQ(4, discarded);
+
+    // the wrapped handler outlives the dispatcher
+    asio_amqp::message late;
+    handler(late);
+    EXPECT_EQ(1, handled);
+    EXPECT_EQ(5, discarded);
+}
+
+TEST(test_keyed_dispatcher, busy_key_does_not_starve_another)
+{
+    constexpr std::uint64_t flood = 1000;
+    std::promise<void> started, release, done;
+    auto released = release.get_future().share();
+    std::mutex mutex;
+    std::vector<std::string> order;
+
+    asio_amqp::keyed_dispatcher dispatcher(1, asio_amqp::keyed_dispatcher::by_routing_key());
+    auto handler = dispatcher.wrap([&](asio_amqp::message& msg)
+                                   {
+                                       if (msg.routing_key == "hot" and msg.delivery_tag == 0) {
+                                           started.set_value();
+                                           released.wait();
+                                       }
+                                       std::lock_guard<std::mutex> lock(mutex);
+                                       order.push_back(msg.routing_key);
+                                       if (order.size() == flood + 1) {
+                                           done.set_value();
+                                       }
+                                   });
+
+    // the one worker is busy with the first hot message while the rest queue
+    asio_amqp::message msg;
+    msg.routing_key = "hot";
+    handler(msg);
+    started.get_future().wait();
+    for (std::uint64_t i = 1 ; i < flood ; ++i) {
+        msg.routing_key = "hot";
+        msg.delivery_tag = i;
+        handler(msg);
+    }
+    msg.routing_key = "cold";
+    handler(msg);
+    release.set_value();
+
+    ASSERT_EQ(std::future_status::ready,
+              done.get_future().wait_for(std::chrono::seconds(10)));
+    std::lock_guard<std::mutex> lock(mutex);
+    auto cold = std::find(order.begin(), order.end(), "cold");
+    ASSERT_NE(order.end(), cold);
+    // within a batch or two of the hot key, not after all of it
+    EXPECT_LT(std::size_t(cold - order.begin()), std::size_t(100));
+}
@@ -0,0 +1,70 @@
+#include <gtest/gtest.h>
+#include <asio_amqp/memory_accountant.hpp>
+
+using asio_amqp::memory_accountant;
+
+TEST(test_memory_accountant, limit_and_peak)
+{
+    memory_accountant acc(100);
+    acc.charge(60);
+    EXPECT_FALSE(acc.over_limit());
+    acc.charge(40);
+    EXPECT_TRUE(acc.over_limit());
+    acc.release(50);
+    EXPECT_FALSE(acc.over_limit());
+
+    auto stats = acc.stats();
+    EXPECT_EQ(50u, stats.used);
+    EXPECT_EQ(100u, stats.peak);
+    EXPECT_EQ(100u, stats.limit);
+}
+
+TEST(test_memory_accountant, unlimited)
+{
+    memory_accountant acc;
+    acc.charge(std::size_t(1) << 40);
+    EXPECT_FALSE(acc.over_limit());
+}
+
+TEST(test_memory_accountant, parent_is_charged_and_limits_children)
+{
+    auto service = std::make_shared<memory_accountant>(100);
+    {
+        memory_accountant a(0, service), b(0, service);
+        a.charge(70);
+        EXPECT_FALSE(b.over_limit());
+        b.adjust(0, 30);
+        EXPECT_EQ(100u, service->used());
+        EXPECT_TRUE(a.over_limit());
+        EXPECT_TRUE(b.over_limit());
+        b.adjust(30, 10);
+        EXPECT_EQ(80u, service->used());
+    }
+    // destroying a child returns whatever it still held
+    EXPECT_EQ(0u, service->used());
+    EXPECT_EQ(100u, service->stats().peak);
+}
+
+TEST(test_memory_accountant, notifies_when_back_under_limit)
+{
+    auto service = std::make_shared<memory_accountant>(100);
+    memory_accountant conn(50, service);
+    int notified = 0;
+    EXPECT_FALSE(conn.notify_below_limit([&] { ++notified; }));
+
+    conn.charge(60);
+    EXPECT_TRUE(conn.notify_below_limit([&] { ++notified; }));
+    conn.release(5);
+    EXPECT_EQ(0, notified);
+    conn.release(10);
+    EXPECT_EQ(1, notified);
+    conn.release(45);
+    EXPECT_EQ(1, notified);
+
+    // a waiter on the service is woken by a release from any of its children
+    memory_accountant other(0, service);
+    other.charge(100);
+    EXPECT_TRUE(conn.notify_below_limit([&] { ++notified; }));
+    other.release(1);
+    EXPECT_EQ(2, notified);
+}
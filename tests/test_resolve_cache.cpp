@@ -0,0 +1,195 @@
+#include <gtest/gtest.h>
+#include <asio_amqp/resolve_cache.hpp>
+#include <stdexcept>
+#include <vector>
+
+using asio_amqp::resolve_cache;
+namespace asio = asio_amqp::asio;
+
+namespace {
+    /// A lookup that completes only when told to
+    struct fake_resolver
+    {
+        struct pending
+        {
+            asio::io_service* io_service;
+            resolve_cache::handler_type handler;
+        };
+
+        resolve_cache::lookup_function function()
+        {
+            return [this](asio::io_service& io_service,
+                          const resolve_cache::query_type&,
+                          resolve_cache::handler_type handler)
+            {
+                calls.push_back(pending { &io_service, std::move(handler) });
+            };
+        }
+
+        void answer(std::size_t i, const asio_amqp::system::error_code& ec, unsigned short port)
+        {
+            resolve_cache::results_type results;
+            if (not ec) {
+                results.emplace_back(asio::ip::address_v4::loopback(), port);
+            }
+            calls[i].handler(ec, results);
+        }
+
+        std::vector<pending> calls;
+    };
+
+    struct outcome
+    {
+        asio_amqp::system::error_code ec;
+        resolve_cache::results_type endpoints;
+        bool done = false;
+    };
+
+    resolve_cache::handler_type record(outcome& o)
+    {
+        return [&o](const asio_amqp::system::error_code& ec, const resolve_cache::results_type& endpoints)
+        {
+            o.ec = ec;
+            o.endpoints = endpoints;
+            o.done = true;
+        };
+    }
+
+    resolve_cache::query_type query(const char* host) {
+        return resolve_cache::query_type(host, "5672");
+    }
+
+    /// A clock that moves only when the test advances it
+    struct manual_clock
+    {
+        resolve_cache::now_function function()
+        {
+            return [this] { return now; };
+        }
+
+        resolve_cache::clock_type::time_point now = resolve_cache::clock_type::now();
+    };
+}
+
+TEST(test_resolve_cache, concurrent_requests_share_one_lookup)
+{
+    asio::io_service io_service;
+    fake_resolver resolver;
+    resolve_cache cache(asio_amqp::resolve_options(), resolver.function());
+
+    std::vector<outcome> outcomes(10);
+    for (auto& o : outcomes) {
+        cache.async_resolve(io_service, query("broker"), record(o));
+    }
+    ASSERT_EQ(1u, resolver.calls.size());
+    resolver.answer(0, {}, 5672);
+    io_service.run();
+    for (auto& o : outcomes) {
+        EXPECT_TRUE(o.done);
+        EXPECT_FALSE(o.ec);
+        ASSERT_EQ(1u, o.endpoints.size());
+        EXPECT_EQ(5672, o.endpoints[0].port());
+    }
+
+    // and later requests are answered from the cache
+    outcome later;
+    cache.async_resolve(io_service, query("broker"), record(later));
+    EXPECT_FALSE(later.done);       // always posted
+    io_service.reset();
+    io_service.run();
+    EXPECT_TRUE(later.done);
+    EXPECT_EQ(1u, resolver.calls.size());
+    EXPECT_EQ(1u, cache.stats().hits);
+    EXPECT_EQ(9u, cache.stats().waits);
+}
+
+TEST(test_resolve_cache, failures_are_cached_for_negative_ttl)
+{
+    asio::io_service io_service;
+    fake_resolver resolver;
+    resolve_cache cache(asio_amqp::resolve_options(), resolver.function());
+
+    outcome first, second;
+    cache.async_resolve(io_service, query("nowhere"), record(first));
+    resolver.answer(0, asio::error::host_not_found, 0);
+    cache.async_resolve(io_service, query("nowhere"), record(second));
+    io_service.run();
+
+    EXPECT_EQ(asio::error::host_not_found, first.ec);
+    EXPECT_EQ(asio::error::host_not_found, second.ec);
+    EXPECT_EQ(1u, resolver.calls.size());
+}
+
+TEST(test_resolve_cache, expired_results_are_served_while_revalidating)
+{
+    asio::io_service io_service;
+    fake_resolver resolver;
+    asio_amqp::resolve_options options;
+    options.ttl = std::chrono::seconds(1);
+    manual_clock clock;
+    resolve_cache cache(options, resolver.function(), clock.function());
+
+    outcome first;
+    cache.async_resolve(io_service, query("broker"), record(first));
+    resolver.answer(0, {}, 1000);
+    clock.now += std::chrono::milliseconds(1100);
+
+    // stale: answered at once, with one refresh started
+    outcome stale, stale_again;
+    cache.async_resolve(io_service, query("broker"), record(stale));
+    cache.async_resolve(io_service, query("broker"), record(stale_again));
+    ASSERT_EQ(2u, resolver.calls.size());
+    io_service.run();
+    ASSERT_EQ(1u, stale.endpoints.size());
+    EXPECT_EQ(1000, stale.endpoints[0].port());
+    EXPECT_EQ(2u, cache.stats().stale);
+
+    // a failed refresh keeps the old result
+    resolver.answer(1, asio::error::host_not_found, 0);
+    outcome kept;
+    cache.async_resolve(io_service, query("broker"), record(kept));
+    io_service.reset();
+    io_service.run();
+    EXPECT_FALSE(kept.ec);
+    ASSERT_EQ(1u, kept.endpoints.size());
+    EXPECT_EQ(1000, kept.endpoints[0].port());
+}
+
+TEST(test_resolve_cache, lookup_survives_a_stopped_requester)
+{
+    fake_resolver resolver;
+    resolve_cache cache(asio_amqp::resolve_options(), resolver.function());
+
+    asio::io_service first_io, second_io;
+    outcome first, second;
+    cache.async_resolve(first_io, query("broker"), record(first));
+    cache.async_resolve(second_io, query("broker"), record(second));
+    ASSERT_EQ(1u, resolver.calls.size());
+    EXPECT_NE(&first_io, resolver.calls[0].io_service);
+
+    // the io_service that started the lookup goes away before it completes
+    first_io.stop();
+    resolver.answer(0, {}, 5672);
+    second_io.run();
+    EXPECT_TRUE(second.done);
+    EXPECT_FALSE(second.ec);
+    EXPECT_FALSE(first.done);
+
+    // and the entry is not left looking up
+    outcome later;
+    cache.async_resolve(second_io, query("broker"), record(later));
+    second_io.reset();
+    second_io.run();
+    EXPECT_TRUE(later.done);
+    EXPECT_EQ(1u, resolver.calls.size());
+}
+
+TEST(test_resolve_cache, shared_rejects_different_options)
+{
+    asio_amqp::resolve_options options;
+    auto& cache = resolve_cache::shared(options);
+    EXPECT_EQ(&cache, &resolve_cache::shared(options));
+
+    options.ttl = std::chrono::seconds(1);
+    EXPECT_THROW(resolve_cache::shared(options), std::invalid_argument);
+}
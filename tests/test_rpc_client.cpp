@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+#include <asio_amqp/channel.hpp>
+#include <asio_amqp/connection.hpp>
+#include <asio_amqp/rpc_client.hpp>
+#include "stand_in_fixture.hpp"
+#include <chrono>
+#include <memory>
+#include <string>
+
+namespace asio = asio_amqp::asio;
+
+namespace {
+    /// An rpc_client started on its own channel of a stand-in broker, which
+    /// answers every request with its body
+    struct started_client
+    {
+        started_client()
+        {
+            asio_amqp::system::error_code error;
+            bool done = false;
+            chan.async_open(broker.uri(), [&](asio_amqp::system::error_code ec, unsigned) {
+                error = ec;
+                done = true;
+            });
+            EXPECT_TRUE(run_until(io_service, [&] { return done; }));
+            EXPECT_FALSE(error) << error.message();
+
+            client = std::make_unique<asio_amqp::rpc_client>(chan);
+            done = false;
+            client->async_start([&](asio_amqp::system::error_code ec) {
+                error = ec;
+                done = true;
+            });
+            EXPECT_TRUE(run_until(io_service, [&] { return done; }));
+            EXPECT_FALSE(error) << error.message();
+        }
+
+        stand_in_fixture broker;
+        asio::io_service io_service;
+        asio_amqp::connection conn { io_service };
+        asio_amqp::channel chan { io_service, conn };
+        std::unique_ptr<asio_amqp::rpc_client> client;
+    };
+
+    asio_amqp::message request(std::string routing_key, std::string body)
+    {
+        asio_amqp::message msg;
+        msg.routing_key = std::move(routing_key);
+        msg.body = std::move(body);
+        return msg;
+    }
+
+    /// The outcome of one call
+    struct call_result
+    {
+        bool done = false;
+        asio_amqp::system::error_code error;
+        asio_amqp::message reply;
+
+        auto handler()
+        {
+            return [this](asio_amqp::system::error_code ec, asio_amqp::message msg) {
+                done = true;
+                error = ec;
+                reply = std::move(msg);
+            };
+        }
+    };
+}
+
+TEST(test_rpc_client, call_completes_with_reply)
+{
+    started_client c;
+    call_result result;
+    c.client->async_call(request("requests", "ping"), std::chrono::seconds(10), result.handler());
+    ASSERT_TRUE(run_until(c.io_service, [&] { return result.done; }));
+    EXPECT_FALSE(result.error) << result.error.message();
+    EXPECT_EQ("ping", result.reply.body);
+    EXPECT_EQ(0u, c.client->outstanding());
+}
+
+TEST(test_rpc_client, call_times_out)
+{
+    started_client c;
+    call_result result;
+    auto start = std::chrono::steady_clock::now();
+    c.client->async_call(request(bench::stand_in_broker::unanswered, "ping"),
+                         std::chrono::milliseconds(50), result.handler());
+    ASSERT_TRUE(run_until(c.io_service, [&] { return result.done; }));
+    EXPECT_EQ(asio_amqp::system::error_code(asio_amqp::runtime_error_code::timed_out), result.error);
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(50));
+    EXPECT_EQ(0u, c.client->outstanding());
+}
+
+TEST(test_rpc_client, destruction_cancels_calls)
+{
+    started_client c;
+    call_result result;
+    c.client->async_call(request(bench::stand_in_broker::unanswered, "ping"),
+                         std::chrono::seconds(0), result.handler());
+    ASSERT_TRUE(run_until(c.io_service, [&] { return c.client->outstanding() == 1; }));
+    c.client.reset();
+    ASSERT_TRUE(run_until(c.io_service, [&] { return result.done; }));
+    EXPECT_EQ(asio_amqp::system::error_code(asio_amqp::runtime_error_code::cancelled), result.error);
+}
+
+TEST(test_rpc_client, publish_failure_fails_the_call)
+{
+    started_client c;
+    c.chan.get_impl_ptr()->close();
+    call_result result;
+    c.client->async_call(request("requests", "ping"), std::chrono::seconds(10), result.handler());
+    ASSERT_TRUE(run_until(c.io_service, [&] { return result.done; }));
+    EXPECT_EQ(asio_amqp::system::error_code(asio_amqp::logic_error_code::channel_not_open), result.error);
+    EXPECT_EQ(0u, c.client->outstanding());
+}
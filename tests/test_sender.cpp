@@ -0,0 +1,183 @@
+#include <gtest/gtest.h>
+#include <asio_amqp/detail/sender.hpp>
+#include <asio_amqp/detail/frame_encoder.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/read.hpp>
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace asio = asio_amqp::asio;
+using asio_amqp::detail::frame_encoder;
+
+namespace {
+    using socket_type = asio::local::stream_protocol::socket;
+
+    /// (type, channel) of each frame in data
+    std::vector<std::pair<int, int>> frames_of(const std::vector<char>& data)
+    {
+        std::vector<std::pair<int, int>> result;
+        auto p = reinterpret_cast<const unsigned char*>(data.data());
+        std::size_t pos = 0;
+        while (pos < data.size()) {
+            result.emplace_back(p[pos], asio_amqp::detail::read_frame_channel(p + pos));
+            pos += asio_amqp::detail::frame_overhead + asio_amqp::detail::read_frame_size(p + pos);
+        }
+        return result;
+    }
+
+    struct sender_test : ::testing::Test
+    {
+        sender_test()
+        : a(io_service), b(io_service), sender(a)
+        {
+            asio::local::connect_pair(a, b);
+            asio_amqp::send_options options;
+            options.max_write_bytes = 64;
+            sender.set_options(options);
+        }
+
+        /// queue count body frames on channel as one buffer
+        void queue_bodies(std::uint16_t channel, int count)
+        {
+            std::vector<char> frames;
+            frame_encoder encoder(frames);
+            std::string body(100, 'x');
+            for (int i = 0 ; i < count ; ++i) {
+                encoder.body_frames(channel, body.data(), body.size(), body.size());
+            }
+            sender.queue_for_send(std::move(frames));
+        }
+
+        std::vector<std::pair<int, int>> written()
+        {
+            io_service.run();
+            std::vector<char> data(sender_bytes);
+            asio::read(b, asio::buffer(data));
+            return frames_of(data);
+        }
+
+        asio::io_service io_service;
+        socket_type a, b;
+        asio_amqp::detail::sender<socket_type> sender;
+        std::size_t sender_bytes = 0;
+    };
+}
+
+TEST_F(sender_test, control_frames_overtake_other_channels)
+{
+    queue_bodies(1, 4);
+    sender.encode_control(0, 8, [](std::vector<char>& out) { frame_encoder(out).heartbeat(); });
+    sender.encode_control(2, 64, [](std::vector<char>& out) { frame_encoder(out).ack(2, 1, false); });
+    sender_bytes = 4 * 108 + 8 + 21;
+
+    // the first body frame was already being written when the others arrived
+    std::vector<std::pair<int, int>> expected {
+        { 3, 1 }, { 8, 0 }, { 1, 2 }, { 3, 1 }, { 3, 1 }, { 3, 1 }
+    };
+    EXPECT_EQ(expected, written());
+}
+
+TEST_F(sender_test, control_frames_keep_their_channel_order)
+{
+    queue_bodies(1, 3);
+    sender.encode_control(1, 64, [](std::vector<char>& out) { frame_encoder(out).ack(1, 1, false); });
+    sender_bytes = 3 * 108 + 21;
+
+    std::vector<std::pair<int, int>> expected {
+        { 3, 1 }, { 3, 1 }, { 3, 1 }, { 1, 1 }
+    };
+    EXPECT_EQ(expected, written());
+}
+
+TEST_F(sender_test, linger_window_flushes)
+{
+    asio_amqp::send_options options;
+    options.linger = std::chrono::milliseconds(50);
+    sender.set_options(options);
+    auto start = std::chrono::steady_clock::now();
+    queue_bodies(1, 1);
+    io_service.poll();
+    EXPECT_EQ(0u, b.available());
+    EXPECT_EQ(108u, sender.queued_bytes());
+    
+    sender_bytes = 108;
+    std::vector<std::pair<int, int>> expected { { 3, 1 } };
+    EXPECT_EQ(expected, written());
+    EXPECT_GE(std::chrono::steady_clock::now() - start, options.linger);
+}
+
+TEST_F(sender_test, batch_size_limit_flushes_before_linger_ends)
+{
+    asio_amqp::send_options options;
+    options.linger = std::chrono::seconds(60);
+    options.max_batch_bytes = 200;
+    sender.set_options(options);
+    auto start = std::chrono::steady_clock::now();
+    queue_bodies(1, 1);
+    io_service.poll();
+    EXPECT_EQ(0u, b.available());
+    
+    queue_bodies(1, 1);
+    sender_bytes = 2 * 108;
+    std::vector<std::pair<int, int>> expected { { 3, 1 }, { 3, 1 } };
+    EXPECT_EQ(expected, written());
+    EXPECT_LT(std::chrono::steady_clock::now() - start, options.linger);
+    EXPECT_EQ(0u, sender.pending_bytes());
+}
+
+TEST_F(sender_test, channel_is_released_once_its_frames_are_written)
+{
+    // one buffer: a body frame of channel 1, then two of channel 2; the first
+    // write takes only the channel 1 frame
+    std::vector<char> frames;
+    frame_encoder encoder(frames);
+    std::string body(100, 'x');
+    encoder.body_frames(1, body.data(), body.size(), body.size());
+    encoder.body_frames(2, body.data(), body.size(), body.size());
+    encoder.body_frames(2, body.data(), body.size(), body.size());
+    sender.queue_for_send(std::move(frames));
+
+    // channel 1 has nothing left queued, so its ack need not wait for channel 2
+    sender.encode_control(1, 64, [](std::vector<char>& out) { frame_encoder(out).ack(1, 1, false); });
+    sender_bytes = 3 * 108 + 21;
+
+    std::vector<std::pair<int, int>> expected {
+        { 3, 1 }, { 1, 1 }, { 3, 2 }, { 3, 2 }
+    };
+    EXPECT_EQ(expected, written());
+}
+
+TEST_F(sender_test, channel_0_is_released_once_the_protocol_header_is_written)
+{
+    // a write in progress lets what follows coalesce into one buffer: the
+    // protocol header, a channel 0 frame, then bodies of channel 1
+    queue_bodies(3, 1);
+    std::string header("AMQP\x00\x00\x09\x01", 8);
+    sender.queue_for_send(header.begin(), header.end());
+    sender.encode_for_send(8, [](std::vector<char>& out) { frame_encoder(out).heartbeat(); });
+    std::string body(100, 'x');
+    sender.encode_for_send(3 * 108, [&body](std::vector<char>& out)
+                           {
+                               frame_encoder encoder(out);
+                               for (int i = 0 ; i < 3 ; ++i) {
+                                   encoder.body_frames(1, body.data(), body.size(), body.size());
+                               }
+                           });
+
+    // the next write takes the header and the channel 0 frame, leaving the
+    // rest of the buffer queued
+    io_service.run_one();
+    sender.encode_control(0, 8, [](std::vector<char>& out) { frame_encoder(out).heartbeat(); });
+
+    io_service.run();
+    std::vector<char> data(108 + 8 + 8 + 8 + 3 * 108);
+    asio::read(b, asio::buffer(data));
+    EXPECT_EQ(header, std::string(data.data() + 108, 8));
+    data.erase(data.begin() + 108, data.begin() + 116);
+    std::vector<std::pair<int, int>> expected {
+        { 3, 3 }, { 8, 0 }, { 8, 0 }, { 3, 1 }, { 3, 1 }, { 3, 1 }
+    };
+    EXPECT_EQ(expected, frames_of(data));
+}
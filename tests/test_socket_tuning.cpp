@@ -0,0 +1,56 @@
+#include <gtest/gtest.h>
+#include <asio_amqp/detail/socket_tuning.hpp>
+
+namespace asio = asio_amqp::asio;
+using asio_amqp::detail::apply_socket_options;
+
+namespace {
+    struct open_socket
+    {
+        open_socket() {
+            socket.open(asio::ip::tcp::v4());
+        }
+
+        template<class Option>
+        int reported()
+        {
+            Option option;
+            socket.get_option(option);
+            return option.value();
+        }
+
+        asio::io_service io_service;
+        asio::ip::tcp::socket socket { io_service };
+    };
+}
+
+TEST(test_socket_tuning, buffer_sizes_are_set_and_reported)
+{
+    // small enough to stay under any wmem_max / rmem_max
+    asio_amqp::socket_options small, larger;
+    small.send_buffer = small.receive_buffer = 16 * 1024;
+    larger.send_buffer = larger.receive_buffer = 32 * 1024;
+
+    open_socket a, b;
+    auto effective_small = apply_socket_options(a.socket, small);
+    auto effective_larger = apply_socket_options(b.socket, larger);
+
+    EXPECT_EQ(a.reported<asio::socket_base::send_buffer_size>(), effective_small.send_buffer);
+    EXPECT_EQ(a.reported<asio::socket_base::receive_buffer_size>(), effective_small.receive_buffer);
+    // the kernel may round or double a request, but never shrinks it
+    EXPECT_GE(effective_small.send_buffer, small.send_buffer);
+    EXPECT_GE(effective_small.receive_buffer, small.receive_buffer);
+    EXPECT_LT(effective_small.send_buffer, effective_larger.send_buffer);
+    EXPECT_LT(effective_small.receive_buffer, effective_larger.receive_buffer);
+}
+
+TEST(test_socket_tuning, default_buffers_are_left_alone)
+{
+    open_socket s;
+    auto before_send = s.reported<asio::socket_base::send_buffer_size>();
+    auto before_receive = s.reported<asio::socket_base::receive_buffer_size>();
+    auto effective = apply_socket_options(s.socket, asio_amqp::socket_options());
+
+    EXPECT_EQ(before_send, effective.send_buffer);
+    EXPECT_EQ(before_receive, effective.receive_buffer);
+}
@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+#include <asio_amqp/trace.hpp>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+TEST(test_trace, ring_drains_in_order)
+{
+    asio_amqp::trace_ring ring(8);
+    for (std::uint64_t i = 0 ; i < 5 ; ++i) {
+        asio_amqp::trace_record rec {};
+        rec.event = std::uint16_t(asio_amqp::trace_event::consume);
+        rec.nargs = 1;
+        rec.args[0] = i;
+        ring.push(rec);
+    }
+    std::vector<std::uint64_t> seen;
+    auto lost = ring.drain([&](const asio_amqp::trace_record& rec) { seen.push_back(rec.args[0]); });
+    EXPECT_EQ(0u, lost);
+    EXPECT_EQ((std::vector<std::uint64_t>{ 0, 1, 2, 3, 4 }), seen);
+    EXPECT_EQ(0u, ring.drain([&](const asio_amqp::trace_record&) { FAIL(); }));
+}
+
+TEST(test_trace, ring_overwrites_oldest)
+{
+    asio_amqp::trace_ring ring(4);
+    for (std::uint64_t i = 0 ; i < 10 ; ++i) {
+        asio_amqp::trace_record rec {};
+        rec.args[0] = i;
+        ring.push(rec);
+    }
+    std::vector<std::uint64_t> seen;
+    auto lost = ring.drain([&](const asio_amqp::trace_record& rec) { seen.push_back(rec.args[0]); });
+    EXPECT_EQ(6u, lost);
+    EXPECT_EQ((std::vector<std::uint64_t>{ 6, 7, 8, 9 }), seen);
+}
+
+TEST(test_trace, concurrent_producers)
+{
+    asio_amqp::trace_ring ring(1 << 16);
+    asio_amqp::set_trace_sink(&ring);
+    std::vector<std::thread> threads;
+    for (int t = 0 ; t < 4 ; ++t) {
+        threads.emplace_back([t] {
+            for (std::uint64_t i = 0 ; i < 1000 ; ++i) {
+                ASIO_AMQP_ERROR(asio_amqp::trace_event::send_failure, t, i);
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    asio_amqp::set_trace_sink(nullptr);
+
+    std::size_t count = 0;
+    auto lost = ring.drain([&](const asio_amqp::trace_record& rec) {
+        EXPECT_EQ(2u, rec.nargs);
+        EXPECT_EQ(std::uint8_t(asio_amqp::trace_level::error), rec.level);
+        ++count;
+    });
+    EXPECT_EQ(0u, lost);
+    EXPECT_EQ(4000u, count);
+}
+
+TEST(test_trace, ring_never_delivers_torn_records)
+{
+    // a small ring so that producers lap each other and the reader
+    asio_amqp::trace_ring ring(4);
+    std::atomic<bool> done { false };
+    std::vector<std::thread> threads;
+    for (std::uint64_t t = 0 ; t < 4 ; ++t) {
+        threads.emplace_back([&ring, t] {
+            for (std::uint64_t i = 0 ; i < 100000 ; ++i) {
+                asio_amqp::trace_record rec {};
+                auto value = t << 32 | i;
+                rec.timestamp = value;
+                rec.nargs = 4;
+                for (auto& arg : rec.args) {
+                    arg = value;
+                }
+                ring.push(rec);
+            }
+        });
+    }
+    std::size_t torn = 0;
+    auto check = [&](const asio_amqp::trace_record& rec) {
+        for (auto arg : rec.args) {
+            if (arg != rec.timestamp) {
+                ++torn;
+            }
+        }
+    };
+    std::thread reader([&] {
+        while (not done) {
+            ring.drain(check);
+        }
+    });
+    for (auto& t : threads) t.join();
+    done = true;
+    reader.join();
+    ring.drain(check);
+    EXPECT_EQ(0u, torn);
+}